@@ -0,0 +1,280 @@
+/*
+ * calib_cache.c: Persistent cache of TSC calibration (read overhead,
+ *                TSC frequency, autotuned read method).
+ *
+ * Entry is keyed by CPU model, microcode, kernel release, read method and
+ * CPU, i.e. it is invalidated by changes of hardware and software which
+ * affect the cost of TSC reading. Valid entry is re-verified at startup by
+ * probes of about 100 reads and 10 ms instead of full calibration (autotune
+ * takes up to 10^6 runs of every method); the entry is recalibrated only
+ * if the probes drifted from it.
+ *
+ * File format (text, one entry per line):
+ *   model microcode kernel method cpu overhead tsc_hz best time
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "tsc_autotune.h"
+#include "calib_cache.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+#define CALIB_PROBE_MSEC 10
+#define CALIB_FULL_MSEC 100
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* cpuinfo_value: Copies value of the field ("name : value") without newline. */
+static void cpuinfo_value(const char *line, char *value, int size)
+{
+    const char *p = strchr(line, ':');
+    if (p == NULL)
+        return;
+    for (p++; *p == ' ' || *p == '\t'; p++)
+        ;
+    snprintf(value, size, "%s", p);
+    value[strcspn(value, "\n")] = '\0';
+}
+
+/*
+ * calib_cache_key: Fills key of the CPU: model name and microcode
+ * (/proc/cpuinfo), kernel release and read method name.
+ */
+void calib_cache_key(calib_key_t *key, const char *method, int cpu)
+{
+    char line[256], model[256] = "";
+    int processor = -1;
+
+    memset(key, 0, sizeof(*key));
+    snprintf(key->microcode, sizeof(key->microcode), "-");
+    snprintf(key->kernel, sizeof(key->kernel), "-");
+    snprintf(key->method, sizeof(key->method), "%s", method);
+    key->cpu = cpu;
+
+    /* Fields of the CPU's block (microcode may differ between CPUs) */
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strncmp(line, "processor", 9) == 0 &&
+                sscanf(line, "processor : %d", &processor) != 1)
+            {
+                processor = -1;
+            }
+            if (processor != cpu)
+                continue;
+            if (strncmp(line, "model name", 10) == 0)
+                cpuinfo_value(line, model, sizeof(model));
+            else if (strncmp(line, "microcode", 9) == 0)
+                cpuinfo_value(line, key->microcode, sizeof(key->microcode));
+        }
+        fclose(f);
+    }
+    key->model = fnv1a(FNV_OFFSET, model, strlen(model));
+
+    struct utsname uts;
+    if (uname(&uts) == 0)
+        snprintf(key->kernel, sizeof(key->kernel), "%s", uts.release);
+}
+
+static int key_equal(const calib_key_t *a, const calib_key_t *b)
+{
+    return a->model == b->model && a->cpu == b->cpu &&
+           strcmp(a->microcode, b->microcode) == 0 &&
+           strcmp(a->kernel, b->kernel) == 0 &&
+           strcmp(a->method, b->method) == 0;
+}
+
+/* parse_entry: Parses line of the cache file. Returns 0 on success. */
+static int parse_entry(const char *line, calib_entry_t *e)
+{
+    memset(e, 0, sizeof(*e));
+    if (line[0] == '#')
+        return -1;
+    return sscanf(line, "%" SCNx64 " %23s %71s %31s %d %" SCNu64 " %lf %31s %" SCNd64,
+                  &e->key.model, e->key.microcode, e->key.kernel, e->key.method, &e->key.cpu,
+                  &e->overhead, &e->tsc_hz, e->best, &e->time) == 9 ? 0 : -1;
+}
+
+static void write_entry(FILE *f, const calib_entry_t *e)
+{
+    fprintf(f, "%016" PRIx64 " %s %s %s %d %" PRIu64 " %.0f %s %" PRId64 "\n",
+            e->key.model, e->key.microcode, e->key.kernel, e->key.method, e->key.cpu,
+            e->overhead, e->tsc_hz, e->best, e->time);
+}
+
+/* calib_cache_lookup: Finds entry by key in the cache file. Returns 0 if found. */
+int calib_cache_lookup(const char *path, const calib_key_t *key, calib_entry_t *entry)
+{
+    char line[512];
+    calib_entry_t e;
+    int found = -1;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (parse_entry(line, &e) == 0 && key_equal(&e.key, key)) {
+            *entry = e;
+            found = 0;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+/*
+ * calib_cache_store: Replaces entry with the same key in the cache file
+ *                    (or appends it). Returns 0 on success.
+ */
+int calib_cache_store(const char *path, const calib_entry_t *entry)
+{
+    char line[512], tmp[512];
+    calib_entry_t e;
+
+    /* New file is renamed over the old one: concurrent readers see either */
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL)
+        return -1;
+    fprintf(out, "# tscbench calibration cache: model microcode kernel method cpu"
+                 " overhead tsc_hz best time\n");
+    FILE *in = fopen(path, "r");
+    if (in != NULL) {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (parse_entry(line, &e) == 0 && !key_equal(&e.key, &entry->key))
+                write_entry(out, &e);
+        }
+        fclose(in);
+    }
+    write_entry(out, entry);
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* find_method: Returns index of available read method by name or -1. */
+static int find_method(const char *name)
+{
+    for (int i = 0; tsc_read_methods[i].name != NULL; i++) {
+        if (strcmp(tsc_read_methods[i].name, name) == 0)
+            return tsc_read_methods[i].need_rdtscp && !is_rdtscp_available() ? -1 : i;
+    }
+    return -1;
+}
+
+static double drift(double probe, double value)
+{
+    return value > 0.0 ? fabs(probe - value) / value * 100.0 : 100.0;
+}
+
+/*
+ * calib_cache_calibrate: Returns calibration of read method (method < 0
+ * selects method by tsc_autotune) on the current CPU. Valid entry of the
+ * cache is re-verified by quick probes of overhead and TSC frequency; full
+ * calibration is done and stored only if the entry is missed, expired or
+ * drifted. Returns 0 on success, -1 if no read method is selected.
+ */
+int calib_cache_calibrate(calib_t *calib, const char *path, int method, int cpu)
+{
+    calib_entry_t *e = &calib->entry;
+    calib_key_t key;
+
+    memset(calib, 0, sizeof(*calib));
+    calib->method = method;
+    if (cpu < 0)
+        cpu = sched_getcpu();
+    calib_cache_key(&key, method >= 0 ? tsc_read_methods[method].name : "auto", cpu);
+
+    int64_t now = (int64_t)time(NULL);
+    calib->status = CALIB_MISSED;
+    if (calib_cache_lookup(path, &key, e) == 0) {
+        int m = find_method(e->best);
+        if (m < 0 || (method >= 0 && m != method)) {
+            calib->status = CALIB_MISSED;
+        } else if (now - e->time > CALIB_CACHE_MAX_AGE || now < e->time) {
+            calib->status = CALIB_EXPIRED;
+        } else {
+            calib->overhead_drift = drift(tsc_read_methods[m].overhead(), e->overhead);
+            calib->tsc_hz_drift = drift(measure_tsc_frequency(CALIB_PROBE_MSEC), e->tsc_hz);
+            if (calib->overhead_drift > CALIB_OVERHEAD_DRIFT ||
+                calib->tsc_hz_drift > CALIB_TSC_HZ_DRIFT)
+            {
+                calib->status = CALIB_DRIFTED;
+            } else {
+                calib->method = m;
+                calib->status = CALIB_CACHED;
+                return 0;
+            }
+        }
+    }
+
+    /* Full calibration */
+    if (method < 0) {
+        tsc_autotune_score_t scores[32];
+        int nscores;
+        method = tsc_autotune(scores, 32, &nscores);
+        tsc_autotune_report(scores, nscores, method, stdout);
+        if (method < 0)
+            return -1;
+    }
+    calib->method = method;
+    e->key = key;
+    e->overhead = tsc_read_methods[method].overhead();
+    e->tsc_hz = measure_tsc_frequency(CALIB_FULL_MSEC);
+    snprintf(e->best, sizeof(e->best), "%s", tsc_read_methods[method].name);
+    e->time = now;
+    if (calib_cache_store(path, e) != 0)
+        fprintf(stderr, "# [Warning!] Can't write calibration cache %s\n", path);
+    return 0;
+}
+
+/* calib_cache_report: Prints calibration and its source. */
+void calib_cache_report(calib_t *calib, FILE *f)
+{
+    calib_entry_t *e = &calib->entry;
+
+    fprintf(f, "# Calibration: %s (CPU %d, microcode %s, kernel %s, method %s)\n",
+            calib_status_name(calib->status), e->key.cpu, e->key.microcode,
+            e->key.kernel, e->key.method);
+    fprintf(f, "# [Method]       [Overhead] [TSC, MHz]   [Overhead drift] [TSC drift] [Age, s]\n");
+    fprintf(f, "  %-14s %-10" PRIu64 " %-12.2f %-16.2f %-11.3f %" PRId64 "\n",
+            e->best, e->overhead, e->tsc_hz / 1E6, calib->overhead_drift,
+            calib->tsc_hz_drift, (int64_t)time(NULL) - e->time);
+}
+
+/* calib_status_name: Returns name of calibration status. */
+const char *calib_status_name(int status)
+{
+    switch (status) {
+    case CALIB_CACHED: return "cached";
+    case CALIB_MISSED: return "missed, recalibrated";
+    case CALIB_EXPIRED: return "expired, recalibrated";
+    case CALIB_DRIFTED: return "drifted, recalibrated";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * calib_cache.h: Persistent cache of TSC calibration (read overhead,
+ *                TSC frequency, autotuned read method).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef CALIB_CACHE_H
+#define CALIB_CACHE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define CALIB_CACHE_DEFAULT "tscbench.calib"
+#define CALIB_CACHE_MAX_AGE (7 * 24 * 3600)     /* Seconds */
+#define CALIB_OVERHEAD_DRIFT 10.0               /* Percents */
+#define CALIB_TSC_HZ_DRIFT 0.5                  /* Percents */
+
+enum {
+    CALIB_CACHED = 0,           /* Entry is valid and passed re-verification */
+    CALIB_MISSED = 1,           /* No entry for the key */
+    CALIB_EXPIRED = 2,          /* Entry is older than CALIB_CACHE_MAX_AGE */
+    CALIB_DRIFTED = 3           /* Re-verification probe differs from the entry */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t model;             /* Hash of CPU model name */
+    char microcode[24];
+    char kernel[72];            /* Kernel release */
+    char method[32];            /* Read method or "auto" */
+    int cpu;
+} calib_key_t;
+
+typedef struct {
+    calib_key_t key;
+    uint64_t overhead;          /* Minimal overhead of read method (ticks) */
+    double tsc_hz;
+    char best[32];              /* Read method of the overhead (selected by autotune for "auto") */
+    int64_t time;               /* Time of calibration (seconds since the Epoch) */
+} calib_entry_t;
+
+typedef struct {
+    calib_entry_t entry;
+    int status;                 /* CALIB_* */
+    int method;                 /* Index of read method in tsc_read_methods */
+    double overhead_drift;      /* Drift found by re-verification (percents) */
+    double tsc_hz_drift;
+} calib_t;
+
+/*
+ * calib_cache_key: Fills key of the CPU: model name and microcode
+ * (/proc/cpuinfo), kernel release and read method name.
+ */
+void calib_cache_key(calib_key_t *key, const char *method, int cpu);
+
+/* calib_cache_lookup: Finds entry by key in the cache file. Returns 0 if found. */
+int calib_cache_lookup(const char *path, const calib_key_t *key, calib_entry_t *entry);
+
+/*
+ * calib_cache_store: Replaces entry with the same key in the cache file
+ *                    (or appends it). Returns 0 on success.
+ */
+int calib_cache_store(const char *path, const calib_entry_t *entry);
+
+/*
+ * calib_cache_calibrate: Returns calibration of read method (method < 0
+ * selects method by tsc_autotune) on the current CPU. Valid entry of the
+ * cache is re-verified by quick probes of overhead and TSC frequency; full
+ * calibration is done and stored only if the entry is missed, expired or
+ * drifted. Returns 0 on success, -1 if no read method is selected.
+ */
+int calib_cache_calibrate(calib_t *calib, const char *path, int method, int cpu);
+
+/* calib_cache_report: Prints calibration and its source. */
+void calib_cache_report(calib_t *calib, FILE *f);
+
+/* calib_status_name: Returns name of calibration status. */
+const char *calib_status_name(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CALIB_CACHE_H */
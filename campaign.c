@@ -0,0 +1,386 @@
+/*
+ * campaign.c: Parallel campaign of benchmark runs across isolated cores.
+ *
+ * Every run is a child "tscbench run -c cpu -M method [-P pages] -S store"
+ * (the child applies preflight isolation to its CPU). The parent stays
+ * unpinned, loads the record of the child from its temporary store and
+ * appends a row to the output, which is the checkpoint of the campaign:
+ * an interrupted campaign is resumed by running it with the same output.
+ * Only runs with status 0 are done; failed runs are repeated on resume.
+ * The header keeps the matrix of the campaign, and output of another
+ * matrix (config or kernel of the build) is refused. Runs are ordered
+ * trial-major, so partial campaigns cover every configuration evenly.
+ *
+ * The kernel is not an axis of the config: "tscbench run" measures CODE()
+ * compiled into the binary (its read method loops are instantiated for
+ * it), so a campaign over kernels is a campaign per build and output.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "numa_mem.h"
+#include "results_store.h"
+#include "campaign.h"
+
+enum {
+    LIST_MAX = 1024
+};
+
+typedef struct {
+    pid_t pid;                  /* 0 if slot is free */
+    int run;
+    int cpu;
+    char store[512];
+} campaign_slot_t;
+
+/* read_cpu_list: Reads CPU list of /sys/devices/system/cpu/cpu<cpu>/<name>. Returns its size. */
+static int read_cpu_list(int cpu, const char *name, int *list, int maxlist)
+{
+    char path[256], buf[1024];
+    int n = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+    if (fgets(buf, sizeof(buf), f) != NULL)
+        n = numa_mem_parse_list(buf, list, maxlist);
+    fclose(f);
+    return n;
+}
+
+/* llc_cpus: Stores CPUs sharing the last level cache with cpu. Returns their number. */
+static int llc_cpus(int cpu, int *list, int maxlist)
+{
+    char name[64];
+    int n = 0, maxlevel = 0;
+
+    for (int index = 0; index < 8; index++) {
+        int level;
+        snprintf(name, sizeof(name), "cache/index%d/level", index);
+        if (read_cpu_list(cpu, name, &level, 1) != 1)
+            break;
+        if (level >= maxlevel) {
+            maxlevel = level;
+            snprintf(name, sizeof(name), "cache/index%d/shared_cpu_list", index);
+            n = read_cpu_list(cpu, name, list, maxlist);
+        }
+    }
+    return n;
+}
+
+static int list_contains(const int *list, int n, int cpu)
+{
+    for (int i = 0; i < n; i++) {
+        if (list[i] == cpu)
+            return 1;
+    }
+    return 0;
+}
+
+static void add_value(char values[][CAMPAIGN_VALUE_LEN], int *n, const char *value)
+{
+    if (*n < CAMPAIGN_VALUES_MAX)
+        snprintf(values[(*n)++], CAMPAIGN_VALUE_LEN, "%s", value);
+}
+
+/*
+ * campaign_config_load: Reads config of lines "key value ...": methods,
+ * pages, trials ('#' starts a comment). Missing keys get defaults (std,
+ * static, 1). Returns 0 on success.
+ */
+int campaign_config_load(const char *path, campaign_config_t *cfg)
+{
+    char line[1024];
+    int lineno = 0;
+
+    memset(cfg, 0, sizeof(*cfg));
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "# Error: can't open campaign config %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        line[strcspn(line, "#\n")] = '\0';
+        char *key = strtok(line, " \t");
+        if (key == NULL)
+            continue;
+        for (char *val = strtok(NULL, " \t,"); val != NULL; val = strtok(NULL, " \t,")) {
+            if (strcmp(key, "methods") == 0) {
+                add_value(cfg->methods, &cfg->nmethods, val);
+            } else if (strcmp(key, "pages") == 0) {
+                add_value(cfg->pages, &cfg->npages, val);
+            } else if (strcmp(key, "trials") == 0) {
+                cfg->ntrials = atoi(val);
+            } else {
+                fprintf(stderr, "# Error: %s:%d: unknown key '%s' (methods, pages, trials)\n",
+                        path, lineno, key);
+                fclose(f);
+                return -1;
+            }
+        }
+    }
+    fclose(f);
+
+    if (cfg->nmethods == 0)
+        add_value(cfg->methods, &cfg->nmethods, "std");
+    if (cfg->npages == 0)
+        add_value(cfg->pages, &cfg->npages, "static");
+    if (cfg->ntrials < 1)
+        cfg->ntrials = 1;
+    return 0;
+}
+
+/* campaign_matrix: Formats the matrix as one line (stored in the output header). */
+void campaign_matrix(const campaign_config_t *cfg, char *buf, int size)
+{
+    int len = snprintf(buf, size, "kernel %s methods", cfg->kernel);
+    for (int i = 0; i < cfg->nmethods && len < size; i++)
+        len += snprintf(buf + len, size - len, " %s", cfg->methods[i]);
+    if (len < size)
+        len += snprintf(buf + len, size - len, " pages");
+    for (int i = 0; i < cfg->npages && len < size; i++)
+        len += snprintf(buf + len, size - len, " %s", cfg->pages[i]);
+    if (len < size)
+        snprintf(buf + len, size - len, " trials %d", cfg->ntrials);
+}
+
+/*
+ * campaign_slots: Selects CPUs of the process for concurrent runs: no two
+ * CPUs share a physical core (SMT siblings) and, if by_llc, a last level
+ * cache. Returns number of CPUs stored into cpus.
+ */
+int campaign_slots(int by_llc, int *cpus, int maxcpus)
+{
+    static int list[LIST_MAX];
+    cpu_set_t allowed;
+    int n = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < maxcpus; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        int conflict = 0;
+        int nlist = read_cpu_list(cpu, "topology/thread_siblings_list", list, LIST_MAX);
+        for (int i = 0; i < n && !conflict; i++)
+            conflict = list_contains(list, nlist, cpus[i]);
+        if (by_llc && !conflict) {
+            nlist = llc_cpus(cpu, list, LIST_MAX);
+            for (int i = 0; i < n && !conflict; i++)
+                conflict = list_contains(list, nlist, cpus[i]);
+        }
+        if (!conflict)
+            cpus[n++] = cpu;
+    }
+    return n;
+}
+
+/* run_config: Returns method and pages of the run (trial-major order). */
+static void run_config(const campaign_config_t *cfg, int run, const char **method,
+                       const char **pages, int *trial)
+{
+    int nconfigs = cfg->nmethods * cfg->npages;
+    int config = run % nconfigs;
+    *trial = run / nconfigs;
+    *method = cfg->methods[config / cfg->npages];
+    *pages = cfg->pages[config % cfg->npages];
+}
+
+/*
+ * load_done: Marks runs with status 0 in output. Returns number of runs
+ *            found or -1 if output belongs to another matrix.
+ */
+static int load_done(const char *output, const char *matrix, char *done, int nruns)
+{
+    char line[CAMPAIGN_MATRIX_LEN + 64], found[CAMPAIGN_MATRIX_LEN + 64] = "none";
+    int n = 0, nlines = 0;
+
+    FILE *f = fopen(output, "r");
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        int run, status;
+        nlines++;
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "# Matrix: ", 10) == 0) {
+            snprintf(found, sizeof(found), "%s", line + 10);
+            continue;
+        }
+        /* [Run] [Method] [Pages] [Trial] [CPU] [Runs] [Mean] [StdDev] [Min] [Status] */
+        if (line[0] == '#' ||
+            sscanf(line, "%d %*s %*s %*d %*d %*s %*s %*s %*s %d", &run, &status) != 2)
+        {
+            continue;
+        }
+        if (status == 0 && run >= 0 && run < nruns && !done[run]) {
+            done[run] = 1;
+            n++;
+        }
+    }
+    fclose(f);
+    if (nlines > 0 && strcmp(found, matrix) != 0) {
+        fprintf(stderr, "# Error: campaign output %s is of another matrix\n"
+                        "#   output: %s\n#   config: %s\n", output, found, matrix);
+        return -1;
+    }
+    return n;
+}
+
+static pid_t start_run(const campaign_config_t *cfg, campaign_slot_t *slot)
+{
+    const char *method, *pages;
+    char cpu[16];
+    int trial;
+
+    run_config(cfg, slot->run, &method, &pages, &trial);
+    snprintf(cpu, sizeof(cpu), "%d", slot->cpu);
+    unlink(slot->store);
+
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+
+    /* Child: output of the run is not needed, the result is in the store */
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    char *argv[] = {"/proc/self/exe", "run", "-c", cpu, "-M", (char *)method, "-S", slot->store,
+                    "-P", (char *)pages, NULL};
+    if (strcmp(pages, "static") == 0)
+        argv[8] = NULL;
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+static void finish_run(const campaign_config_t *cfg, campaign_slot_t *slot, int status, FILE *out)
+{
+    const char *method, *pages;
+    results_record_t *recs = NULL;
+    int trial;
+
+    run_config(cfg, slot->run, &method, &pages, &trial);
+    int exitcode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    int nrecs = results_store_load(slot->store, &recs);
+    if (nrecs > 0) {
+        results_record_t *r = &recs[nrecs - 1];
+        fprintf(out, "  %-6d %-14s %-8s %-7d %-5d %-8" PRIu64 " %-18.2f %-18.2f %-18.2f %d\n",
+                slot->run, method, pages, trial, slot->cpu, r->nruns, r->mean, r->stddev, r->min,
+                exitcode);
+    } else {
+        fprintf(out, "  %-6d %-14s %-8s %-7d %-5d %-8d %-18s %-18s %-18s %d\n",
+                slot->run, method, pages, trial, slot->cpu, 0, "-", "-", "-",
+                exitcode != 0 ? exitcode : 1);
+    }
+    fflush(out);
+    free(recs);
+    unlink(slot->store);
+    slot->pid = 0;
+}
+
+/*
+ * campaign_run: Runs all configurations, at most one run per CPU of slots
+ * at a time (every run is "tscbench run -c cpu ..." in a child process).
+ * Results are appended to output as rows, one per finished run; runs
+ * already present in output are skipped (resume). Returns number of
+ * failed runs or -1 on error.
+ */
+int campaign_run(const campaign_config_t *cfg, const char *output, const int *slots, int nslots,
+                 FILE *log)
+{
+    campaign_slot_t active[CAMPAIGN_SLOTS_MAX];
+    int nruns = cfg->nmethods * cfg->npages * cfg->ntrials;
+
+    if (nslots < 1 || nslots > CAMPAIGN_SLOTS_MAX || nruns < 1)
+        return -1;
+    char *done = calloc(nruns, 1);
+    if (done == NULL) {
+        fprintf(stderr, "# No enough memory for campaign\n");
+        return -1;
+    }
+    char matrix[CAMPAIGN_MATRIX_LEN];
+    campaign_matrix(cfg, matrix, sizeof(matrix));
+    int ndone = load_done(output, matrix, done, nruns);
+    if (ndone < 0) {
+        free(done);
+        return -1;
+    }
+    FILE *out = fopen(output, "a");
+    if (out == NULL) {
+        fprintf(stderr, "# Error: can't open campaign output %s\n", output);
+        free(done);
+        return -1;
+    }
+    if (ftell(out) == 0) {
+        fprintf(out, "# Campaign: %d methods x %d pages x %d trials\n",
+                cfg->nmethods, cfg->npages, cfg->ntrials);
+        fprintf(out, "# Matrix: %s\n", matrix);
+        fprintf(out, "# [Run]  [Method]       [Pages]  [Trial] [CPU] [Runs]   [Mean]             [StdDev]           [Min]              [Status]\n");
+        fflush(out);
+    }
+    fprintf(log, "# Campaign: %d runs, %d done, %d slots (CPUs", nruns, ndone, nslots);
+    for (int i = 0; i < nslots; i++) {
+        fprintf(log, " %d", slots[i]);
+        active[i].pid = 0;
+        active[i].cpu = slots[i];
+        snprintf(active[i].store, sizeof(active[i].store), "%.480s.cpu%d.store", output, slots[i]);
+    }
+    fprintf(log, ")\n");
+
+    int next = 0, nactive = 0, nfailed = 0;
+    for (;;) {
+        for (int i = 0; i < nslots; i++) {
+            while (next < nruns && done[next])
+                next++;
+            if (active[i].pid != 0 || next >= nruns)
+                continue;
+            active[i].run = next++;
+            if ( (active[i].pid = start_run(cfg, &active[i])) < 0) {
+                fprintf(stderr, "# Error: can't start run %d\n", active[i].run);
+                active[i].pid = 0;
+                nfailed++;
+                continue;
+            }
+            nactive++;
+        }
+        if (nactive == 0)
+            break;
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            break;
+        for (int i = 0; i < nslots; i++) {
+            if (active[i].pid == pid) {
+                finish_run(cfg, &active[i], status, out);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                    nfailed++;
+                nactive--;
+                ndone++;
+                fprintf(log, "# Progress: %d of %d runs\r", ndone, nruns);
+                fflush(log);
+                break;
+            }
+        }
+    }
+    fprintf(log, "\n");
+    fclose(out);
+    free(done);
+    return nfailed;
+}
@@ -0,0 +1,66 @@
+/*
+ * campaign.h: Parallel campaign of benchmark runs across isolated cores.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef CAMPAIGN_H
+#define CAMPAIGN_H
+
+#include <stdio.h>
+
+#define CAMPAIGN_VALUES_MAX 16
+#define CAMPAIGN_VALUE_LEN 16
+#define CAMPAIGN_SLOTS_MAX 256
+#define CAMPAIGN_MATRIX_LEN 1024
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Matrix of run configurations: every combination is run ntrials times.
+ * The measured kernel is CODE() of the binary (measured_code.h), i.e. a
+ * kernel axis is a campaign per build.
+ */
+typedef struct {
+    char kernel[CAMPAIGN_VALUE_LEN * 2];                    /* CODE() of the build */
+    char methods[CAMPAIGN_VALUES_MAX][CAMPAIGN_VALUE_LEN];  /* TSC read methods (-M) */
+    int nmethods;
+    char pages[CAMPAIGN_VALUES_MAX][CAMPAIGN_VALUE_LEN];    /* Pages (-P), "static" for none */
+    int npages;
+    int ntrials;
+} campaign_config_t;
+
+/*
+ * campaign_config_load: Reads config of lines "key value ...": methods,
+ * pages, trials ('#' starts a comment). Missing keys get defaults (std,
+ * static, 1). Returns 0 on success.
+ */
+int campaign_config_load(const char *path, campaign_config_t *cfg);
+
+/* campaign_matrix: Formats the matrix as one line (stored in the output header). */
+void campaign_matrix(const campaign_config_t *cfg, char *buf, int size);
+
+/*
+ * campaign_slots: Selects CPUs of the process for concurrent runs: no two
+ * CPUs share a physical core (SMT siblings) and, if by_llc, a last level
+ * cache. Returns number of CPUs stored into cpus.
+ */
+int campaign_slots(int by_llc, int *cpus, int maxcpus);
+
+/*
+ * campaign_run: Runs all configurations, at most one run per CPU of slots
+ * at a time (every run is "tscbench run -c cpu ..." in a child process).
+ * Results are appended to output as rows, one per finished run; runs
+ * with status 0 in output are skipped (resume). Output of another matrix
+ * is not resumed. Returns number of failed runs or -1 on error.
+ */
+int campaign_run(const campaign_config_t *cfg, const char *output, const int *slots, int nslots,
+                 FILE *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CAMPAIGN_H */
@@ -0,0 +1,313 @@
+/*
+ * clock_backend.c: Clock backends (TSC, clock_gettime, perf task-clock).
+ *
+ * TSC backend uses the selected read method (compiled method by default):
+ * its overhead loops from tsc_read_methods[] and kernel_measure(). Measurement
+ * loops of other backends are instantiated by macro (as read methods in tsc_x86.c), so
+ * reads of the clock are inlined into loops and overheads of backends are
+ * comparable. clock_gettime() of MONOTONIC and
+ * MONOTONIC_RAW goes through the vDSO when the clocksource allows it;
+ * perf task-clock is read by read(2) of a software counter of the thread.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "mathstat.h"
+#include "kernel_measure.h"
+#include "clock_backend.h"
+
+static double tsc_hz = 0.0;
+static const tsc_read_method_t *tsc_method = NULL;
+static int perf_fd = -1;
+
+static inline uint64_t read_monotonic()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t read_monotonic_raw()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t read_task_clock()
+{
+    uint64_t val = 0;
+    if (read(perf_fd, &val, sizeof(val)) != sizeof(val))
+        return 0;
+    return val;
+}
+
+static int open_always()
+{
+    return 0;
+}
+
+static void close_none()
+{
+}
+
+static int open_tsc()
+{
+    if (!is_tsc_available())
+        return -1;
+    for (int i = 0; tsc_method == NULL && tsc_read_methods[i].name != NULL; i++) {
+        /* Compiled method if none is selected */
+        if (strcmp(tsc_read_methods[i].name, TSC_READ_METHOD_NAME) == 0)
+            tsc_method = &tsc_read_methods[i];
+    }
+    if (tsc_method == NULL)
+        return -1;
+    if (tsc_hz == 0.0)
+        tsc_hz = measure_tsc_frequency(100);
+    return 0;
+}
+
+static double frequency_tsc()
+{
+    return tsc_hz;
+}
+
+static double frequency_ns()
+{
+    return 1E9;
+}
+
+static double resolution_tsc()
+{
+    return 1.0;
+}
+
+static double resolution_monotonic()
+{
+    struct timespec ts;
+    return clock_getres(CLOCK_MONOTONIC, &ts) == 0 ? ts.tv_sec * 1E9 + ts.tv_nsec : 0.0;
+}
+
+static double resolution_monotonic_raw()
+{
+    struct timespec ts;
+    return clock_getres(CLOCK_MONOTONIC_RAW, &ts) == 0 ? ts.tv_sec * 1E9 + ts.tv_nsec : 0.0;
+}
+
+static double resolution_unknown()
+{
+    return 0.0;
+}
+
+static int open_task_clock()
+{
+    struct perf_event_attr attr;
+
+    if (perf_fd >= 0)
+        return 0;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_SW_TASK_CLOCK;
+    attr.exclude_kernel = 1;        /* Allowed by perf_event_paranoid 2 */
+    attr.exclude_hv = 1;
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd < 0)
+        return -1;
+    ioctl(perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    return 0;
+}
+
+static void close_task_clock()
+{
+    if (perf_fd >= 0)
+        close(perf_fd);
+    perf_fd = -1;
+}
+
+/*
+ * granularity_tsc: Minimal nonzero difference of back-to-back rdtsc() -- TSC
+ *                  increment, not the cost of serialized reads.
+ */
+static uint64_t granularity_tsc()
+{
+    uint64_t mingap = UINT64_MAX;
+    for (int i = 0; i < 100; i++) {
+        uint64_t t0 = rdtsc(), t1;
+        for (int j = 0; j < 1000000 && (t1 = rdtsc()) == t0; j++)
+            ;
+        if (t1 > t0 && t1 - t0 < mingap)
+            mingap = t1 - t0;
+    }
+    return mingap == UINT64_MAX ? 0 : mingap;
+}
+
+static uint64_t overhead_min_tsc()
+{
+    return tsc_method->overhead();
+}
+
+static int overhead_stat_tsc(stat_sample_t *stat)
+{
+    return tsc_method->overhead_stat(stat);
+}
+
+static int measure_tsc(void (*func)(void *), void *arg, uint64_t overhead, kernel_result_t *res)
+{
+    return kernel_measure(tsc_method, func, arg, overhead, res);
+}
+
+/*
+ * DEFINE_CLOCK_FUNCS: Defines granularity_<clock>(), overhead_min_<clock>(),
+ * overhead_stat_<clock>() and measure_<clock>() for the read function of
+ * a clock with coarse resolution: loops of tsc_read_methods[] and
+ * kernel_measure() which keep zero differences.
+ */
+#define DEFINE_CLOCK_FUNCS(clock, read)                                             \
+static uint64_t granularity_##clock()                                               \
+{                                                                                   \
+    uint64_t mingap = UINT64_MAX;                                                   \
+    for (int i = 0; i < 100; i++) {                                                 \
+        uint64_t t0 = read(), t1;                                                   \
+        /* Spin until the clock advances */                                         \
+        for (int j = 0; j < 1000000 && (t1 = read()) == t0; j++)                    \
+            ;                                                                       \
+        if (t1 > t0 && t1 - t0 < mingap)                                            \
+            mingap = t1 - t0;                                                       \
+    }                                                                               \
+    return mingap == UINT64_MAX ? 0 : mingap;                                       \
+}                                                                                   \
+                                                                                    \
+static uint64_t overhead_min_##clock()                                              \
+{                                                                                   \
+    volatile uint64_t t0, t1, minticks = (uint64_t)~0x1;                            \
+    for (int i = 0, n = 0; i < 100 && n < 100000; n++) {                            \
+        t0 = read();                                                                \
+        t1 = read();                                                                \
+        if (t1 > t0) {                                                              \
+            if (t1 - t0 < minticks)                                                 \
+                minticks = t1 - t0;                                                 \
+            i++;                                                                    \
+        }                                                                           \
+    }                                                                               \
+    return minticks == (uint64_t)~0x1 ? 0 : minticks;                               \
+}                                                                                   \
+                                                                                    \
+static int overhead_stat_##clock(stat_sample_t *stat)                               \
+{                                                                                   \
+    enum {                                                                          \
+        NRUNS_MIN = 100,                                                            \
+        NRUNS_MAX = 1000000                                                         \
+    };                                                                              \
+    volatile uint64_t t0, t1;                                                       \
+    int nrejects = 0;                                                               \
+                                                                                    \
+    for (int i = 0; i < 10; i++) {                                                  \
+        t0 = read();                                                                \
+        t1 = read();                                                                \
+    }                                                                               \
+    int nruns = NRUNS_MIN;                                                          \
+    do {                                                                            \
+        stat_sample_clean(stat);                                                    \
+        /* Zero differences of a coarse clock are rejected but counted */           \
+        for (int i = 0; i < nruns; i++) {                                           \
+            t0 = read();                                                            \
+            t1 = read();                                                            \
+            if (t1 > t0)                                                            \
+                stat_sample_add(stat, (double)(t1 - t0));                           \
+            else                                                                    \
+                nrejects++;                                                         \
+        }                                                                           \
+        nruns *= 4;                                                                 \
+    } while (stat_sample_size(stat) < NRUNS_MAX &&                                  \
+             (stat_sample_size(stat) == 0 || stat_sample_rel_stderr_knuth(stat) > 5.0)); \
+    return nrejects;                                                                \
+}                                                                                   \
+                                                                                    \
+static int measure_##clock(void (*func)(void *), void *arg, uint64_t overhead,      \
+                           kernel_result_t *res)                                    \
+{                                                                                   \
+    enum {                                                                          \
+        NRUNS_MIN = 100,                                                            \
+        NRUNS_MAX = 1000000                                                         \
+    };                                                                              \
+    stat_sample_t *stat = stat_sample_create();                                     \
+    if (stat == NULL) {                                                             \
+        fprintf(stderr, "# No enough memory for statistics\n");                     \
+        return -1;                                                                  \
+    }                                                                               \
+    volatile uint64_t t0, t1;                                                       \
+                                                                                    \
+    for (int i = 0; i < 10; i++)                                                    \
+        func(arg);                                                                  \
+    int nruns = NRUNS_MIN;                                                          \
+    do {                                                                            \
+        stat_sample_clean(stat);                                                    \
+        /* Every run is kept: below resolution of the clock time is 0 */            \
+        for (int i = 0; i < nruns; i++) {                                           \
+            t0 = read();                                                            \
+            func(arg);                                                              \
+            t1 = read();                                                            \
+            stat_sample_add(stat, (double)normolize_ticks(t0, t1, overhead));       \
+        }                                                                           \
+        nruns *= 4;                                                                 \
+    } while (stat_sample_size(stat) < NRUNS_MAX &&                                  \
+             !(stat_sample_rel_stderr_knuth(stat) <= 5.0));                         \
+                                                                                    \
+    res->nruns = stat_sample_size(stat);                                            \
+    res->mean = stat_sample_mean_knuth(stat);                                       \
+    res->stddev = stat_sample_stddev_knuth(stat);                                   \
+    res->rse = stat_sample_rel_stderr_knuth(stat);                                  \
+    res->min = stat_sample_min(stat);                                               \
+    res->max = stat_sample_max(stat);                                               \
+    stat_sample_free(stat);                                                         \
+    return 0;                                                                       \
+}
+
+DEFINE_CLOCK_FUNCS(monotonic, read_monotonic)
+DEFINE_CLOCK_FUNCS(monotonic_raw, read_monotonic_raw)
+DEFINE_CLOCK_FUNCS(task_clock, read_task_clock)
+
+const clock_backend_t clock_backends[] = {
+    {"tsc", "rdtsc (selected read method)", open_tsc, close_none, frequency_tsc,
+     resolution_tsc, granularity_tsc, overhead_min_tsc, overhead_stat_tsc, measure_tsc},
+    {"monotonic", "clock_gettime(CLOCK_MONOTONIC)", open_always, close_none, frequency_ns,
+     resolution_monotonic, granularity_monotonic, overhead_min_monotonic,
+     overhead_stat_monotonic, measure_monotonic},
+    {"monotonic_raw", "clock_gettime(CLOCK_MONOTONIC_RAW)", open_always, close_none, frequency_ns,
+     resolution_monotonic_raw, granularity_monotonic_raw, overhead_min_monotonic_raw,
+     overhead_stat_monotonic_raw, measure_monotonic_raw},
+    {"task_clock", "perf_event task-clock (read)", open_task_clock, close_task_clock, frequency_ns,
+     resolution_unknown, granularity_task_clock, overhead_min_task_clock,
+     overhead_stat_task_clock, measure_task_clock},
+    {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL}
+};
+
+/* clock_backend_set_tsc_method: Selects read method of the TSC backend (before open). */
+void clock_backend_set_tsc_method(const tsc_read_method_t *method)
+{
+    tsc_method = method;
+}
+
+/* find_clock_backend: Returns backend by name or NULL. */
+const clock_backend_t *find_clock_backend(const char *name)
+{
+    for (int i = 0; clock_backends[i].name != NULL; i++) {
+        if (strcmp(clock_backends[i].name, name) == 0)
+            return &clock_backends[i];
+    }
+    return NULL;
+}
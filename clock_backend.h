@@ -0,0 +1,50 @@
+/*
+ * clock_backend.h: Clock backends (TSC, clock_gettime, perf task-clock).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef CLOCK_BACKEND_H
+#define CLOCK_BACKEND_H
+
+#include <inttypes.h>
+
+#include "mathstat.h"
+#include "kernel_measure.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Values of all functions are in units of the clock (ticks or ns) */
+typedef struct {
+    const char *name;
+    const char *descr;
+    int (*open)();                   /* Returns 0 if clock is available */
+    void (*close)();
+    double (*frequency)();           /* Units per second */
+    double (*resolution)();          /* Nominal resolution (units), 0 if unknown */
+    uint64_t (*granularity)();       /* Minimal nonzero difference of consecutive reads */
+    uint64_t (*overhead)();          /* Minimal overhead (as measure_tsc_overhead) */
+    /*
+     * Collects statistic of overhead with given precision (RSE), returns
+     * number of rejected measurements (second value <= first one).
+     */
+    int (*overhead_stat)(stat_sample_t *stat);
+    /* Measures func(arg) as kernel_measure() does with reads of the clock */
+    int (*measure)(void (*func)(void *), void *arg, uint64_t overhead, kernel_result_t *res);
+} clock_backend_t;
+
+extern const clock_backend_t clock_backends[];   /* Terminated by {NULL, ...} */
+
+/* clock_backend_set_tsc_method: Selects read method of the TSC backend (before open). */
+void clock_backend_set_tsc_method(const tsc_read_method_t *method);
+
+/* find_clock_backend: Returns backend by name or NULL. */
+const clock_backend_t *find_clock_backend(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLOCK_BACKEND_H */
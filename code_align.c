@@ -0,0 +1,162 @@
+/*
+ * code_align.c: Code alignment sensitivity of measured kernels.
+ *
+ * Execution time of small loops depends on placement of the code in memory
+ * (alignment of loops relative to 32/64-byte fetch blocks, uop cache and
+ * loop stream detector windows). The section of relocatable kernels is
+ * copied to executable memory at a range of offsets and every copy
+ * is measured separately.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "kernel_measure.h"
+#include "code_align.h"
+
+/* measure_code: Measures execution time of func(arg) with given precision (RSE). */
+static int measure_code(const tsc_read_method_t *method, void (*func)(void *), void *arg,
+                        uint64_t overhead, code_align_result_t *res)
+{
+    kernel_result_t r;
+
+    if (kernel_measure(method, func, arg, overhead, &r) != 0)
+        return -1;
+    res->nruns = r.nruns;
+    res->mean = r.mean;
+    res->stddev = r.stddev;
+    res->rse = r.rse;
+    res->min = r.min;
+    res->max = r.max;
+    return 0;
+}
+
+/*
+ * code_align_sweep: Copies relocatable kernel to executable memory at
+ * offsets first, first + step, ..., < last (relative to the page boundary)
+ * and measures execution time of each copy by the read method. Result of
+ * linked (original) code is stored into results[0]. Returns number of
+ * results or -1 on error.
+ */
+int code_align_sweep(const reloc_code_t *code, const tsc_read_method_t *method,
+                     int first, int last, int step,
+                     code_align_result_t *results, int maxresults)
+{
+    const char *sect = reloc_section_start();
+    size_t sectsize = reloc_section_size();
+    size_t entry = (const char *)code->func - sect;
+    long pagesize = sysconf(_SC_PAGESIZE);
+
+    if (first < 0 || step <= 0 || last <= first || maxresults < 1)
+        return -1;
+
+    uint64_t overhead = method->overhead();
+    void *ws;
+    void *arg = reloc_code_arg_create(code, &ws);
+    if (arg == NULL) {
+        fprintf(stderr, "# Error allocating working set of the kernel\n");
+        return -1;
+    }
+
+    /* Linked code */
+    results[0].offset = -1;
+    results[0].addr = (uintptr_t)code->func;
+    if (measure_code(method, code->func, arg, overhead, &results[0]) != 0) {
+        reloc_code_arg_free(code, arg, ws);
+        return -1;
+    }
+    int nresults = 1;
+
+    size_t mapsize = ((last + sectsize) / pagesize + 1) * pagesize;
+    for (int offset = first; offset < last && nresults < maxresults; offset += step) {
+        char *buf = mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf == MAP_FAILED) {
+            fprintf(stderr, "# Error allocating memory for code copy\n");
+            reloc_code_arg_free(code, arg, ws);
+            return -1;
+        }
+        memcpy(buf + offset, sect, sectsize);
+        if (mprotect(buf, mapsize, PROT_READ | PROT_EXEC) != 0) {
+            fprintf(stderr, "# Error changing protection of code copy (W^X policy?)\n");
+            munmap(buf, mapsize);
+            reloc_code_arg_free(code, arg, ws);
+            return -1;
+        }
+
+        void (*func)(void *) = (void (*)(void *))(buf + offset + entry);
+        code_align_result_t *res = &results[nresults];
+        res->offset = offset;
+        res->addr = (uintptr_t)func;
+        int rc = measure_code(method, func, arg, overhead, res);
+        munmap(buf, mapsize);
+        if (rc != 0) {
+            reloc_code_arg_free(code, arg, ws);
+            return -1;
+        }
+        nresults++;
+    }
+    reloc_code_arg_free(code, arg, ws);
+    return nresults;
+}
+
+/* offset_str: Returns offset of the code copy as a string. */
+static const char *offset_str(int offset, char *buf, size_t size)
+{
+    if (offset < 0)
+        return "linked";
+    snprintf(buf, size, "%d", offset);
+    return buf;
+}
+
+/* code_align_report: Prints results of the sweep and spread of the results. */
+void code_align_report(const reloc_code_t *code, code_align_result_t *results, int nresults)
+{
+    char buf[32], buf2[32];
+
+    if (nresults < 1)
+        return;
+
+    double minmean = results[0].mean, maxmean = results[0].mean;
+    double minmin = results[0].min, maxmin = results[0].min;
+    int best = 0, worst = 0;
+    for (int i = 1; i < nresults; i++) {
+        if (results[i].mean < minmean) {
+            minmean = results[i].mean;
+            best = i;
+        }
+        if (results[i].mean > maxmean) {
+            maxmean = results[i].mean;
+            worst = i;
+        }
+        if (results[i].min < minmin)
+            minmin = results[i].min;
+        if (results[i].min > maxmin)
+            maxmin = results[i].min;
+    }
+
+    printf("# Code alignment sweep: %s (ticks)\n", code->name);
+    printf("# [Offset] [Addr%%64] [Runs]  [Mean]             [StdDev]           [RSE]    [Min]              [Max]              [Mean/Best]\n");
+    for (int i = 0; i < nresults; i++) {
+        printf("  %-8s %-9d %-7d %-18.2f %-18.2f %-8.2f %-18.2f %-18.2f %-8.3f\n",
+               offset_str(results[i].offset, buf, sizeof(buf)),
+               (int)(results[i].addr % 64), results[i].nruns, results[i].mean,
+               results[i].stddev, results[i].rse, results[i].min, results[i].max,
+               minmean > 0.0 ? results[i].mean / minmean : 0.0);
+    }
+    printf("# Spread of mean: %.2f%% (best offset %s, worst offset %s)\n",
+           minmean > 0.0 ? (maxmean - minmean) / minmean * 100.0 : 0.0,
+           offset_str(results[best].offset, buf, sizeof(buf)),
+           offset_str(results[worst].offset, buf2, sizeof(buf2)));
+    printf("# Spread of min:  %.2f%%\n",
+           minmin > 0.0 ? (maxmin - minmin) / minmin * 100.0 : 0.0);
+}
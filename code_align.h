@@ -0,0 +1,47 @@
+/*
+ * code_align.h: Code alignment sensitivity of measured kernels.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef CODE_ALIGN_H
+#define CODE_ALIGN_H
+
+#include <inttypes.h>
+#include "measured_code.h"
+#include "tsc_x86.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int offset;          /* Offset of the kernel copy from the page boundary (-1 for linked code) */
+    uintptr_t addr;      /* Entry point of the kernel copy */
+    int nruns;
+    double mean;
+    double stddev;
+    double rse;
+    double min;
+    double max;
+} code_align_result_t;
+
+/*
+ * code_align_sweep: Copies relocatable kernel to executable memory at
+ * offsets first, first + step, ..., < last (relative to the page boundary)
+ * and measures execution time of each copy by the read method. Result of
+ * linked (original) code is stored into results[0]. Returns number of
+ * results or -1 on error.
+ */
+int code_align_sweep(const reloc_code_t *code, const tsc_read_method_t *method,
+                     int first, int last, int step,
+                     code_align_result_t *results, int maxresults);
+
+/* code_align_report: Prints results of the sweep and spread of the results. */
+void code_align_report(const reloc_code_t *code, code_align_result_t *results, int nresults);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CODE_ALIGN_H */
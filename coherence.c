@@ -0,0 +1,271 @@
+/*
+ * coherence.c: Cache-coherence and atomic contention between CPUs.
+ *
+ * Shared data is aligned to LINE_ALIGN (two cache lines: the adjacent
+ * line prefetcher moves 128-byte pairs), so measured transfers are not
+ * mixed with unrelated lines. Threads inherit scheduling policy of the
+ * process, every thread is pinned to its own CPU.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "coherence.h"
+
+enum {
+    NREPS = 5,
+    LINE_ALIGN = 128,
+    PADDED_STRIDE = LINE_ALIGN / sizeof(uint64_t)
+};
+
+enum {
+    KIND_PINGPONG = 0,
+    KIND_ATOMIC = 1,
+    KIND_SHARED = 2,
+    KIND_PADDED = 3
+};
+
+typedef struct {
+    int cpu;
+    int index;                  /* Index of thread in the group */
+    int kind;
+    int op;
+    int niters;
+    uint64_t *data;             /* Aligned to LINE_ALIGN */
+    pthread_barrier_t *barrier;
+    int *start;                 /* 1: all threads are created, -1: abort */
+    uint64_t ticks[NREPS];
+} coherence_thread_t;
+
+static inline void cpu_relax()
+{
+    __asm__ __volatile__ ("pause" ::: "memory");
+}
+
+static void pingpong(coherence_thread_t *t, int rep)
+{
+    uint64_t *line = t->data;
+
+    if (t->index == 0) {
+        uint64_t t0 = read_tsc_before();
+        for (uint64_t i = 0; i < (uint64_t)t->niters; i++) {
+            __atomic_store_n(line, 2 * i + 1, __ATOMIC_RELEASE);
+            while (__atomic_load_n(line, __ATOMIC_ACQUIRE) != 2 * i + 2)
+                cpu_relax();
+        }
+        t->ticks[rep] = read_tsc_after() - t0;
+    } else {
+        for (uint64_t i = 0; i < (uint64_t)t->niters; i++) {
+            while (__atomic_load_n(line, __ATOMIC_ACQUIRE) != 2 * i + 1)
+                cpu_relax();
+            __atomic_store_n(line, 2 * i + 2, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static void atomic_increments(coherence_thread_t *t, int rep)
+{
+    uint64_t *counter = t->data;
+
+    uint64_t t0 = read_tsc_before();
+    if (t->op == COHERENCE_XADD) {
+        for (int i = 0; i < t->niters; i++)
+            __atomic_fetch_add(counter, 1, __ATOMIC_SEQ_CST);
+    } else {
+        for (int i = 0; i < t->niters; i++) {
+            uint64_t old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(counter, &old, old + 1, 0,
+                                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+                ;
+        }
+    }
+    t->ticks[rep] = read_tsc_after() - t0;
+}
+
+static void plain_increments(coherence_thread_t *t, int rep)
+{
+    volatile uint64_t *counter = t->data + (t->kind == KIND_PADDED ? t->index * PADDED_STRIDE : t->index);
+
+    uint64_t t0 = read_tsc_before();
+    for (int i = 0; i < t->niters; i++)
+        (*counter)++;
+    t->ticks[rep] = read_tsc_after() - t0;
+}
+
+static void *coherence_thread(void *arg)
+{
+    coherence_thread_t *t = arg;
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    int start;
+    while ((start = __atomic_load_n(t->start, __ATOMIC_ACQUIRE)) == 0)
+        sched_yield();
+    if (start < 0)
+        return NULL;
+
+    for (int rep = 0; rep < NREPS; rep++) {
+        pthread_barrier_wait(t->barrier);
+        switch (t->kind) {
+        case KIND_PINGPONG: pingpong(t, rep); break;
+        case KIND_ATOMIC: atomic_increments(t, rep); break;
+        default: plain_increments(t, rep); break;
+        }
+        /* Reset shared data between repetitions */
+        pthread_barrier_wait(t->barrier);
+        if (t->index == 0 && t->kind != KIND_PADDED)
+            memset(t->data, 0, LINE_ALIGN);
+    }
+    return NULL;
+}
+
+/*
+ * run_group: Runs kind of test on threads pinned to cpus.
+ * Returns per thread ticks (NREPS per thread) or NULL on error.
+ */
+static coherence_thread_t *run_group(const int *cpus, int nthreads, int kind, int op, int niters)
+{
+    pthread_barrier_t barrier;
+    uint64_t *data;
+    int start = 0;
+
+    if (nthreads < 1 || posix_memalign((void **)&data, LINE_ALIGN, (size_t)LINE_ALIGN * nthreads) != 0)
+        return NULL;
+    memset(data, 0, (size_t)LINE_ALIGN * nthreads);
+    coherence_thread_t *threads = calloc(nthreads, sizeof(*threads));
+    pthread_t *tids = calloc(nthreads, sizeof(*tids));
+    if (threads == NULL || tids == NULL || pthread_barrier_init(&barrier, NULL, nthreads) != 0) {
+        free(threads);
+        free(tids);
+        free(data);
+        return NULL;
+    }
+
+    int nstarted = 0;
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].cpu = cpus[i];
+        threads[i].index = i;
+        threads[i].kind = kind;
+        threads[i].op = op;
+        threads[i].niters = niters;
+        threads[i].data = data;
+        threads[i].barrier = &barrier;
+        threads[i].start = &start;
+        if (pthread_create(&tids[i], NULL, coherence_thread, &threads[i]) != 0)
+            break;
+        nstarted++;
+    }
+    /* Barrier can't be passed if some thread is not created */
+    __atomic_store_n(&start, nstarted < nthreads ? -1 : 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < nstarted; i++)
+        pthread_join(tids[i], NULL);
+
+    pthread_barrier_destroy(&barrier);
+    free(tids);
+    free(data);
+    if (nstarted < nthreads) {
+        free(threads);
+        return NULL;
+    }
+    return threads;
+}
+
+/* mean_ticks: Returns mean over threads of minimal (over repetitions) ticks per iteration. */
+static double mean_ticks(coherence_thread_t *threads, int nthreads, int niters)
+{
+    double sum = 0.0;
+
+    for (int i = 0; i < nthreads; i++) {
+        uint64_t min = threads[i].ticks[0];
+        for (int rep = 1; rep < NREPS; rep++) {
+            if (threads[i].ticks[rep] < min)
+                min = threads[i].ticks[rep];
+        }
+        sum += (double)min / niters;
+    }
+    return sum / nthreads;
+}
+
+/*
+ * coherence_pingpong: Measures round trip of a cache line between
+ * threads pinned to cpu_a and cpu_b: every round the line is written by
+ * one thread and the other waits for the value. Returns minimal ticks
+ * per round (of several repetitions) or a negative value on error.
+ */
+double coherence_pingpong(int cpu_a, int cpu_b, int nrounds)
+{
+    int cpus[2] = {cpu_a, cpu_b};
+
+    /* Spinning threads on one CPU would wait for each other a time slice */
+    if (cpu_a == cpu_b || nrounds < 1)
+        return -1.0;
+    coherence_thread_t *threads = run_group(cpus, 2, KIND_PINGPONG, 0, nrounds);
+    if (threads == NULL)
+        return -1.0;
+    double ticks = mean_ticks(threads, 1, nrounds);
+    free(threads);
+    return ticks;
+}
+
+/*
+ * coherence_atomic: Measures contended atomic increments of one cache
+ * line by threads pinned to cpus[0..nthreads-1]. Returns mean ticks per
+ * operation of a thread or a negative value on error.
+ */
+double coherence_atomic(const int *cpus, int nthreads, int op, int niters)
+{
+    if (op < 0 || op >= COHERENCE_NOPS || niters < 1)
+        return -1.0;
+    coherence_thread_t *threads = run_group(cpus, nthreads, KIND_ATOMIC, op, niters);
+    if (threads == NULL)
+        return -1.0;
+    double ticks = mean_ticks(threads, nthreads, niters);
+    free(threads);
+    return ticks;
+}
+
+/*
+ * coherence_false_sharing: Measures plain increments of per-thread
+ * counters packed into one cache line (shared) and placed on separate
+ * lines (padded). Returns 0 on success.
+ */
+int coherence_false_sharing(const int *cpus, int nthreads, int niters,
+                            double *shared, double *padded)
+{
+    coherence_thread_t *threads;
+
+    /* Counters of all threads must fit into one line */
+    if (nthreads > LINE_ALIGN / 2 / (int)sizeof(uint64_t) || niters < 1)
+        return -1;
+    if ( (threads = run_group(cpus, nthreads, KIND_SHARED, 0, niters)) == NULL)
+        return -1;
+    *shared = mean_ticks(threads, nthreads, niters);
+    free(threads);
+    if ( (threads = run_group(cpus, nthreads, KIND_PADDED, 0, niters)) == NULL)
+        return -1;
+    *padded = mean_ticks(threads, nthreads, niters);
+    free(threads);
+    return 0;
+}
+
+/* coherence_op_name: Returns name of atomic operation. */
+const char *coherence_op_name(int op)
+{
+    switch (op) {
+    case COHERENCE_XADD: return "xadd";
+    case COHERENCE_CAS: return "cas";
+    default: return "none";
+    }
+}
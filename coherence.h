@@ -0,0 +1,50 @@
+/*
+ * coherence.h: Cache-coherence and atomic contention between CPUs.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef COHERENCE_H
+#define COHERENCE_H
+
+enum {
+    COHERENCE_XADD = 0,         /* lock xadd */
+    COHERENCE_CAS = 1,          /* lock cmpxchg loop */
+    COHERENCE_NOPS = 2
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * coherence_pingpong: Measures round trip of a cache line between
+ * threads pinned to cpu_a and cpu_b: every round the line is written by
+ * one thread and the other waits for the value. Returns minimal ticks
+ * per round (of several repetitions) or a negative value on error.
+ */
+double coherence_pingpong(int cpu_a, int cpu_b, int nrounds);
+
+/*
+ * coherence_atomic: Measures contended atomic increments of one cache
+ * line by threads pinned to cpus[0..nthreads-1]. Returns mean ticks per
+ * operation of a thread or a negative value on error.
+ */
+double coherence_atomic(const int *cpus, int nthreads, int op, int niters);
+
+/*
+ * coherence_false_sharing: Measures plain increments of per-thread
+ * counters packed into one cache line (shared) and placed on separate
+ * lines (padded). Returns 0 on success.
+ */
+int coherence_false_sharing(const int *cpus, int nthreads, int niters,
+                            double *shared, double *padded);
+
+/* coherence_op_name: Returns name of atomic operation. */
+const char *coherence_op_name(int op);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COHERENCE_H */
@@ -0,0 +1,99 @@
+/*
+ * cold_trial.c: First call of a kernel in a fresh process.
+ *
+ * Forked child shares warm page cache, but not TLB, caches after the
+ * parent's activity, locked pages (mlockall is not inherited) and lazily
+ * bound symbols of a fresh exec. Sample is sent back over a pipe.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/personality.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "kernel_measure.h"
+#include "cold_trial.h"
+
+static void store_ticks(void *ctx, uint64_t ticks)
+{
+    *(uint64_t *)ctx = ticks;
+}
+
+/*
+ * cold_trial_first_call: Measures the first call of func(arg) in this
+ *                        process by the read method and writes sample to fd.
+ *                        Returns 0 on success.
+ */
+int cold_trial_first_call(const tsc_read_method_t *method, void (*func)(void *), void *arg, int fd)
+{
+    struct rusage before, after;
+    cold_sample_t sample;
+
+    sample.ticks = 0;
+    getrusage(RUSAGE_SELF, &before);
+    int rc = kernel_measure_runs(method, func, arg, 0, 1, store_ticks, &sample.ticks);
+    getrusage(RUSAGE_SELF, &after);
+    if (rc != 0)
+        return -1;
+
+    sample.minflt = after.ru_minflt - before.ru_minflt;
+    sample.majflt = after.ru_majflt - before.ru_majflt;
+    sample.minflt_before = before.ru_minflt;
+    return write(fd, &sample, sizeof(sample)) == sizeof(sample) ? 0 : -1;
+}
+
+/*
+ * cold_trial_run: Forks child which makes the first call of func(arg).
+ * If exec_argv is not NULL, the child executes exec_argv[0] instead
+ * (the program must call cold_trial_first_call(..., COLD_TRIAL_FD)).
+ * no_aslr disables address space randomization of executed child.
+ * Returns 0 on success.
+ */
+int cold_trial_run(const tsc_read_method_t *method, void (*func)(void *), void *arg,
+                   char *const exec_argv[], int no_aslr, cold_sample_t *sample)
+{
+    int fds[2];
+
+    if (pipe(fds) != 0)
+        return -1;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        close(fds[0]);
+        if (exec_argv == NULL)
+            _exit(cold_trial_first_call(method, func, arg, fds[1]) == 0 ? 0 : 1);
+        if (fds[1] != COLD_TRIAL_FD) {
+            dup2(fds[1], COLD_TRIAL_FD);
+            close(fds[1]);
+        }
+        if (no_aslr)
+            personality(personality(0xffffffff) | ADDR_NO_RANDOMIZE);
+        execv(exec_argv[0], exec_argv);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], sample, sizeof(*sample));
+    close(fds[0]);
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return -1;
+    return n == sizeof(*sample) ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+/*
+ * cold_trial.h: First call of a kernel in a fresh process.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef COLD_TRIAL_H
+#define COLD_TRIAL_H
+
+#include <inttypes.h>
+#include "tsc_x86.h"
+
+/* Executed child writes its sample to this descriptor */
+#define COLD_TRIAL_FD 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t ticks;             /* Raw ticks of the first call (overhead is not subtracted) */
+    int64_t minflt;             /* Page faults during the first call */
+    int64_t majflt;
+    int64_t minflt_before;      /* Page faults of the child before the call */
+} cold_sample_t;
+
+/*
+ * cold_trial_first_call: Measures the first call of func(arg) in this
+ *                        process by the read method and writes sample to fd.
+ *                        Returns 0 on success.
+ */
+int cold_trial_first_call(const tsc_read_method_t *method, void (*func)(void *), void *arg, int fd);
+
+/*
+ * cold_trial_run: Forks child which makes the first call of func(arg).
+ * If exec_argv is not NULL, the child executes exec_argv[0] instead
+ * (the program must call cold_trial_first_call(..., COLD_TRIAL_FD)).
+ * no_aslr disables address space randomization of executed child.
+ * Returns 0 on success.
+ */
+int cold_trial_run(const tsc_read_method_t *method, void (*func)(void *), void *arg,
+                   char *const exec_argv[], int no_aslr, cold_sample_t *sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COLD_TRIAL_H */
@@ -0,0 +1,237 @@
+/*
+ * ctx_monitor.c: Context of measurements for attribution of outliers.
+ *
+ * Every sample is tagged by CPU id (TSC_AUX of RDTSCP, which Linux sets to
+ * node << 12 | cpu), the largest samples are kept. Context switches and page
+ * faults of the thread (getrusage(RUSAGE_THREAD)) and interrupts of the
+ * measurement CPU (/proc/interrupts) are counted per batch of runs, so an
+ * outlier is attributed to the counters of its batch. A batch is a round of
+ * the RSE loop, whose samples replace those of the previous rounds, so the
+ * largest samples are kept of the current batch only (as the mean they are
+ * compared with):
+ *     migration  -- sample was taken on another CPU,
+ *     preemption -- involuntary context switches,
+ *     sleep      -- voluntary context switches,
+ *     page fault -- minor/major page faults,
+ *     interrupts -- the most frequent interrupts of the batch,
+ *     unattributed (SMI, frequency change or microarchitectural event).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sched.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "ctx_monitor.h"
+
+/* read_interrupts: Reads interrupt counters of the CPU. Returns number of counters. */
+static int read_interrupts(int cpu, ctx_irq_t *irqs, int maxirqs)
+{
+    static char line[16384];     /* Line has a column per CPU */
+    int column = -1, n = 0;
+
+    FILE *f = fopen("/proc/interrupts", "r");
+    if (f == NULL)
+        return 0;
+
+    /* Header lists online CPUs: "CPU0 CPU1 ..." */
+    if (fgets(line, sizeof(line), f) != NULL) {
+        int i = 0;
+        for (char *tok = strtok(line, " \t\n"); tok != NULL; tok = strtok(NULL, " \t\n"), i++) {
+            if (strncmp(tok, "CPU", 3) == 0 && atoi(tok + 3) == cpu)
+                column = i;
+        }
+    }
+    while (column >= 0 && n < maxirqs && fgets(line, sizeof(line), f) != NULL) {
+        char *name = strtok(line, " \t\n");
+        if (name == NULL)
+            continue;
+        name[strcspn(name, ":")] = '\0';
+        char *tok = NULL;
+        for (int i = 0; i <= column; i++) {
+            if ( (tok = strtok(NULL, " \t\n")) == NULL)
+                break;
+        }
+        if (tok == NULL || tok[0] < '0' || tok[0] > '9')
+            continue;
+        uint64_t count = strtoull(tok, NULL, 10);
+
+        /* Numbered IRQ is named by its device (the last field) */
+        const char *descr = name;
+        if (name[0] >= '0' && name[0] <= '9') {
+            for (char *t = strtok(NULL, " \t\n"); t != NULL; t = strtok(NULL, " \t\n"))
+                descr = t;
+        }
+        snprintf(irqs[n].name, sizeof(irqs[n].name), "%s", descr);
+        irqs[n].count = count;
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+/*
+ * ctx_monitor_open: Initializes monitor of the thread on the CPU which keeps
+ *                   noutliers largest samples. Returns 0 on success.
+ */
+int ctx_monitor_open(ctx_monitor_t *mon, int cpu, int noutliers)
+{
+    memset(mon, 0, sizeof(*mon));
+    mon->cpu = cpu;
+    mon->use_rdtscp = is_rdtscp_available();
+    if (noutliers < 1 || noutliers > CTX_MONITOR_OUTLIERS_MAX)
+        return -1;
+    mon->noutliers_max = noutliers;
+    return 0;
+}
+
+/*
+ * ctx_monitor_batch_begin: Starts batch: reads rusage and interrupt counters,
+ *                          drops the largest samples of previous batches.
+ */
+void ctx_monitor_batch_begin(ctx_monitor_t *mon)
+{
+    struct rusage ru;
+
+    mon->run = 0;
+    mon->noutliers = 0;
+    if (mon->nbatches < CTX_MONITOR_BATCHES_MAX)
+        memset(&mon->batches[mon->nbatches], 0, sizeof(ctx_batch_t));
+    mon->nirqs = read_interrupts(mon->cpu, mon->irqs, CTX_MONITOR_IRQS_MAX);
+    getrusage(RUSAGE_THREAD, &ru);
+    mon->nvcsw = ru.ru_nvcsw;
+    mon->nivcsw = ru.ru_nivcsw;
+    mon->minflt = ru.ru_minflt;
+    mon->majflt = ru.ru_majflt;
+}
+
+/* ctx_monitor_batch_end: Finishes batch: stores deltas of counters. */
+void ctx_monitor_batch_end(ctx_monitor_t *mon, int nruns)
+{
+    static ctx_irq_t irqs[CTX_MONITOR_IRQS_MAX];
+    struct rusage ru;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    int nirqs = read_interrupts(mon->cpu, irqs, CTX_MONITOR_IRQS_MAX);
+    if (mon->nbatches >= CTX_MONITOR_BATCHES_MAX)
+        return;
+
+    ctx_batch_t *b = &mon->batches[mon->nbatches++];
+    b->nruns = nruns;
+    b->nvcsw = ru.ru_nvcsw - mon->nvcsw;
+    b->nivcsw = ru.ru_nivcsw - mon->nivcsw;
+    b->minflt = ru.ru_minflt - mon->minflt;
+    b->majflt = ru.ru_majflt - mon->majflt;
+
+    /* Lines of /proc/interrupts keep their order while IRQs are not added */
+    for (int i = 0; i < nirqs && i < mon->nirqs; i++) {
+        if (strcmp(irqs[i].name, mon->irqs[i].name) != 0 || irqs[i].count < mon->irqs[i].count)
+            continue;
+        uint64_t delta = irqs[i].count - mon->irqs[i].count;
+        b->irqs += delta;
+        for (int j = 0; j < CTX_MONITOR_TOP_IRQS; j++) {
+            if (delta > b->top_irqs[j].count) {
+                memmove(&b->top_irqs[j + 1], &b->top_irqs[j],
+                        sizeof(ctx_irq_t) * (CTX_MONITOR_TOP_IRQS - j - 1));
+                b->top_irqs[j] = irqs[i];
+                b->top_irqs[j].count = delta;
+                break;
+            }
+        }
+    }
+}
+
+/* ctx_monitor_sample: Records sample (called after the measurement, reads CPU id). */
+void ctx_monitor_sample(ctx_monitor_t *mon, double ticks)
+{
+    int run = mon->run++;
+    int cpu;
+
+    if (mon->use_rdtscp) {
+        uint32_t aux;
+        rdtscp_aux(&aux);
+        cpu = aux & 0xfff;
+    } else {
+        cpu = sched_getcpu();
+    }
+    if (cpu != mon->cpu && mon->nbatches < CTX_MONITOR_BATCHES_MAX)
+        mon->batches[mon->nbatches].nmigrated++;
+
+    /* Keep the largest samples: outliers[0] is the smallest of them */
+    int n = mon->noutliers;
+    if (n == mon->noutliers_max) {
+        if (ticks <= mon->outliers[0].ticks)
+            return;
+        memmove(&mon->outliers[0], &mon->outliers[1], sizeof(ctx_outlier_t) * (n - 1));
+        n--;
+    }
+    int i = n;
+    while (i > 0 && mon->outliers[i - 1].ticks > ticks) {
+        mon->outliers[i] = mon->outliers[i - 1];
+        i--;
+    }
+    mon->outliers[i].ticks = ticks;
+    mon->outliers[i].batch = mon->nbatches;
+    mon->outliers[i].run = run;
+    mon->outliers[i].cpu = cpu;
+    mon->noutliers = n + 1;
+}
+
+/* attribute: Writes causes of the outlier by counters of its batch. */
+static void attribute(ctx_monitor_t *mon, const ctx_outlier_t *o, char *buf, int size)
+{
+    int len = 0;
+
+    buf[0] = '\0';
+    if (o->cpu != mon->cpu)
+        len += snprintf(buf + len, size - len, "migration(CPU %d) ", o->cpu);
+    if (o->batch >= mon->nbatches)
+        return;
+    const ctx_batch_t *b = &mon->batches[o->batch];
+    if (b->nivcsw > 0 && len < size)
+        len += snprintf(buf + len, size - len, "preemption(%ld) ", b->nivcsw);
+    if (b->nvcsw > 0 && len < size)
+        len += snprintf(buf + len, size - len, "sleep(%ld) ", b->nvcsw);
+    if (b->minflt + b->majflt > 0 && len < size)
+        len += snprintf(buf + len, size - len, "page_fault(%ld/%ld) ", b->minflt, b->majflt);
+    for (int j = 0; j < CTX_MONITOR_TOP_IRQS && b->top_irqs[j].count > 0 && len < size; j++)
+        len += snprintf(buf + len, size - len, "irq:%s(%" PRIu64 ") ", b->top_irqs[j].name,
+                        b->top_irqs[j].count);
+    if (len == 0)
+        snprintf(buf, size, "unattributed");
+}
+
+/* ctx_monitor_report: Prints batches and the largest samples with attributed causes. */
+void ctx_monitor_report(ctx_monitor_t *mon, double mean, FILE *f)
+{
+    char causes[256];
+
+    fprintf(f, "# Context of batches (CPU %d, %s)\n", mon->cpu,
+            mon->use_rdtscp ? "CPU of samples by TSC_AUX" : "CPU of samples by sched_getcpu");
+    fprintf(f, "# [Batch] [Runs]   [Vol. cs] [Invol. cs] [Min. flt] [Maj. flt] [IRQs]     [Migrated] [Top IRQs]\n");
+    for (int i = 0; i < mon->nbatches; i++) {
+        const ctx_batch_t *b = &mon->batches[i];
+        fprintf(f, "#  %-7d %-8d %-9ld %-11ld %-10ld %-10ld %-10" PRIu64 " %-10" PRIu64 " ",
+                i, b->nruns, b->nvcsw, b->nivcsw, b->minflt, b->majflt, b->irqs, b->nmigrated);
+        for (int j = 0; j < CTX_MONITOR_TOP_IRQS && b->top_irqs[j].count > 0; j++)
+            fprintf(f, "%s:%" PRIu64 " ", b->top_irqs[j].name, b->top_irqs[j].count);
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "# Top %d samples of the last batch with attributed causes\n", mon->noutliers);
+    fprintf(f, "# [Ticks]            [x Mean] [Batch] [Run]    [CPU] [Causes]\n");
+    for (int i = mon->noutliers - 1; i >= 0; i--) {
+        const ctx_outlier_t *o = &mon->outliers[i];
+        attribute(mon, o, causes, sizeof(causes));
+        fprintf(f, "#  %-18.2f %-8.2f %-7d %-8d %-5d %s\n", o->ticks, mean > 0.0 ? o->ticks / mean : 0.0,
+                o->batch, o->run, o->cpu, causes);
+    }
+}
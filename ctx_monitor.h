@@ -0,0 +1,86 @@
+/*
+ * ctx_monitor.h: Context of measurements for attribution of outliers.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef CTX_MONITOR_H
+#define CTX_MONITOR_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define CTX_MONITOR_BATCHES_MAX 64
+#define CTX_MONITOR_OUTLIERS_MAX 64
+#define CTX_MONITOR_IRQS_MAX 512
+#define CTX_MONITOR_TOP_IRQS 3
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    char name[24];
+    uint64_t count;
+} ctx_irq_t;
+
+/* Deltas of counters over a batch */
+typedef struct {
+    int nruns;
+    long nvcsw;                 /* Voluntary context switches */
+    long nivcsw;                /* Involuntary context switches */
+    long minflt;
+    long majflt;
+    uint64_t irqs;              /* Interrupts on the measurement CPU */
+    ctx_irq_t top_irqs[CTX_MONITOR_TOP_IRQS];
+    uint64_t nmigrated;         /* Samples on another CPU */
+} ctx_batch_t;
+
+typedef struct {
+    double ticks;
+    int batch;
+    int run;                    /* Index of the sample in the batch */
+    int cpu;                    /* CPU of the sample (TSC_AUX) */
+} ctx_outlier_t;
+
+typedef struct {
+    int cpu;                    /* Measurement CPU */
+    int use_rdtscp;             /* CPU is read from TSC_AUX (sched_getcpu() otherwise) */
+    int noutliers_max;
+    ctx_outlier_t outliers[CTX_MONITOR_OUTLIERS_MAX];   /* Of the current batch, sorted by ticks (ascending) */
+    int noutliers;
+    ctx_batch_t batches[CTX_MONITOR_BATCHES_MAX];
+    int nbatches;
+    int run;                    /* Samples of the current batch */
+    /* Counters at the batch begin */
+    long nvcsw, nivcsw, minflt, majflt;
+    ctx_irq_t irqs[CTX_MONITOR_IRQS_MAX];
+    int nirqs;
+} ctx_monitor_t;
+
+/*
+ * ctx_monitor_open: Initializes monitor of the thread on the CPU which keeps
+ *                   noutliers largest samples. Returns 0 on success.
+ */
+int ctx_monitor_open(ctx_monitor_t *mon, int cpu, int noutliers);
+
+/*
+ * ctx_monitor_batch_begin: Starts batch: reads rusage and interrupt counters,
+ *                          drops the largest samples of previous batches.
+ */
+void ctx_monitor_batch_begin(ctx_monitor_t *mon);
+
+/* ctx_monitor_batch_end: Finishes batch: stores deltas of counters. */
+void ctx_monitor_batch_end(ctx_monitor_t *mon, int nruns);
+
+/* ctx_monitor_sample: Records sample (called after the measurement, reads CPU id). */
+void ctx_monitor_sample(ctx_monitor_t *mon, double ticks);
+
+/* ctx_monitor_report: Prints batches and the largest samples with attributed causes. */
+void ctx_monitor_report(ctx_monitor_t *mon, double mean, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CTX_MONITOR_H */
@@ -0,0 +1,207 @@
+/*
+ * freq_monitor.c: Monitoring of core frequency and throttling during measurements.
+ *
+ * Effective frequency of a batch is TSC frequency * dAPERF / dMPERF
+ * (MPERF counts at TSC rate in C0, APERF at actual rate). Without access
+ * to MSR the current cpufreq frequency is sampled at the batch bounds.
+ * Thermal throttling events are counted by thermal_throttle sysfs counters.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "freq_monitor.h"
+
+#define MSR_IA32_MPERF 0xE7
+#define MSR_IA32_APERF 0xE8
+
+/* read_sysfs_u64: Reads integer from file root/path. Returns 0 on success. */
+static int read_sysfs_u64(const char *root, const char *path, uint64_t *val)
+{
+    char fname[512];
+    snprintf(fname, sizeof(fname), "%s%s", root, path);
+    FILE *f = fopen(fname, "r");
+    if (f == NULL)
+        return -1;
+    int rc = fscanf(f, "%" SCNu64, val) == 1 ? 0 : -1;
+    fclose(f);
+    return rc;
+}
+
+static int read_msr(int fd, uint32_t reg, uint64_t *val)
+{
+    return pread(fd, val, sizeof(*val), reg) == sizeof(*val) ? 0 : -1;
+}
+
+/* read_throttle_count: Returns sum of core and package throttling counters. */
+static uint64_t read_throttle_count(freq_monitor_t *mon)
+{
+    char path[128];
+    uint64_t val, sum = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/thermal_throttle/core_throttle_count", mon->cpu);
+    if (read_sysfs_u64(mon->sysfs_root, path, &val) == 0)
+        sum += val;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/thermal_throttle/package_throttle_count", mon->cpu);
+    if (read_sysfs_u64(mon->sysfs_root, path, &val) == 0)
+        sum += val;
+    return sum;
+}
+
+/*
+ * freq_monitor_open: Initializes monitor of given CPU: MSR if permitted,
+ *                    sysfs otherwise. sysfs_root is prepended to /sys paths
+ *                    (NULL or "" for real sysfs). Returns 0 on success.
+ */
+int freq_monitor_open(freq_monitor_t *mon, int cpu, const char *sysfs_root)
+{
+    char path[128];
+    uint64_t val;
+
+    memset(mon, 0, sizeof(*mon));
+    mon->cpu = cpu;
+    mon->msr_fd = -1;
+    mon->source = FREQ_SOURCE_NONE;
+    snprintf(mon->sysfs_root, sizeof(mon->sysfs_root), "%s", sysfs_root ? sysfs_root : "");
+
+    snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+    mon->msr_fd = open(path, O_RDONLY);
+    if (mon->msr_fd >= 0 && read_msr(mon->msr_fd, MSR_IA32_APERF, &val) == 0) {
+        mon->source = FREQ_SOURCE_MSR;
+    } else {
+        if (mon->msr_fd >= 0)
+            close(mon->msr_fd);
+        mon->msr_fd = -1;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+        if (read_sysfs_u64(mon->sysfs_root, path, &val) == 0)
+            mon->source = FREQ_SOURCE_SYSFS;
+    }
+    if (mon->source == FREQ_SOURCE_NONE)
+        return -1;
+
+    mon->tsc_hz = tsc_frequency();
+    return 0;
+}
+
+/* freq_monitor_close: Releases resources of the monitor. */
+void freq_monitor_close(freq_monitor_t *mon)
+{
+    if (mon->msr_fd >= 0)
+        close(mon->msr_fd);
+    mon->msr_fd = -1;
+}
+
+/* freq_monitor_sample: Reads counters of monitored CPU. */
+void freq_monitor_sample(freq_monitor_t *mon, freq_sample_t *sample)
+{
+    char path[128];
+
+    memset(sample, 0, sizeof(*sample));
+    sample->tsc = rdtsc();
+    if (mon->source == FREQ_SOURCE_MSR) {
+        read_msr(mon->msr_fd, MSR_IA32_APERF, &sample->aperf);
+        read_msr(mon->msr_fd, MSR_IA32_MPERF, &sample->mperf);
+    } else if (mon->source == FREQ_SOURCE_SYSFS) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", mon->cpu);
+        read_sysfs_u64(mon->sysfs_root, path, &sample->cur_khz);
+    }
+    sample->throttle_count = read_throttle_count(mon);
+}
+
+/* freq_monitor_batch_begin: Starts batch of measurements. */
+void freq_monitor_batch_begin(freq_monitor_t *mon)
+{
+    freq_monitor_sample(mon, &mon->begin);
+}
+
+/* freq_monitor_batch_end: Finishes batch: computes effective frequency and throttling. */
+void freq_monitor_batch_end(freq_monitor_t *mon, int nruns)
+{
+    freq_sample_t end;
+
+    if (mon->nbatches >= FREQ_MONITOR_BATCHES_MAX)
+        return;
+    freq_monitor_sample(mon, &end);
+
+    freq_batch_t *batch = &mon->batches[mon->nbatches++];
+    batch->nruns = nruns;
+    batch->freq_mhz = 0.0;
+    if (mon->source == FREQ_SOURCE_MSR) {
+        uint64_t mperf = end.mperf - mon->begin.mperf;
+        if (mperf > 0)
+            batch->freq_mhz = mon->tsc_hz * (double)(end.aperf - mon->begin.aperf) / mperf / 1E6;
+    } else if (mon->source == FREQ_SOURCE_SYSFS) {
+        batch->freq_mhz = (mon->begin.cur_khz + end.cur_khz) / 2.0 / 1E3;
+    }
+    batch->throttle_events = end.throttle_count - mon->begin.throttle_count;
+}
+
+/* freq_monitor_variation: Returns (max - min) / min of batch frequencies (percents). */
+double freq_monitor_variation(freq_monitor_t *mon)
+{
+    double min = 0.0, max = 0.0;
+
+    for (int i = 0; i < mon->nbatches; i++) {
+        double f = mon->batches[i].freq_mhz;
+        if (f <= 0.0)
+            continue;
+        if (min == 0.0 || f < min)
+            min = f;
+        if (f > max)
+            max = f;
+    }
+    return min > 0.0 ? (max - min) / min * 100.0 : 0.0;
+}
+
+/*
+ * freq_monitor_report: Prints batches; returns 1 if frequency varied more than
+ *                      threshold (percents) or throttling was detected.
+ */
+int freq_monitor_report(freq_monitor_t *mon, double threshold, FILE *f)
+{
+    uint64_t throttle = 0;
+
+    fprintf(f, "# Frequency monitor (%s, CPU %d), TSC frequency %.2f MHz\n",
+            freq_source_name(mon->source), mon->cpu, mon->tsc_hz / 1E6);
+    fprintf(f, "# [Batch] [Runs]   [Freq, MHz]  [Freq/TSC]  [Throttling]\n");
+    for (int i = 0; i < mon->nbatches; i++) {
+        freq_batch_t *b = &mon->batches[i];
+        fprintf(f, "#  %-7d %-8d %-12.2f %-11.3f %" PRIu64 "\n", i, b->nruns, b->freq_mhz,
+                mon->tsc_hz > 0.0 ? b->freq_mhz * 1E6 / mon->tsc_hz : 0.0, b->throttle_events);
+        throttle += b->throttle_events;
+    }
+
+    double variation = freq_monitor_variation(mon);
+    fprintf(f, "# Frequency variation: %.2f%% (threshold %.2f%%)\n", variation, threshold);
+    int flagged = 0;
+    if (variation > threshold) {
+        fprintf(f, "# [Warning!] Core frequency was not constant during measurements"
+                   " (turbo or power management is on?)\n");
+        flagged = 1;
+    }
+    if (throttle > 0) {
+        fprintf(f, "# [Warning!] Thermal throttling events: %" PRIu64 "\n", throttle);
+        flagged = 1;
+    }
+    return flagged;
+}
+
+/* freq_source_name: Returns name of frequency source. */
+const char *freq_source_name(int source)
+{
+    switch (source) {
+    case FREQ_SOURCE_MSR: return "APERF/MPERF";
+    case FREQ_SOURCE_SYSFS: return "cpufreq";
+    default: return "none";
+    }
+}
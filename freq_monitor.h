@@ -0,0 +1,85 @@
+/*
+ * freq_monitor.h: Monitoring of core frequency and throttling during measurements.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef FREQ_MONITOR_H
+#define FREQ_MONITOR_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define FREQ_MONITOR_BATCHES_MAX 64
+
+enum {
+    FREQ_SOURCE_NONE = 0,
+    FREQ_SOURCE_MSR = 1,        /* IA32_APERF/IA32_MPERF by /dev/cpu/N/msr */
+    FREQ_SOURCE_SYSFS = 2       /* cpufreq scaling_cur_freq */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t tsc;
+    uint64_t aperf;
+    uint64_t mperf;
+    uint64_t cur_khz;           /* sysfs: current frequency */
+    uint64_t throttle_count;    /* Core + package thermal throttling events */
+} freq_sample_t;
+
+typedef struct {
+    int nruns;
+    double freq_mhz;            /* Effective frequency of the batch */
+    uint64_t throttle_events;
+} freq_batch_t;
+
+typedef struct {
+    int cpu;
+    int source;
+    int msr_fd;
+    double tsc_hz;
+    char sysfs_root[256];
+    freq_sample_t begin;
+    freq_batch_t batches[FREQ_MONITOR_BATCHES_MAX];
+    int nbatches;
+} freq_monitor_t;
+
+/*
+ * freq_monitor_open: Initializes monitor of given CPU: MSR if permitted,
+ *                    sysfs otherwise. sysfs_root is prepended to /sys paths
+ *                    (NULL or "" for real sysfs). Returns 0 on success.
+ */
+int freq_monitor_open(freq_monitor_t *mon, int cpu, const char *sysfs_root);
+
+/* freq_monitor_close: Releases resources of the monitor. */
+void freq_monitor_close(freq_monitor_t *mon);
+
+/* freq_monitor_sample: Reads counters of monitored CPU. */
+void freq_monitor_sample(freq_monitor_t *mon, freq_sample_t *sample);
+
+/* freq_monitor_batch_begin: Starts batch of measurements. */
+void freq_monitor_batch_begin(freq_monitor_t *mon);
+
+/* freq_monitor_batch_end: Finishes batch: computes effective frequency and throttling. */
+void freq_monitor_batch_end(freq_monitor_t *mon, int nruns);
+
+/* freq_monitor_variation: Returns (max - min) / min of batch frequencies (percents). */
+double freq_monitor_variation(freq_monitor_t *mon);
+
+/*
+ * freq_monitor_report: Prints batches; returns 1 if frequency varied more than
+ *                      threshold (percents) or throttling was detected.
+ */
+int freq_monitor_report(freq_monitor_t *mon, double threshold, FILE *f);
+
+/* freq_source_name: Returns name of frequency source. */
+const char *freq_source_name(int source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FREQ_MONITOR_H */
@@ -0,0 +1,238 @@
+/*
+ * instr_bench.c: Latency and throughput microbenchmarks of instructions.
+ *
+ * DEFINE_INSTR generates two loops of an instruction (or a short snippet):
+ * the body of a loop is unrolled UNROLL times by .rept of GNU as.
+ * Latency loop is a chain: every instruction depends on the result of the
+ * previous one. Throughput loop interleaves independent instructions on
+ * different registers, so they are limited only by execution ports.
+ * Operand %[m] is a cache line aligned scratch buffer for memory forms,
+ * %rax holds its address at the start (scratch[0] points to itself, so
+ * chain of loads of (%rax) stays in the same line). Vector registers are
+ * zeroed before the loop: garbage left by other code may be denormals that
+ * take microcode assists. Loops on ymm registers end with vzeroupper, so the
+ * following SSE code doesn't pay for AVX-SSE transitions.
+ *
+ * Time of loop is T(n) = a + b * n for n iterations, b / (UNROLL * ninstr)
+ * is the number of TSC ticks per instruction (cycles if the core runs
+ * at the nominal frequency), loop overhead is hidden by the unrolling.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "mathstat.h"
+#include "kernel_measure.h"
+#include "instr_bench.h"
+
+#define UNROLL 64
+#define UNROLL_STR "64"
+#define NLENS 5                 /* Iterations: 1, 2, 4, ..., 2^(NLENS - 1) */
+
+static uint64_t scratch[8] __attribute__((aligned(64)));
+
+#define INSTR_LOOP(fname, init, snippet, fini, ...)                                 \
+static void fname(void *arg)                                                        \
+{                                                                                   \
+    uint64_t n = *(uint64_t *)arg;                                                  \
+    __asm__ __volatile__ (                                                          \
+        "mov %[m], %%rax\n\t"                                                       \
+        init "\n"                                                                   \
+        "1:\n\t"                                                                    \
+        ".rept " UNROLL_STR "\n\t"                                                  \
+        snippet "\n\t"                                                              \
+        ".endr\n\t"                                                                 \
+        "dec %[n]\n\t"                                                              \
+        "jnz 1b\n\t"                                                                \
+        fini "\n"                                                                   \
+        : [n] "+r"(n)                                                               \
+        : [m] "r"(scratch)                                                          \
+        : "rax", __VA_ARGS__);                                                      \
+}
+
+/*
+ * DEFINE_INSTR: Defines instr_<name>_lat (lat snippet) and instr_<name>_tput
+ * (tput snippet). Clobbers must include all registers of the snippets
+ * except %rax (always clobbered).
+ */
+#define DEFINE_INSTR(name, lat, tput, ...)                                          \
+    INSTR_LOOP(instr_##name##_lat, "", lat, "", __VA_ARGS__)                        \
+    INSTR_LOOP(instr_##name##_tput, "", tput, "", __VA_ARGS__)
+
+/*
+ * DEFINE_INSTR_VEC: DEFINE_INSTR with init code before loops and fini code
+ * after them (zeroing of vector registers, vzeroupper).
+ */
+#define DEFINE_INSTR_VEC(name, init, lat, tput, fini, ...)                          \
+    INSTR_LOOP(instr_##name##_lat, init, lat, fini, __VA_ARGS__)                    \
+    INSTR_LOOP(instr_##name##_tput, init, tput, fini, __VA_ARGS__)
+
+/* Independent streams of two-operand instruction on 8 registers */
+#define GPR8(op)                                                                    \
+    op " %%rax, %%rax\n\t" op " %%rcx, %%rcx\n\t" op " %%rdx, %%rdx\n\t"            \
+    op " %%rsi, %%rsi\n\t" op " %%rdi, %%rdi\n\t" op " %%r8, %%r8\n\t"              \
+    op " %%r9, %%r9\n\t" op " %%r10, %%r10"
+#define GPR8_CLOBBERS "rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "cc"
+
+#define XMM8(op)                                                                    \
+    op " %%xmm0, %%xmm0\n\t" op " %%xmm1, %%xmm1\n\t" op " %%xmm2, %%xmm2\n\t"      \
+    op " %%xmm3, %%xmm3\n\t" op " %%xmm4, %%xmm4\n\t" op " %%xmm5, %%xmm5\n\t"      \
+    op " %%xmm6, %%xmm6\n\t" op " %%xmm7, %%xmm7"
+#define YMM8(op)                                                                    \
+    op " %%ymm0, %%ymm0, %%ymm0\n\t" op " %%ymm1, %%ymm1, %%ymm1\n\t"               \
+    op " %%ymm2, %%ymm2, %%ymm2\n\t" op " %%ymm3, %%ymm3, %%ymm3\n\t"               \
+    op " %%ymm4, %%ymm4, %%ymm4\n\t" op " %%ymm5, %%ymm5, %%ymm5\n\t"               \
+    op " %%ymm6, %%ymm6, %%ymm6\n\t" op " %%ymm7, %%ymm7, %%ymm7"
+#define XMM8_CLOBBERS "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7"
+#define XMM8_ZERO                                                                   \
+    "xorpd %%xmm0, %%xmm0\n\txorpd %%xmm1, %%xmm1\n\txorpd %%xmm2, %%xmm2\n\t"     \
+    "xorpd %%xmm3, %%xmm3\n\txorpd %%xmm4, %%xmm4\n\txorpd %%xmm5, %%xmm5\n\t"     \
+    "xorpd %%xmm6, %%xmm6\n\txorpd %%xmm7, %%xmm7"
+/* VEX form zeroes upper halves of ymm too */
+#define YMM8_ZERO                                                                   \
+    "vxorpd %%ymm0, %%ymm0, %%ymm0\n\tvxorpd %%ymm1, %%ymm1, %%ymm1\n\t"           \
+    "vxorpd %%ymm2, %%ymm2, %%ymm2\n\tvxorpd %%ymm3, %%ymm3, %%ymm3\n\t"           \
+    "vxorpd %%ymm4, %%ymm4, %%ymm4\n\tvxorpd %%ymm5, %%ymm5, %%ymm5\n\t"           \
+    "vxorpd %%ymm6, %%ymm6, %%ymm6\n\tvxorpd %%ymm7, %%ymm7, %%ymm7"
+
+DEFINE_INSTR(add, "add %%rax, %%rax", GPR8("add"), GPR8_CLOBBERS)
+DEFINE_INSTR(imul, "imul %%rax, %%rax", GPR8("imul"), GPR8_CLOBBERS)
+DEFINE_INSTR(popcnt, "popcnt %%rax, %%rax", GPR8("popcnt"), GPR8_CLOBBERS)
+DEFINE_INSTR(load, "mov (%%rax), %%rax",
+             "mov (%[m]), %%rax\n\tmov 8(%[m]), %%rcx\n\tmov 16(%[m]), %%rdx\n\tmov 24(%[m]), %%rsi",
+             "rcx", "rdx", "rsi", "memory")
+DEFINE_INSTR(lock_add, "lock addq %%rax, (%[m])", "lock addq %%rax, (%[m])", "cc", "memory")
+DEFINE_INSTR(lock_xadd, "lock xaddq %%rax, (%[m])", "lock xaddq %%rcx, (%[m])", "rcx", "cc", "memory")
+DEFINE_INSTR(lock_cmpxchg, "lock cmpxchgq %%rcx, (%[m])", "lock cmpxchgq %%rcx, (%[m])",
+             "rcx", "cc", "memory")
+DEFINE_INSTR(xchg, "xchg %%rax, (%[m])", "xchg %%rcx, (%[m])", "rcx", "memory")
+DEFINE_INSTR(lfence, "lfence", "lfence", "memory")
+DEFINE_INSTR(sfence, "sfence", "sfence", "memory")
+DEFINE_INSTR(mfence, "mfence", "mfence", "memory")
+DEFINE_INSTR(pause, "pause", "pause", "memory")
+DEFINE_INSTR(rdtsc, "rdtsc", "rdtsc", "rdx")
+DEFINE_INSTR(rdtscp, "rdtscp", "rdtscp", "rcx", "rdx")
+DEFINE_INSTR_VEC(addpd, XMM8_ZERO, "addpd %%xmm0, %%xmm0", XMM8("addpd"), "", XMM8_CLOBBERS)
+DEFINE_INSTR_VEC(mulpd, XMM8_ZERO, "mulpd %%xmm0, %%xmm0", XMM8("mulpd"), "", XMM8_CLOBBERS)
+DEFINE_INSTR_VEC(vaddpd, YMM8_ZERO, "vaddpd %%ymm0, %%ymm0, %%ymm0", YMM8("vaddpd"),
+                 "vzeroupper", XMM8_CLOBBERS)
+DEFINE_INSTR_VEC(vfmadd, YMM8_ZERO, "vfmadd231pd %%ymm0, %%ymm0, %%ymm0", YMM8("vfmadd231pd"),
+                 "vzeroupper", XMM8_CLOBBERS)
+
+#define INSTR(name, feature, lat_ninstr, tput_ninstr) \
+    {#name, feature, instr_##name##_lat, instr_##name##_tput, lat_ninstr, tput_ninstr}
+
+const instr_bench_t instr_benches[] = {
+    INSTR(add, NULL, 1, 8),
+    INSTR(imul, NULL, 1, 8),
+    INSTR(popcnt, "popcnt", 1, 8),
+    INSTR(load, NULL, 1, 4),
+    INSTR(lock_add, NULL, 1, 1),
+    INSTR(lock_xadd, NULL, 1, 1),
+    INSTR(lock_cmpxchg, NULL, 1, 1),
+    INSTR(xchg, NULL, 1, 1),
+    INSTR(lfence, NULL, 1, 1),
+    INSTR(sfence, NULL, 1, 1),
+    INSTR(mfence, NULL, 1, 1),
+    INSTR(pause, NULL, 1, 1),
+    INSTR(rdtsc, NULL, 1, 1),
+    INSTR(rdtscp, NULL, 1, 1),
+    INSTR(addpd, NULL, 1, 8),
+    INSTR(mulpd, NULL, 1, 8),
+    INSTR(vaddpd, "avx", 1, 8),
+    INSTR(vfmadd, "fma", 1, 8),
+    {NULL, NULL, NULL, NULL, 0, 0}
+};
+
+/* instr_bench_find: Returns benchmark of the instruction by name or NULL. */
+const instr_bench_t *instr_bench_find(const char *name)
+{
+    for (int i = 0; instr_benches[i].name != NULL; i++) {
+        if (strcmp(instr_benches[i].name, name) == 0)
+            return &instr_benches[i];
+    }
+    return NULL;
+}
+
+/* is_supported: Returns 1 if CPU supports instructions of the benchmark. */
+static int is_supported(const instr_bench_t *ib)
+{
+    __builtin_cpu_init();
+    if (ib->feature == NULL)
+        return 1;
+    if (strcmp(ib->feature, "popcnt") == 0)
+        return __builtin_cpu_supports("popcnt");
+    if (strcmp(ib->feature, "avx") == 0)
+        return __builtin_cpu_supports("avx");
+    if (strcmp(ib->feature, "fma") == 0)
+        return __builtin_cpu_supports("fma");
+    return 0;
+}
+
+/* fit_loop: Returns ticks per instruction of the loop (slope of time against iterations). */
+static int fit_loop(const tsc_read_method_t *method, void (*loop)(void *), int ninstr,
+                    uint64_t overhead, double *tpi, double *r2)
+{
+    double x[NLENS], y[NLENS];
+    double slope, intercept;
+
+    for (int i = 0; i < NLENS; i++) {
+        uint64_t n = (uint64_t)1 << i;
+        kernel_result_t res;
+        if (kernel_measure(method, loop, &n, overhead, &res) != 0)
+            return -1;
+        x[i] = n;
+        y[i] = res.mean;
+    }
+    *r2 = stat_linear_regression(x, y, NLENS, &slope, &intercept);
+    *tpi = slope / ((double)UNROLL * ninstr);
+    return 0;
+}
+
+/*
+ * instr_bench_measure: Measures chains and streams of several lengths, ticks
+ *                      per instruction are slopes of least squares fit
+ *                      (read method with its overhead). Returns 0 on success.
+ */
+int instr_bench_measure(const instr_bench_t *ib, const tsc_read_method_t *method,
+                        uint64_t overhead, instr_result_t *res)
+{
+    memset(res, 0, sizeof(*res));
+    if (strcmp(ib->name, "rdtscp") == 0)
+        res->available = is_rdtscp_available();
+    else
+        res->available = is_supported(ib);
+    if (!res->available)
+        return 0;
+
+    memset(scratch, 0, sizeof(scratch));
+    scratch[0] = (uint64_t)(uintptr_t)scratch;      /* load: chain of mov (%rax), %rax */
+    if (fit_loop(method, ib->lat, ib->lat_ninstr, overhead, &res->latency, &res->lat_r2) != 0)
+        return -1;
+    scratch[0] = (uint64_t)(uintptr_t)scratch;
+    if (fit_loop(method, ib->tput, ib->tput_ninstr, overhead, &res->rthroughput, &res->tput_r2) != 0)
+        return -1;
+    return 0;
+}
+
+/* instr_bench_report: Prints result of the instruction (header if ib is NULL). */
+void instr_bench_report(const instr_bench_t *ib, const instr_result_t *res, FILE *f)
+{
+    if (ib == NULL) {
+        fprintf(f, "# Instructions (TSC ticks per instruction, unroll %d)\n", UNROLL);
+        fprintf(f, "# [Instruction]  [Latency] [Recip. throughput] [Instr/tick] [R^2 lat] [R^2 tput]\n");
+        return;
+    }
+    if (!res->available) {
+        fprintf(f, "  %-14s (not supported by this processor)\n", ib->name);
+        return;
+    }
+    fprintf(f, "  %-14s %-9.2f %-19.2f %-12.2f %-9.4f %-9.4f\n", ib->name, res->latency,
+            res->rthroughput, res->rthroughput > 0.0 ? 1.0 / res->rthroughput : 0.0,
+            res->lat_r2, res->tput_r2);
+}
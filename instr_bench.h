@@ -0,0 +1,55 @@
+/*
+ * instr_bench.h: Latency and throughput microbenchmarks of instructions.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef INSTR_BENCH_H
+#define INSTR_BENCH_H
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tsc_x86.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *name;
+    const char *feature;        /* CPU feature for __builtin_cpu_supports (NULL: any x86-64) */
+    void (*lat)(void *arg);     /* Dependent chain, arg: uint64_t number of iterations */
+    void (*tput)(void *arg);    /* Independent streams */
+    int lat_ninstr;             /* Instructions per iteration */
+    int tput_ninstr;
+} instr_bench_t;
+
+extern const instr_bench_t instr_benches[];   /* Terminated by {NULL, ...} */
+
+typedef struct {
+    int available;
+    double latency;             /* Ticks per instruction of dependent chain */
+    double rthroughput;         /* Ticks per instruction of independent streams */
+    double lat_r2;
+    double tput_r2;
+} instr_result_t;
+
+/* instr_bench_find: Returns benchmark of the instruction by name or NULL. */
+const instr_bench_t *instr_bench_find(const char *name);
+
+/*
+ * instr_bench_measure: Measures chains and streams of several lengths, ticks
+ *                      per instruction are slopes of least squares fit
+ *                      (read method with its overhead). Returns 0 on success.
+ */
+int instr_bench_measure(const instr_bench_t *ib, const tsc_read_method_t *method,
+                        uint64_t overhead, instr_result_t *res);
+
+/* instr_bench_report: Prints result of the instruction (header if ib is NULL). */
+void instr_bench_report(const instr_bench_t *ib, const instr_result_t *res, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INSTR_BENCH_H */
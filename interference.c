@@ -0,0 +1,286 @@
+/*
+ * interference.c: Antagonist threads for sensitivity testing.
+ *
+ * Antagonists run with SCHED_OTHER policy (the measuring process may be
+ * SCHED_FIFO after preflight_apply) until interference_stop():
+ *   llc     -- read-modify-write with line stride over 2 x LLC size,
+ *   membw   -- copy between two halves of a 256 MiB buffer of the NUMA
+ *              node shared by threads of the node (every thread starts
+ *              at its own offset, i.e. memory locked by mlockall does not
+ *              grow with the number of threads),
+ *   avx     -- independent 256-bit multiplications (port and power
+ *              pressure on the SMT sibling), SSE if AVX is not supported,
+ *   syscall -- getppid() and mprotect() of a touched page: changes of
+ *              protection send TLB shootdown IPIs to CPUs of the process.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "numa_mem.h"
+#include "interference.h"
+
+enum {
+    LINE_SIZE = 64,
+    LLC_SIZE_DEFAULT = 32 << 20,
+    MEMBW_SIZE = 256 << 20
+};
+
+static const char *antagonist_names[ANTAGONIST_NKINDS] = {
+    "llc", "membw", "avx", "syscall"
+};
+
+/* llc_size: Returns size of the last level cache of the CPU (bytes). */
+static size_t llc_size(int cpu)
+{
+    char path[128];
+    size_t size = 0;
+
+    for (int index = 0; index < 8; index++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/size", cpu, index);
+        FILE *f = fopen(path, "r");
+        if (f == NULL)
+            break;
+        unsigned long kb;
+        if (fscanf(f, "%luK", &kb) == 1 && kb * 1024 > size)
+            size = kb * 1024;
+        fclose(f);
+    }
+    return size > 0 ? size : LLC_SIZE_DEFAULT;
+}
+
+static int stopped(interference_t *ifr)
+{
+    return __atomic_load_n(&ifr->stop, __ATOMIC_RELAXED);
+}
+
+static void antagonist_llc(interference_t *ifr)
+{
+    volatile uint8_t *buf = malloc(ifr->size);
+    if (buf == NULL)
+        return;
+    while (!stopped(ifr)) {
+        for (size_t i = 0; i < ifr->size; i += LINE_SIZE)
+            buf[i]++;
+    }
+    free((void *)buf);
+}
+
+static void antagonist_membw(antagonist_arg_t *a)
+{
+    char *buf = a->buf;
+    size_t half = a->ifr->size / 2, off = a->offset;
+
+    while (!stopped(a->ifr)) {
+        memcpy(buf + half + off, buf + off, half - off);
+        memcpy(buf + half, buf, off);
+        memcpy(buf + off, buf + half + off, half - off);
+        memcpy(buf, buf + half, off);
+    }
+}
+
+/* membw_node_buf: Returns shared buffer of the CPU's node (allocated on first use) or NULL. */
+static char *membw_node_buf(interference_t *ifr, int cpu)
+{
+    int node = numa_mem_node_of_cpu(cpu);
+
+    for (int i = 0; i < ifr->nbufs; i++) {
+        if (ifr->buf_nodes[i] == node)
+            return ifr->bufs[i];
+    }
+    if (ifr->nbufs >= INTERFERENCE_NODES_MAX)
+        return NULL;
+    char *buf = numa_mem_alloc(ifr->size, node);
+    if (buf == NULL)
+        return NULL;
+    memset(buf, 1, ifr->size);
+    ifr->buf_nodes[ifr->nbufs] = node;
+    ifr->bufs[ifr->nbufs++] = buf;
+    return buf;
+}
+
+static void antagonist_avx(interference_t *ifr)
+{
+    static const double ones[4] __attribute__((aligned(32))) = {1.0, 1.0, 1.0, 1.0};
+
+    /*
+     * Accumulators are loaded with ones by the same asm statement: products
+     * stay 1.0 (no denormals), and registers are not kept between statements.
+     */
+    if (__builtin_cpu_supports("avx")) {
+        while (!stopped(ifr)) {
+            __asm__ __volatile__ (
+                "vmovapd %0, %%ymm0\n"
+                "vmovapd %%ymm0, %%ymm1\n"
+                "vmovapd %%ymm0, %%ymm2\n"
+                "vmovapd %%ymm0, %%ymm3\n"
+                "vmovapd %%ymm0, %%ymm4\n"
+                ".rept 64\n"
+                "vmulpd %%ymm0, %%ymm1, %%ymm1\n"
+                "vmulpd %%ymm0, %%ymm2, %%ymm2\n"
+                "vmulpd %%ymm0, %%ymm3, %%ymm3\n"
+                "vmulpd %%ymm0, %%ymm4, %%ymm4\n"
+                ".endr\n"
+                :: "m" (ones) : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4"
+            );
+        }
+        __asm__ __volatile__ ("vzeroupper" ::: "memory");
+    } else {
+        while (!stopped(ifr)) {
+            __asm__ __volatile__ (
+                "movapd %0, %%xmm0\n"
+                "movapd %%xmm0, %%xmm1\n"
+                "movapd %%xmm0, %%xmm2\n"
+                "movapd %%xmm0, %%xmm3\n"
+                "movapd %%xmm0, %%xmm4\n"
+                ".rept 64\n"
+                "mulpd %%xmm0, %%xmm1\n"
+                "mulpd %%xmm0, %%xmm2\n"
+                "mulpd %%xmm0, %%xmm3\n"
+                "mulpd %%xmm0, %%xmm4\n"
+                ".endr\n"
+                :: "m" (ones) : "xmm0", "xmm1", "xmm2", "xmm3", "xmm4"
+            );
+        }
+    }
+}
+
+static void antagonist_syscall(interference_t *ifr)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    volatile char *page = mmap(NULL, pagesize, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED)
+        return;
+    while (!stopped(ifr)) {
+        syscall(SYS_getppid);
+        page[0]++;
+        mprotect((void *)page, pagesize, PROT_READ);
+        mprotect((void *)page, pagesize, PROT_READ | PROT_WRITE);
+    }
+    munmap((void *)page, pagesize);
+}
+
+static void *antagonist_thread(void *arg)
+{
+    antagonist_arg_t *a = arg;
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(a->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    switch (a->ifr->kind) {
+    case ANTAGONIST_LLC: antagonist_llc(a->ifr); break;
+    case ANTAGONIST_MEMBW: antagonist_membw(a); break;
+    case ANTAGONIST_AVX: antagonist_avx(a->ifr); break;
+    case ANTAGONIST_SYSCALL: antagonist_syscall(a->ifr); break;
+    }
+    return NULL;
+}
+
+/*
+ * interference_start: Starts antagonist threads of the kind pinned to
+ * cpus[0..ncpus-1] (SCHED_OTHER policy). Returns 0 on success.
+ */
+int interference_start(interference_t *ifr, int kind, const int *cpus, int ncpus)
+{
+    pthread_attr_t attr;
+    struct sched_param param = {.sched_priority = 0};
+
+    memset(ifr, 0, sizeof(*ifr));
+    if (kind < 0 || kind >= ANTAGONIST_NKINDS || ncpus < 1 || ncpus > INTERFERENCE_THREADS_MAX)
+        return -1;
+    ifr->kind = kind;
+    if (kind == ANTAGONIST_LLC)
+        ifr->size = 2 * llc_size(cpus[0]);
+    else if (kind == ANTAGONIST_MEMBW)
+        ifr->size = MEMBW_SIZE;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    for (int i = 0; i < ncpus; i++) {
+        ifr->args[i].ifr = ifr;
+        ifr->args[i].cpu = cpus[i];
+        if (kind == ANTAGONIST_MEMBW) {
+            if ( (ifr->args[i].buf = membw_node_buf(ifr, cpus[i])) == NULL) {
+                fprintf(stderr, "# No enough memory for antagonist buffer\n");
+                pthread_attr_destroy(&attr);
+                interference_stop(ifr);
+                return -1;
+            }
+            ifr->args[i].offset = ifr->size / 2 / ncpus * i / LINE_SIZE * LINE_SIZE;
+        }
+        if (pthread_create(&ifr->tids[i], &attr, antagonist_thread, &ifr->args[i]) != 0) {
+            pthread_attr_destroy(&attr);
+            interference_stop(ifr);
+            return -1;
+        }
+        ifr->nthreads++;
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+/* interference_stop: Stops and joins antagonist threads. */
+void interference_stop(interference_t *ifr)
+{
+    __atomic_store_n(&ifr->stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < ifr->nthreads; i++)
+        pthread_join(ifr->tids[i], NULL);
+    ifr->nthreads = 0;
+    for (int i = 0; i < ifr->nbufs; i++)
+        numa_mem_free(ifr->bufs[i], ifr->size);
+    ifr->nbufs = 0;
+}
+
+/* interference_smt_siblings: Stores SMT siblings of the CPU (without it). Returns their number. */
+int interference_smt_siblings(int cpu, int *cpus, int maxcpus)
+{
+    char path[128], buf[256];
+    int list[INTERFERENCE_THREADS_MAX];
+    int n = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+        int nlist = numa_mem_parse_list(buf, list, INTERFERENCE_THREADS_MAX);
+        for (int i = 0; i < nlist && n < maxcpus; i++) {
+            if (list[i] != cpu)
+                cpus[n++] = list[i];
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+/* antagonist_name: Returns name of the antagonist. */
+const char *antagonist_name(int kind)
+{
+    return kind >= 0 && kind < ANTAGONIST_NKINDS ? antagonist_names[kind] : "none";
+}
+
+/* antagonist_parse: Returns antagonist by name or -1. */
+int antagonist_parse(const char *name)
+{
+    for (int i = 0; i < ANTAGONIST_NKINDS; i++) {
+        if (strcmp(antagonist_names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
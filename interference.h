@@ -0,0 +1,71 @@
+/*
+ * interference.h: Antagonist threads for sensitivity testing.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef INTERFERENCE_H
+#define INTERFERENCE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+enum {
+    ANTAGONIST_LLC = 0,         /* Read-modify-write of lines of a buffer 2 x LLC */
+    ANTAGONIST_MEMBW = 1,       /* Streaming copy of a large buffer */
+    ANTAGONIST_AVX = 2,         /* 256-bit FP multiplications on SMT sibling */
+    ANTAGONIST_SYSCALL = 3,     /* System calls and TLB shootdown IPIs */
+    ANTAGONIST_NKINDS = 4
+};
+
+#define INTERFERENCE_THREADS_MAX 256
+#define INTERFERENCE_NODES_MAX 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct interference interference_t;
+
+typedef struct {
+    interference_t *ifr;
+    int cpu;
+    char *buf;                  /* Shared buffer of the CPU's node (membw) */
+    size_t offset;              /* Start of the copy in the buffer half (membw) */
+} antagonist_arg_t;
+
+struct interference {
+    int kind;
+    int nthreads;
+    int stop;
+    pthread_t tids[INTERFERENCE_THREADS_MAX];
+    antagonist_arg_t args[INTERFERENCE_THREADS_MAX];
+    size_t size;                /* Buffer of a thread (LLC) or a node (membw) */
+    int nbufs;
+    int buf_nodes[INTERFERENCE_NODES_MAX];
+    char *bufs[INTERFERENCE_NODES_MAX];
+};
+
+/*
+ * interference_start: Starts antagonist threads of the kind pinned to
+ * cpus[0..ncpus-1] (SCHED_OTHER policy). Returns 0 on success.
+ */
+int interference_start(interference_t *ifr, int kind, const int *cpus, int ncpus);
+
+/* interference_stop: Stops and joins antagonist threads. */
+void interference_stop(interference_t *ifr);
+
+/* interference_smt_siblings: Stores SMT siblings of the CPU (without it). Returns their number. */
+int interference_smt_siblings(int cpu, int *cpus, int maxcpus);
+
+/* antagonist_name: Returns name of the antagonist. */
+const char *antagonist_name(int kind);
+
+/* antagonist_parse: Returns antagonist by name or -1. */
+int antagonist_parse(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* INTERFERENCE_H */
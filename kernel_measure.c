@@ -0,0 +1,155 @@
+/*
+ * kernel_measure.c: Measurement of kernels called by pointer.
+ *
+ * Measurement loops are instantiated for every read method by macro (as
+ * DEFINE_OVERHEAD_FUNCS in tsc_x86.c), so reads of TSC are inlined into
+ * loops and the overhead of the method applies to them.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "mathstat.h"
+#include "kernel_measure.h"
+
+#define RSE_MAX 5.0
+
+/*
+ * DEFINE_KERNEL_MEASURE: Defines kernel_measure_<method>() and
+ * kernel_measure_runs_<method>() for the pair of read functions.
+ */
+#define DEFINE_KERNEL_MEASURE(method, before, after)                                \
+static int kernel_measure_##method(void (*func)(void *), void *arg,                 \
+                                   uint64_t overhead, stat_sample_t *stat)          \
+{                                                                                   \
+    enum {                                                                          \
+        NRUNS_MIN = 100,                                                            \
+        NRUNS_MAX = 1000000                                                         \
+    };                                                                              \
+    volatile uint64_t t0, t1;                                                       \
+                                                                                    \
+    /* Warmup I-cache and data */                                                   \
+    for (int i = 0; i < 10; i++)                                                    \
+        func(arg);                                                                  \
+                                                                                    \
+    int nruns = NRUNS_MIN;                                                          \
+    do {                                                                            \
+        stat_sample_clean(stat);                                                    \
+        for (int i = 0; i < nruns; ) {                                              \
+            t0 = before();                                                          \
+            func(arg);                                                              \
+            t1 = after();                                                           \
+            /* Accumulate only correct results */                                   \
+            if (t1 > t0 && t1 - t0 > overhead) {                                    \
+                stat_sample_add(stat, (double)(t1 - t0 - overhead));                \
+                i++;                                                                \
+            }                                                                       \
+        }                                                                           \
+        nruns *= 4;                                                                 \
+    } while (stat_sample_size(stat) < NRUNS_MAX &&                                  \
+             stat_sample_rel_stderr_knuth(stat) > RSE_MAX);                         \
+    return 0;                                                                       \
+}                                                                                   \
+                                                                                    \
+static void kernel_measure_runs_##method(void (*func)(void *), void *arg,           \
+                                         uint64_t overhead, int nruns,              \
+                                         void (*sample)(void *ctx, uint64_t ticks), \
+                                         void *ctx)                                 \
+{                                                                                   \
+    volatile uint64_t t0, t1;                                                       \
+                                                                                    \
+    for (int i = 0; i < nruns; i++) {                                               \
+        t0 = before();                                                              \
+        func(arg);                                                                  \
+        t1 = after();                                                               \
+        sample(ctx, normolize_ticks(t0, t1, overhead));                             \
+    }                                                                               \
+}
+
+DEFINE_KERNEL_MEASURE(std, read_tsc_before_std, read_tsc_after_std)
+DEFINE_KERNEL_MEASURE(intel, read_tsc_before_intel, read_tsc_after_intel)
+DEFINE_KERNEL_MEASURE(lfence, read_tsc_before_lfence, read_tsc_after_lfence)
+DEFINE_KERNEL_MEASURE(mfence, read_tsc_before_mfence, read_tsc_after_mfence)
+DEFINE_KERNEL_MEASURE(cpuid4, read_tsc_cpuid2, read_tsc_cpuid2)
+DEFINE_KERNEL_MEASURE(lfence2, read_tsc_lfence2, read_tsc_lfence2)
+DEFINE_KERNEL_MEASURE(rdtscp, read_tsc_rdtscp_lfence, read_tsc_rdtscp_lfence)
+DEFINE_KERNEL_MEASURE(mfence_lfence, read_tsc_mfence_lfence, read_tsc_mfence_lfence)
+
+/* Measurement loops of read methods (same order as tsc_read_methods) */
+static const struct {
+    const char *name;
+    int (*measure)(void (*func)(void *), void *arg, uint64_t overhead, stat_sample_t *stat);
+    void (*runs)(void (*func)(void *), void *arg, uint64_t overhead, int nruns,
+                 void (*sample)(void *ctx, uint64_t ticks), void *ctx);
+} measure_methods[] = {
+    {"std", kernel_measure_std, kernel_measure_runs_std},
+    {"intel", kernel_measure_intel, kernel_measure_runs_intel},
+    {"lfence", kernel_measure_lfence, kernel_measure_runs_lfence},
+    {"mfence", kernel_measure_mfence, kernel_measure_runs_mfence},
+    {"cpuid4", kernel_measure_cpuid4, kernel_measure_runs_cpuid4},
+    {"lfence2", kernel_measure_lfence2, kernel_measure_runs_lfence2},
+    {"rdtscp", kernel_measure_rdtscp, kernel_measure_runs_rdtscp},
+    {"mfence_lfence", kernel_measure_mfence_lfence, kernel_measure_runs_mfence_lfence},
+    {NULL, NULL, NULL}
+};
+
+/* find_loops: Returns index of measurement loops of the read method or -1. */
+static int find_loops(const tsc_read_method_t *method)
+{
+    for (int i = 0; measure_methods[i].name != NULL; i++) {
+        if (strcmp(measure_methods[i].name, method->name) == 0)
+            return i;
+    }
+    fprintf(stderr, "# Error: no measurement loop for TSC read method '%s'\n", method->name);
+    return -1;
+}
+
+/*
+ * kernel_measure: Measures execution time of func(arg) (ticks) by the read
+ *                 method (overhead is its overhead) with given precision
+ *                 (RSE). Returns 0 on success.
+ */
+int kernel_measure(const tsc_read_method_t *method, void (*func)(void *), void *arg,
+                   uint64_t overhead, kernel_result_t *res)
+{
+    int m = find_loops(method);
+    if (m < 0)
+        return -1;
+    stat_sample_t *stat = stat_sample_create();
+    if (stat == NULL) {
+        fprintf(stderr, "# No enough memory for statistics\n");
+        return -1;
+    }
+
+    measure_methods[m].measure(func, arg, overhead, stat);
+
+    res->nruns = stat_sample_size(stat);
+    res->mean = stat_sample_mean_knuth(stat);
+    res->stddev = stat_sample_stddev_knuth(stat);
+    res->rse = stat_sample_rel_stderr_knuth(stat);
+    res->min = stat_sample_min(stat);
+    res->max = stat_sample_max(stat);
+    stat_sample_free(stat);
+    return 0;
+}
+
+/*
+ * kernel_measure_runs: Measures nruns of func(arg) by the read method without
+ *                      warmup and passes time of every run (normolize_ticks)
+ *                      to sample(ctx, ticks). Returns 0 on success.
+ */
+int kernel_measure_runs(const tsc_read_method_t *method, void (*func)(void *), void *arg,
+                        uint64_t overhead, int nruns, void (*sample)(void *ctx, uint64_t ticks),
+                        void *ctx)
+{
+    int m = find_loops(method);
+    if (m < 0)
+        return -1;
+    measure_methods[m].runs(func, arg, overhead, nruns, sample, ctx);
+    return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * kernel_measure.h: Measurement of kernels called by pointer.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef KERNEL_MEASURE_H
+#define KERNEL_MEASURE_H
+
+#include <inttypes.h>
+#include "tsc_x86.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int nruns;
+    double mean;
+    double stddev;
+    double rse;
+    double min;
+    double max;
+} kernel_result_t;
+
+/*
+ * kernel_measure: Measures execution time of func(arg) (ticks) by the read
+ *                 method (overhead is its overhead) with given precision
+ *                 (RSE). Returns 0 on success.
+ */
+int kernel_measure(const tsc_read_method_t *method, void (*func)(void *), void *arg,
+                   uint64_t overhead, kernel_result_t *res);
+
+/*
+ * kernel_measure_runs: Measures nruns of func(arg) by the read method without
+ *                      warmup and passes time of every run (normolize_ticks)
+ *                      to sample(ctx, ticks). Returns 0 on success.
+ */
+int kernel_measure_runs(const tsc_read_method_t *method, void (*func)(void *), void *arg,
+                        uint64_t overhead, int nruns, void (*sample)(void *ctx, uint64_t ticks),
+                        void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KERNEL_MEASURE_H */
@@ -0,0 +1,239 @@
+/*
+ * libtscbench.c: Embeddable region timing API.
+ *
+ * Every thread owns a table of samples (one sample per region), tables
+ * are linked into a global list. Recording touches only the table of
+ * calling thread; readers (tscbench_region_stat) merge tables of all
+ * threads and samples of exited threads. Table of a thread is merged into
+ * the retired samples and freed at thread exit (destructor of pthread key),
+ * so thread pools with short-lived threads do not grow the list.
+ *
+ * Regions over TSCBENCH_REGIONS_MAX map to the overflow region: its
+ * measurements are dropped and counted (tscbench_dropped).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "mathstat.h"
+#include "tscbench.h"
+
+struct tscbench_region {
+    int id;
+    char name[TSCBENCH_REGION_NAME_MAX];
+};
+
+typedef struct thread_samples {
+    stat_sample_t *samples[TSCBENCH_REGIONS_MAX];
+    struct thread_samples *next;
+} thread_samples_t;
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static uint64_t tsc_overhead = 0;
+static pthread_key_t self_key;
+
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+static tscbench_region_t regions[TSCBENCH_REGIONS_MAX];
+static int nregions = 0;
+static tscbench_region_t overflow_region = {.id = -1, .name = "<overflow>"};
+static uint64_t ndropped = 0;
+
+/* Tables of live threads and merged samples of exited threads */
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_samples_t *threads = NULL;
+static stat_sample_t *retired[TSCBENCH_REGIONS_MAX];
+static __thread thread_samples_t *self = NULL;
+
+static void thread_samples_release(void *arg);
+
+static void calibrate()
+{
+    tsc_overhead = measure_tsc_overhead();
+    pthread_key_create(&self_key, thread_samples_release);
+}
+
+/* tscbench_init: Calibrates TSC overhead (only once). Returns 0 on success. */
+int tscbench_init()
+{
+    if (!is_tsc_available())
+        return -1;
+    return pthread_once(&calibrate_once, calibrate) == 0 ? 0 : -1;
+}
+
+/* tscbench_overhead: Returns calibrated TSC overhead (ticks). */
+uint64_t tscbench_overhead()
+{
+    tscbench_init();
+    return tsc_overhead;
+}
+
+/*
+ * tscbench_region: Returns region with given name, registers new region
+ *                  if it does not exist. Returns the overflow region
+ *                  (measurements are dropped) if limit of regions is
+ *                  exceeded or TSC is not available.
+ */
+tscbench_region_t *tscbench_region(const char *name)
+{
+    tscbench_region_t *region = NULL;
+
+    if (tscbench_init() != 0)
+        return &overflow_region;
+
+    pthread_mutex_lock(&regions_lock);
+    for (int i = 0; i < nregions; i++) {
+        if (strncmp(regions[i].name, name, TSCBENCH_REGION_NAME_MAX - 1) == 0) {
+            region = &regions[i];
+            break;
+        }
+    }
+    if (region == NULL && nregions < TSCBENCH_REGIONS_MAX) {
+        region = &regions[nregions];
+        region->id = nregions;
+        strncpy(region->name, name, TSCBENCH_REGION_NAME_MAX - 1);
+        region->name[TSCBENCH_REGION_NAME_MAX - 1] = '\0';
+        /* Publish region after initialization */
+        __atomic_store_n(&nregions, nregions + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&regions_lock);
+    return region != NULL ? region : &overflow_region;
+}
+
+/* tscbench_region_name: Returns name of the region. */
+const char *tscbench_region_name(tscbench_region_t *region)
+{
+    return region->name;
+}
+
+/* tscbench_dropped: Returns number of measurements of the overflow region. */
+uint64_t tscbench_dropped()
+{
+    return __atomic_load_n(&ndropped, __ATOMIC_RELAXED);
+}
+
+/* thread_samples_create: Creates table of samples for calling thread. */
+static thread_samples_t *thread_samples_create()
+{
+    thread_samples_t *ts = calloc(1, sizeof(*ts));
+    if (ts == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&threads_lock);
+    ts->next = threads;
+    threads = ts;
+    pthread_mutex_unlock(&threads_lock);
+    pthread_setspecific(self_key, ts);
+    self = ts;
+    return ts;
+}
+
+/*
+ * thread_samples_release: Destructor of table at thread exit: merges its
+ *                         samples into the retired ones and frees it.
+ */
+static void thread_samples_release(void *arg)
+{
+    thread_samples_t *ts = arg;
+
+    pthread_mutex_lock(&threads_lock);
+    for (thread_samples_t **p = &threads; *p != NULL; p = &(*p)->next) {
+        if (*p == ts) {
+            *p = ts->next;
+            break;
+        }
+    }
+    for (int i = 0; i < TSCBENCH_REGIONS_MAX; i++) {
+        if (ts->samples[i] == NULL)
+            continue;
+        if (retired[i] == NULL)
+            retired[i] = stat_sample_create();
+        if (retired[i] != NULL)
+            stat_sample_merge(retired[i], ts->samples[i]);
+        stat_sample_free(ts->samples[i]);
+    }
+    pthread_mutex_unlock(&threads_lock);
+    free(ts);
+    self = NULL;
+}
+
+/*
+ * tscbench_region_record: Adds measurement t1 - t0 - overhead to the samples
+ *                         of calling thread.
+ */
+void tscbench_region_record(tscbench_region_t *region, uint64_t t0, uint64_t t1)
+{
+    if (__builtin_expect(region == NULL || region->id < 0, 0)) {
+        __atomic_add_fetch(&ndropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    thread_samples_t *ts = self;
+    if (__builtin_expect(ts == NULL, 0)) {
+        if ( (ts = thread_samples_create()) == NULL)
+            return;
+    }
+
+    stat_sample_t *sample = ts->samples[region->id];
+    if (__builtin_expect(sample == NULL, 0)) {
+        if ( (sample = stat_sample_create()) == NULL)
+            return;
+        __atomic_store_n(&ts->samples[region->id], sample, __ATOMIC_RELEASE);
+    }
+    if (t1 > t0)
+        stat_sample_add(sample, (double)normolize_ticks(t0, t1, tsc_overhead));
+}
+
+/*
+ * tscbench_region_stat: Merges samples of all threads into sample stat.
+ *                       Values are exact if timed threads are quiescent.
+ */
+void tscbench_region_stat(tscbench_region_t *region, stat_sample_t *stat)
+{
+    stat_sample_clean(stat);
+    if (region == NULL || region->id < 0)
+        return;
+
+    pthread_mutex_lock(&threads_lock);
+    if (retired[region->id] != NULL)
+        stat_sample_merge(stat, retired[region->id]);
+    for (thread_samples_t *ts = threads; ts != NULL; ts = ts->next) {
+        stat_sample_t *sample = __atomic_load_n(&ts->samples[region->id], __ATOMIC_ACQUIRE);
+        if (sample != NULL)
+            stat_sample_merge(stat, sample);
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+/* tscbench_report: Prints statistics of all regions. */
+void tscbench_report(FILE *f)
+{
+    stat_sample_t *stat = stat_sample_create();
+    if (stat == NULL) {
+        fprintf(stderr, "# No enough memory for statistics\n");
+        return;
+    }
+
+    fprintf(f, "# Region statistic (ticks), TSC overhead %" PRIu64 "\n", tsc_overhead);
+    fprintf(f, "# [Region]                [Count]    [Mean]             [StdDev]           [Min]              [Max]\n");
+    int n = __atomic_load_n(&nregions, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++) {
+        tscbench_region_stat(&regions[i], stat);
+        if (stat_sample_size(stat) == 0)
+            continue;
+        fprintf(f, "  %-24s %-10d %-18.2f %-18.2f %-18.2f %-18.2f\n",
+                regions[i].name, stat_sample_size(stat), stat_sample_mean_knuth(stat),
+                stat_sample_stddev_knuth(stat), stat_sample_min(stat), stat_sample_max(stat));
+    }
+    if (tscbench_dropped() > 0)
+        fprintf(f, "# [Warning!] Measurements of regions over limit %d are dropped: %" PRIu64 "\n",
+                TSCBENCH_REGIONS_MAX, tscbench_dropped());
+    stat_sample_free(stat);
+}
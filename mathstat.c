@@ -4,6 +4,7 @@
  * Copyright (C) 2014 Mikhail Kurnosov <mkurnosov@gmail.com>
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <math.h>
@@ -38,6 +39,9 @@ struct stat_sample {
     uint32_t min_index;   /* Elements are numbered from 0: 0, 1, 2, ... */
     uint32_t max_index;
     uint32_t size;        /* Number of elements in sample */
+    double *values;       /* Raw values (if kept by stat_sample_keep_values) */
+    uint32_t nvalues;
+    uint32_t maxvalues;
 };
 
 /* stat_sample_create: Creates empty sample. Returns NULL on error. */
@@ -48,6 +52,8 @@ stat_sample_t *stat_sample_create()
     if ( (sample = malloc(sizeof(*sample))) == NULL)
         return NULL;
         
+    sample->values = NULL;
+    sample->maxvalues = 0;
     stat_sample_clean(sample);
     return sample;
 }
@@ -55,8 +61,10 @@ stat_sample_t *stat_sample_create()
 /* stat_sample_free: Frees sample. */
 void stat_sample_free(stat_sample_t *sample)
 {
-    if (sample)
+    if (sample) {
+        free(sample->values);
         free(sample);
+    }
 }
 
 /* stat_sample_clean: Cleans sample. */
@@ -71,6 +79,29 @@ void stat_sample_clean(stat_sample_t *sample)
     sample->max_index = (uint32_t)~0x1;
     sample->knuth_mean = 0;
     sample->knuth_var = 0;
+    sample->nvalues = 0;
+}
+
+/*
+ * stat_sample_keep_values: Keeps first maxvalues raw values added to the
+ *                          sample (after the last clean). Returns 0 on success.
+ */
+int stat_sample_keep_values(stat_sample_t *sample, int maxvalues)
+{
+    double *values = realloc(sample->values, sizeof(*values) * maxvalues);
+    if (values == NULL)
+        return -1;
+    sample->values = values;
+    sample->maxvalues = maxvalues;
+    sample->nvalues = 0;
+    return 0;
+}
+
+/* stat_sample_values: Returns kept raw values of the sample. */
+double *stat_sample_values(stat_sample_t *sample, int *nvalues)
+{
+    *nvalues = sample->nvalues;
+    return sample->values;
 }
 
 /* stat_sample_add: Adds value to the sample. */
@@ -89,6 +120,8 @@ void stat_sample_add(stat_sample_t *sample, double val)
         sample->max_index = sample->size;
     }
     sample->size++;
+    if (sample->nvalues < sample->maxvalues)
+        sample->values[sample->nvalues++] = val;
 
     /* B.P. Welford's approach */
     if (sample->size > 1) {       
@@ -102,6 +135,39 @@ void stat_sample_add(stat_sample_t *sample, double val)
     }
 }
 
+/*
+ * stat_sample_add_weighted: Adds count copies of the value to the sample
+ *                           (equivalent to count calls of stat_sample_add).
+ *                           Size of sample is clamped to INT32_MAX elements.
+ */
+void stat_sample_add_weighted(stat_sample_t *sample, double val, uint64_t count)
+{
+    /* stat_sample_size() returns int */
+    uint64_t room = INT32_MAX - (uint64_t)sample->size;
+    if (count > room) {
+        fprintf(stderr, "# [Warning!] Sample size is limited by %" PRId32 " elements: "
+                "%" PRIu64 " copies of %.2f are dropped\n", INT32_MAX, count - room, val);
+        count = room;
+    }
+    if (count == 0)
+        return;
+
+    stat_sample_t batch;
+    batch.values = NULL;
+    batch.maxvalues = 0;
+    stat_sample_clean(&batch);
+    batch.size = count;
+    batch.sum = val * count;
+    batch.sum_pow2 = val * val * count;
+    batch.min = val;
+    batch.max = val;
+    batch.min_index = 0;
+    batch.max_index = 0;
+    batch.knuth_mean = val;
+    batch.knuth_var = 0;
+    stat_sample_merge(sample, &batch);
+}
+
 /* stat_sample_add_dataset: Adds array of values to the sample. */
 void stat_sample_add_dataset(stat_sample_t *sample, double *dataset, int size)
 {
@@ -109,6 +175,46 @@ void stat_sample_add_dataset(stat_sample_t *sample, double *dataset, int size)
         stat_sample_add(sample, dataset[i]);
 }
 
+/*
+ * stat_sample_merge: Adds all elements of sample src to sample dst.
+ *                    Welford's statistics are combined by Chan's formula:
+ *                    M = Ma + d * Nb / N, S = Sa + Sb + d^2 * Na * Nb / N,
+ *                    where d = Mb - Ma, N = Na + Nb.
+ */
+void stat_sample_merge(stat_sample_t *dst, stat_sample_t *src)
+{
+    if (src->size == 0)
+        return;
+    if (dst->size == 0) {
+        /* Raw values are not merged */
+        double *values = dst->values;
+        uint32_t nvalues = dst->nvalues, maxvalues = dst->maxvalues;
+        *dst = *src;
+        dst->values = values;
+        dst->nvalues = nvalues;
+        dst->maxvalues = maxvalues;
+        return;
+    }
+
+    double n = (double)dst->size + src->size;
+    double delta = src->knuth_mean - dst->knuth_mean;
+    dst->knuth_var = dst->knuth_var + src->knuth_var +
+                     delta * delta * dst->size * src->size / n;
+    dst->knuth_mean = dst->knuth_mean + delta * src->size / n;
+    
+    dst->sum += src->sum;
+    dst->sum_pow2 += src->sum_pow2;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+        dst->min_index = dst->size + src->min_index;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+        dst->max_index = dst->size + src->max_index;
+    }
+    dst->size += src->size;
+}
+
 /* stat_sample_mean: Returns sample mean. */
 double stat_sample_mean(stat_sample_t *sample)
 {
@@ -346,6 +452,49 @@ int stat_max_index(double *data, int size)
     return imax;
 }
 
+/*
+ * stat_hist_percentile: Returns p-th percentile (0 <= p <= 100) of the
+ * histogram: values[i] is sorted in ascending order, counts[i] is number
+ * of elements equal to values[i]. Returns the smallest value which is
+ * greater than or equal to p percents of elements.
+ */
+double stat_hist_percentile(double *values, uint64_t *counts, int size, double p)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < size; i++)
+        total += counts[i];
+    if (total == 0)
+        return 0.0;
+
+    double rank = p / 100.0 * total;
+    uint64_t sum = 0;
+    for (int i = 0; i < size; i++) {
+        sum += counts[i];
+        if (counts[i] > 0 && (double)sum >= rank)
+            return values[i];
+    }
+    return values[size - 1];
+}
+
+/*
+ * stat_linear_regression: Fits y = intercept + slope * x by least squares.
+ *                         Returns coefficient of determination R^2.
+ */
+double stat_linear_regression(double *x, double *y, int size, double *slope, double *intercept)
+{
+    double mx = stat_mean(x, size), my = stat_mean(y, size);
+    double sxx = 0.0, sxy = 0.0, syy = 0.0;
+
+    for (int i = 0; i < size; i++) {
+        sxx += (x[i] - mx) * (x[i] - mx);
+        sxy += (x[i] - mx) * (y[i] - my);
+        syy += (y[i] - my) * (y[i] - my);
+    }
+    *slope = sxx > 0.0 ? sxy / sxx : 0.0;
+    *intercept = my - *slope * mx;
+    return sxx > 0.0 && syy > 0.0 ? sxy * sxy / (sxx * syy) : 1.0;
+}
+
 /* fcmp: Compares two elements of type double. */
 static int fcmp(const void *a, const void *b)
 {
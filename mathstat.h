@@ -19,7 +19,11 @@ stat_sample_t *stat_sample_create();
 void stat_sample_free(stat_sample_t *sample);
 void stat_sample_clean(stat_sample_t *sample);
 void stat_sample_add(stat_sample_t *sample, double val);
+int stat_sample_keep_values(stat_sample_t *sample, int maxvalues);
+double *stat_sample_values(stat_sample_t *sample, int *nvalues);
 void stat_sample_add_dataset(stat_sample_t *sample, double *dataset, int size);
+void stat_sample_add_weighted(stat_sample_t *sample, double val, uint64_t count);
+void stat_sample_merge(stat_sample_t *dst, stat_sample_t *src);
 double stat_sample_mean(stat_sample_t *sample);
 double stat_sample_mean_knuth(stat_sample_t *sample);
 double stat_sample_var(stat_sample_t *sample);
@@ -46,6 +50,10 @@ int stat_min_index(double *data, int size);
 double stat_max(double *data, int size);
 int stat_max_index(double *data, int size);
 
+double stat_linear_regression(double *x, double *y, int size, double *slope, double *intercept);
+
+double stat_hist_percentile(double *values, uint64_t *counts, int size, double p);
+
 int stat_dataset_remove_outliers(double *data, int size, int lb, int ub);
 
 #ifdef __cplusplus
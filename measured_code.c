@@ -4,21 +4,56 @@
  * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
  */
 
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
 #include <math.h>
 #include "measured_code.h"
+#include "tscbench_barrier.h"
  
 #ifdef __GNUC__
 #define NOOPTIMIZE __attribute__((optimize("O0")))
+#define NOINLINE __attribute__((noinline))
 #else
 #define NOOPTIMIZE
+#define NOINLINE
 #endif
 
-NOOPTIMIZE void empty() 
+/*
+ * Kernels keep their work by compiler barriers (tscbench_barrier.h) and
+ * are compiled with full optimization (vectorized). Former forms with
+ * volatile data and -O0 are kept as *_volatile() for comparison.
+ */
+
+NOINLINE void empty()
+{
+    /* Empty code: call is not removed */
+    tscbench_clobber_memory();
+}
+
+NOOPTIMIZE void empty_volatile() 
 {
     /* Empty code */
 }
 
 int prime_numbers()
+{
+    int nprimes = 2;
+    for (int n = 3; n < 1000; n += 2) {
+        int limit, factor = 3;
+        limit = (long)(sqrt((float)n) + 0.5f);
+        tscbench_do_not_optimize(limit);
+        while ((factor <= limit) && (n % factor))
+            factor++;
+        if (factor > limit)
+            nprimes++;
+    }
+    tscbench_do_not_optimize(nprimes);
+    return nprimes;
+}
+
+int prime_numbers_volatile()
 {
     int nprimes = 2;
     for (int n = 3; n < 1000; n += 2) {
@@ -33,32 +68,94 @@ int prime_numbers()
 }
 
 #define SAXPY_N 1000
-volatile float alpha = 3.14;
-volatile float x[SAXPY_N], y[SAXPY_N];
+float alpha = 3.14;
+static float x_bss[SAXPY_N], y_bss[SAXPY_N];
+float *x = x_bss, *y = y_bss;
 
 float saxpy()
-{   
+{
+    float *restrict xp = x, *restrict yp = y;
+    float a = alpha;
+
+    tscbench_do_not_optimize(a);
     for (int i = 0; i < SAXPY_N; i++)
-        y[i] = alpha * x[i] + y[i];
-    return y[0];
+        yp[i] = a * xp[i] + yp[i];
+    tscbench_clobber_memory();
+    return yp[0];
+}
+
+float saxpy_volatile()
+{
+    volatile float *vx = x, *vy = y;
+    volatile float *valpha = &alpha;
+
+    for (int i = 0; i < SAXPY_N; i++)
+        vy[i] = *valpha * vx[i] + vy[i];
+    return vy[0];
 }
 
 #define DGEMM_N 512
-volatile double a[DGEMM_N * DGEMM_N], b[DGEMM_N * DGEMM_N], c[DGEMM_N * DGEMM_N];
+static double a_bss[DGEMM_N * DGEMM_N], b_bss[DGEMM_N * DGEMM_N], c_bss[DGEMM_N * DGEMM_N];
+double *a = a_bss, *b = b_bss, *c = c_bss;
 
+/* dgemm: Naive C = A * B in i-j-k order (the same loops as dgemm_volatile) */
 double dgemm()
 {
+    double *restrict ap = a, *restrict bp = b, *restrict cp = c;
+
+    for (int i = 0; i < DGEMM_N; i++) {
+        for (int j = 0; j < DGEMM_N; j++) {
+            cp[i * DGEMM_N + j] = 0;
+            for (int k = 0; k < DGEMM_N; k++)
+                cp[i * DGEMM_N + j] += ap[i * DGEMM_N + k] * bp[k * DGEMM_N + j];
+        }
+    }
+    tscbench_clobber_memory();
+    return *cp;
+}
+
+double dgemm_volatile()
+{
+    volatile double *va = a, *vb = b, *vc = c;
     int i, j, k;
     
     for (i = 0; i < DGEMM_N; i++) {
         for (j = 0; j < DGEMM_N; j++) {
-            *(c + i * DGEMM_N + j) = 0;
+            *(vc + i * DGEMM_N + j) = 0;
             for (k = 0; k < DGEMM_N; k++) {
-                *(c + i * DGEMM_N + j) += *(a + i * DGEMM_N + k) * *(b + k * DGEMM_N + j);
+                *(vc + i * DGEMM_N + j) += *(va + i * DGEMM_N + k) * *(vb + k * DGEMM_N + j);
             }
         }
     }
-    return *c;
+    return *vc;
+}
+
+/* measured_code_buffers_size: Returns size of arrays of saxpy() and dgemm() in bytes. */
+size_t measured_code_buffers_size()
+{
+    return sizeof(double) * 3 * DGEMM_N * DGEMM_N + sizeof(float) * 2 * SAXPY_N;
+}
+
+/*
+ * measured_code_set_buffers: Places arrays of saxpy() and dgemm() into buf
+ *                            (measured_code_buffers_size() bytes), NULL
+ *                            restores static arrays.
+ */
+void measured_code_set_buffers(void *buf)
+{
+    if (buf == NULL) {
+        a = a_bss;
+        b = b_bss;
+        c = c_bss;
+        x = x_bss;
+        y = y_bss;
+        return;
+    }
+    a = buf;
+    b = a + DGEMM_N * DGEMM_N;
+    c = b + DGEMM_N * DGEMM_N;
+    x = (float *)(c + DGEMM_N * DGEMM_N);
+    y = x + SAXPY_N;
 }
 
 void loop_of_cpuid()
@@ -81,3 +178,240 @@ void loop_of_mfence()
         );
     }
 }
+
+/*
+ * Relocatable kernels: leaf functions which are placed into a separate
+ * section "tscbench_reloc", so the whole section can be copied to
+ * an arbitrary address of executable memory (see code_align.c).
+ * Kernels must not call functions and must not reference global data:
+ * all data are passed by the argument. Block partitioning and library
+ * call generation (memset/memcpy) are disabled for the same reason.
+ */
+#ifdef __GNUC__
+#define RELOCATABLE __attribute__((section("tscbench_reloc"), noinline, \
+                                   optimize("no-reorder-blocks-and-partition", \
+                                            "no-tree-loop-distribute-patterns")))
+#else
+#define RELOCATABLE
+#endif
+
+typedef struct {
+    float *x;
+    float *y;
+    float alpha;
+    int n;
+} reloc_saxpy_arg_t;
+
+typedef struct {
+    double *a;
+    double *b;
+    double *c;
+    int n;
+} reloc_dgemm_arg_t;
+
+typedef struct {
+    uint64_t *data;
+    int n;
+} reloc_sum_arg_t;
+
+typedef struct {
+    void **pos;                 /* Current node of the cyclic list */
+    int nhops;
+} reloc_chase_arg_t;
+
+RELOCATABLE void reloc_sum(void *arg)
+{
+    reloc_sum_arg_t *p = arg;
+    uint64_t sum = 0;
+    for (int i = 0; i < p->n; i++)
+        sum += p->data[i];
+    p->data[0] = sum;
+}
+
+RELOCATABLE void reloc_saxpy(void *arg)
+{
+    reloc_saxpy_arg_t *p = arg;
+    for (int i = 0; i < p->n; i++)
+        p->y[i] = p->alpha * p->x[i] + p->y[i];
+}
+
+RELOCATABLE void reloc_dgemm(void *arg)
+{
+    reloc_dgemm_arg_t *p = arg;
+    int n = p->n;
+
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            double s = 0.0;
+            for (int k = 0; k < n; k++)
+                s += p->a[i * n + k] * p->b[k * n + j];
+            p->c[i * n + j] = s;
+        }
+    }
+}
+
+/* reloc_chase: Follows nhops pointers of random cyclic list (memory latency) */
+RELOCATABLE void reloc_chase(void *arg)
+{
+    reloc_chase_arg_t *p = arg;
+    void **pos = p->pos;
+    for (int i = 0; i < p->nhops; i++)
+        pos = *pos;
+    p->pos = pos;
+}
+
+#define RELOC_SUM_N 1000
+#define RELOC_SAXPY_N 1000
+#define RELOC_DGEMM_N 64
+#define RELOC_CHASE_WS (64 << 20)       /* Larger than LLC */
+#define RELOC_CHASE_STRIDE 64           /* One node per cache line */
+#define RELOC_CHASE_NHOPS 4096
+
+static uint64_t reloc_sum_data[RELOC_SUM_N];
+static float reloc_x[RELOC_SAXPY_N], reloc_y[RELOC_SAXPY_N];
+static double reloc_a[RELOC_DGEMM_N * RELOC_DGEMM_N];
+static double reloc_b[RELOC_DGEMM_N * RELOC_DGEMM_N];
+static double reloc_c[RELOC_DGEMM_N * RELOC_DGEMM_N];
+
+static reloc_sum_arg_t reloc_sum_arg = {reloc_sum_data, RELOC_SUM_N};
+static reloc_saxpy_arg_t reloc_saxpy_arg = {reloc_x, reloc_y, 3.14f, RELOC_SAXPY_N};
+static reloc_dgemm_arg_t reloc_dgemm_arg = {reloc_a, reloc_b, reloc_c, RELOC_DGEMM_N};
+
+/* Initializers of working sets placed into caller's memory */
+static void *reloc_sum_init(void *ws)
+{
+    reloc_sum_arg_t *p = malloc(sizeof(*p));
+    if (p == NULL)
+        return NULL;
+    p->data = ws;
+    p->n = RELOC_SUM_N;
+    for (int i = 0; i < p->n; i++)
+        p->data[i] = i;
+    return p;
+}
+
+static void *reloc_saxpy_init(void *ws)
+{
+    reloc_saxpy_arg_t *p = malloc(sizeof(*p));
+    if (p == NULL)
+        return NULL;
+    p->x = ws;
+    p->y = p->x + RELOC_SAXPY_N;
+    p->alpha = 3.14f;
+    p->n = RELOC_SAXPY_N;
+    for (int i = 0; i < p->n; i++)
+        p->x[i] = p->y[i] = 1.0f;
+    return p;
+}
+
+static void *reloc_dgemm_init(void *ws)
+{
+    reloc_dgemm_arg_t *p = malloc(sizeof(*p));
+    if (p == NULL)
+        return NULL;
+    p->n = RELOC_DGEMM_N;
+    p->a = ws;
+    p->b = p->a + p->n * p->n;
+    p->c = p->b + p->n * p->n;
+    for (int i = 0; i < p->n * p->n; i++)
+        p->a[i] = p->b[i] = p->c[i] = 1.0;
+    return p;
+}
+
+/* reloc_chase_init: Links cache lines of ws into random cycle (Sattolo's algorithm). */
+static void *reloc_chase_init(void *ws)
+{
+    enum { NNODES = RELOC_CHASE_WS / RELOC_CHASE_STRIDE };
+    reloc_chase_arg_t *p = malloc(sizeof(*p));
+    uint32_t *perm = malloc(sizeof(*perm) * NNODES);
+    if (p == NULL || perm == NULL) {
+        free(p);
+        free(perm);
+        return NULL;
+    }
+
+    uint64_t rnd = 88172645463325252ULL;
+    for (uint32_t i = 0; i < NNODES; i++)
+        perm[i] = i;
+    for (uint32_t i = NNODES - 1; i > 0; i--) {
+        rnd ^= rnd << 13;
+        rnd ^= rnd >> 7;
+        rnd ^= rnd << 17;
+        uint32_t j = rnd % i;
+        uint32_t t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+    /* perm is a single cycle: node i points to node perm[i] */
+    char *base = ws;
+    for (uint32_t i = 0; i < NNODES; i++)
+        *(void **)(base + (size_t)i * RELOC_CHASE_STRIDE) = base + (size_t)perm[i] * RELOC_CHASE_STRIDE;
+    free(perm);
+
+    p->pos = ws;
+    p->nhops = RELOC_CHASE_NHOPS;
+    return p;
+}
+
+const reloc_code_t reloc_codes[] = {
+    {"sum", reloc_sum, &reloc_sum_arg, sizeof(uint64_t) * RELOC_SUM_N, reloc_sum_init},
+    {"saxpy", reloc_saxpy, &reloc_saxpy_arg, sizeof(float) * 2 * RELOC_SAXPY_N, reloc_saxpy_init},
+    {"dgemm", reloc_dgemm, &reloc_dgemm_arg, sizeof(double) * 3 * RELOC_DGEMM_N * RELOC_DGEMM_N,
+     reloc_dgemm_init},
+    {"chase", reloc_chase, NULL, RELOC_CHASE_WS, reloc_chase_init},
+    {NULL, NULL, NULL, 0, NULL}
+};
+
+/* Section bounds are defined by the linker */
+extern char __start_tscbench_reloc[];
+extern char __stop_tscbench_reloc[];
+
+/* reloc_code_find: Returns relocatable kernel by name or NULL. */
+const reloc_code_t *reloc_code_find(const char *name)
+{
+    for (int i = 0; reloc_codes[i].name != NULL; i++) {
+        if (strcmp(reloc_codes[i].name, name) == 0)
+            return &reloc_codes[i];
+    }
+    return NULL;
+}
+
+/*
+ * reloc_code_arg_create: Returns argument of the kernel: static one or
+ *                        working set allocated by malloc (*ws, NULL if static).
+ */
+void *reloc_code_arg_create(const reloc_code_t *code, void **ws)
+{
+    *ws = NULL;
+    if (code->arg != NULL)
+        return code->arg;
+    if ( (*ws = malloc(code->ws_size)) == NULL)
+        return NULL;
+    void *arg = code->ws_init(*ws);
+    if (arg == NULL) {
+        free(*ws);
+        *ws = NULL;
+    }
+    return arg;
+}
+
+/* reloc_code_arg_free: Frees argument created by reloc_code_arg_create. */
+void reloc_code_arg_free(const reloc_code_t *code, void *arg, void *ws)
+{
+    if (ws != NULL) {
+        free(arg);
+        free(ws);
+    }
+}
+
+/* reloc_section_start: Returns address of the first byte of relocatable section. */
+const char *reloc_section_start()
+{
+    return __start_tscbench_reloc;
+}
+
+/* reloc_section_size: Returns size of relocatable section in bytes. */
+size_t reloc_section_size()
+{
+    return __stop_tscbench_reloc - __start_tscbench_reloc;
+}
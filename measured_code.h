@@ -7,6 +7,8 @@
 #ifndef MEASURED_CODE_H
 #define MEASURED_CODE_H
 
+#include <stddef.h>
+
 #define CODE prime_numbers
 
 void empty();
@@ -14,7 +16,38 @@ int prime_numbers();
 float saxpy();
 double dgemm();
 
+/* Former forms: volatile data (memory access on every use), empty() at -O0 */
+void empty_volatile();
+int prime_numbers_volatile();
+float saxpy_volatile();
+double dgemm_volatile();
+
+/* Arrays of saxpy() and dgemm() can be placed into caller's buffer (e.g. on huge pages) */
+size_t measured_code_buffers_size();
+void measured_code_set_buffers(void *buf);
+
 void loop_of_cpuid();
 void loop_of_mfence();
 
+/*
+ * Relocatable kernels: can be copied to any address (see measured_code.c).
+ * Working set of a kernel can be placed into caller's memory: ws_init()
+ * initializes ws_size bytes at ws and returns argument of func (freed by free()).
+ */
+typedef struct {
+    const char *name;
+    void (*func)(void *arg);
+    void *arg;                      /* Argument with static working set (NULL if none) */
+    size_t ws_size;
+    void *(*ws_init)(void *ws);
+} reloc_code_t;
+
+extern const reloc_code_t reloc_codes[];   /* Terminated by {NULL, ...} */
+
+const reloc_code_t *reloc_code_find(const char *name);
+void *reloc_code_arg_create(const reloc_code_t *code, void **ws);
+void reloc_code_arg_free(const reloc_code_t *code, void *arg, void *ws);
+const char *reloc_section_start();
+size_t reloc_section_size();
+
 #endif /* MEASURED_CODE_H */
@@ -0,0 +1,230 @@
+/*
+ * membw.c: STREAM-style memory bandwidth of 1..N pinned threads.
+ *
+ * Every thread allocates and first touches its part of arrays a, b, c
+ * on the node (page_alloc.c), so pages are local to the node regardless of
+ * the memory policy. Bytes of a kernel are counted as in STREAM (loads +
+ * stores, write-allocate traffic is not counted). Best of NTIMES phases
+ * is reported.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "page_alloc.h"
+#include "membw.h"
+
+enum {
+    NTIMES = 10
+};
+
+#define SCALAR 3.0
+
+static const char *kernel_names[MEMBW_NKERNELS] = {
+    "copy", "scale", "add", "triad", "read", "write"
+};
+
+/* Bytes moved per element */
+static const int kernel_bytes[MEMBW_NKERNELS] = {16, 16, 24, 24, 8, 8};
+
+typedef struct {
+    int cpu;
+    int node;
+    size_t n;                   /* Elements of the thread */
+    page_buf_t bufs[3];
+    double *a, *b, *c;
+    volatile double sink;
+    pthread_barrier_t *barrier;
+    int *start;                 /* 1: all threads are created, -1: abort */
+    int *error;
+    uint64_t t0[NTIMES][MEMBW_NKERNELS];
+    uint64_t t1[NTIMES][MEMBW_NKERNELS];
+} membw_thread_t;
+
+static void run_kernel(membw_thread_t *t, int kernel)
+{
+    double *a = t->a, *b = t->b, *c = t->c;
+    size_t n = t->n;
+    double sum = 0.0;
+
+    switch (kernel) {
+    case MEMBW_COPY:
+        for (size_t i = 0; i < n; i++)
+            c[i] = a[i];
+        break;
+    case MEMBW_SCALE:
+        for (size_t i = 0; i < n; i++)
+            b[i] = SCALAR * c[i];
+        break;
+    case MEMBW_ADD:
+        for (size_t i = 0; i < n; i++)
+            c[i] = a[i] + b[i];
+        break;
+    case MEMBW_TRIAD:
+        for (size_t i = 0; i < n; i++)
+            a[i] = b[i] + SCALAR * c[i];
+        break;
+    case MEMBW_READ:
+        for (size_t i = 0; i < n; i++)
+            sum += a[i];
+        t->sink = sum;
+        break;
+    case MEMBW_WRITE:
+        for (size_t i = 0; i < n; i++)
+            a[i] = SCALAR;
+        break;
+    }
+}
+
+static void *membw_thread(void *arg)
+{
+    membw_thread_t *t = arg;
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(t->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    int start;
+    while ((start = __atomic_load_n(t->start, __ATOMIC_ACQUIRE)) == 0)
+        sched_yield();
+    if (start < 0)
+        return NULL;
+
+    /* Allocation and first touch by the thread on its CPU */
+    double *arrays[3];
+    for (int i = 0; i < 3; i++) {
+        if (page_buf_alloc(&t->bufs[i], t->n * sizeof(double), PAGE_KIND_4K, t->node) != 0) {
+            __atomic_store_n(t->error, 1, __ATOMIC_RELAXED);
+            arrays[i] = NULL;
+        } else {
+            arrays[i] = t->bufs[i].addr;
+        }
+    }
+    t->a = arrays[0];
+    t->b = arrays[1];
+    t->c = arrays[2];
+    if (t->a && t->b && t->c) {
+        for (size_t i = 0; i < t->n; i++) {
+            t->a[i] = 1.0;
+            t->b[i] = 2.0;
+            t->c[i] = 0.0;
+        }
+    }
+
+    pthread_barrier_wait(t->barrier);
+    if (__atomic_load_n(t->error, __ATOMIC_RELAXED))
+        return NULL;
+
+    for (int rep = 0; rep < NTIMES; rep++) {
+        for (int k = 0; k < MEMBW_NKERNELS; k++) {
+            pthread_barrier_wait(t->barrier);
+            t->t0[rep][k] = read_tsc_before();
+            run_kernel(t, k);
+            t->t1[rep][k] = read_tsc_after();
+        }
+    }
+    return NULL;
+}
+
+/*
+ * membw_measure: Runs kernels on threads pinned to cpus[0..nthreads-1]
+ * with arrays of array_size bytes (split between threads) on the node.
+ * Threads start every kernel at a barrier, time of the phase is from
+ * the earliest start to the latest end (TSC). Returns 0 on success.
+ */
+int membw_measure(int node, const int *cpus, int nthreads, size_t array_size, double tsc_hz,
+                  membw_result_t *res)
+{
+    pthread_barrier_t barrier;
+    int start = 0, error = 0;
+
+    memset(res, 0, sizeof(*res));
+    res->node = node;
+    res->nthreads = nthreads;
+    membw_thread_t *threads = calloc(nthreads, sizeof(*threads));
+    pthread_t *tids = calloc(nthreads, sizeof(*tids));
+    if (threads == NULL || tids == NULL || pthread_barrier_init(&barrier, NULL, nthreads) != 0) {
+        free(threads);
+        free(tids);
+        return -1;
+    }
+
+    size_t n = array_size / sizeof(double) / nthreads;
+    int nstarted = 0;
+    for (int i = 0; i < nthreads; i++) {
+        threads[i].cpu = cpus[i];
+        threads[i].node = node;
+        threads[i].n = n;
+        threads[i].barrier = &barrier;
+        threads[i].start = &start;
+        threads[i].error = &error;
+        if (pthread_create(&tids[i], NULL, membw_thread, &threads[i]) != 0)
+            break;
+        nstarted++;
+    }
+    /* Barrier can't be passed if some thread is not created */
+    if (nstarted < nthreads)
+        error = 1;
+    __atomic_store_n(&start, error ? -1 : 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < nstarted; i++)
+        pthread_join(tids[i], NULL);
+
+    if (!error) {
+        for (int k = 0; k < MEMBW_NKERNELS; k++) {
+            for (int rep = 1; rep < NTIMES; rep++) {    /* First phase is a warmup */
+                uint64_t t0 = threads[0].t0[rep][k], t1 = threads[0].t1[rep][k];
+                for (int i = 1; i < nthreads; i++) {
+                    if (threads[i].t0[rep][k] < t0)
+                        t0 = threads[i].t0[rep][k];
+                    if (threads[i].t1[rep][k] > t1)
+                        t1 = threads[i].t1[rep][k];
+                }
+                double sec = (double)(t1 - t0) / tsc_hz;
+                double mbs = sec > 0.0 ? (double)kernel_bytes[k] * n * nthreads / sec / 1E6 : 0.0;
+                if (mbs > res->mbs[k])
+                    res->mbs[k] = mbs;
+            }
+        }
+    }
+
+    for (int i = 0; i < nthreads; i++) {
+        for (int j = 0; j < 3; j++)
+            page_buf_free(&threads[i].bufs[j]);
+    }
+    pthread_barrier_destroy(&barrier);
+    free(threads);
+    free(tids);
+    return error ? -1 : 0;
+}
+
+/* membw_report: Prints result (header if res is NULL). */
+void membw_report(const membw_result_t *res, FILE *f)
+{
+    if (res == NULL) {
+        fprintf(f, "# [Node] [Threads]");
+        for (int k = 0; k < MEMBW_NKERNELS; k++)
+            fprintf(f, " [%s, MB/s]%*s", kernel_names[k], (int)(6 - strlen(kernel_names[k])), "");
+        fprintf(f, "\n");
+        return;
+    }
+    fprintf(f, "  %-6d %-9d", res->node, res->nthreads);
+    for (int k = 0; k < MEMBW_NKERNELS; k++)
+        fprintf(f, " %-14.1f", res->mbs[k]);
+    fprintf(f, "\n");
+}
+
+/* membw_kernel_name: Returns name of the kernel. */
+const char *membw_kernel_name(int kernel)
+{
+    return kernel >= 0 && kernel < MEMBW_NKERNELS ? kernel_names[kernel] : "none";
+}
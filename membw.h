@@ -0,0 +1,52 @@
+/*
+ * membw.h: STREAM-style memory bandwidth of 1..N pinned threads.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef MEMBW_H
+#define MEMBW_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+enum {
+    MEMBW_COPY = 0,             /* c[i] = a[i] */
+    MEMBW_SCALE = 1,            /* b[i] = s * c[i] */
+    MEMBW_ADD = 2,              /* c[i] = a[i] + b[i] */
+    MEMBW_TRIAD = 3,            /* a[i] = b[i] + s * c[i] */
+    MEMBW_READ = 4,             /* sum += a[i] */
+    MEMBW_WRITE = 5,            /* a[i] = s */
+    MEMBW_NKERNELS = 6
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int node;
+    int nthreads;
+    double mbs[MEMBW_NKERNELS];     /* Best bandwidth, MB/s (10^6 bytes) */
+} membw_result_t;
+
+/*
+ * membw_measure: Runs kernels on threads pinned to cpus[0..nthreads-1]
+ * with arrays of array_size bytes (split between threads) on the node.
+ * Threads start every kernel at a barrier, time of the phase is from
+ * the earliest start to the latest end (TSC). Returns 0 on success.
+ */
+int membw_measure(int node, const int *cpus, int nthreads, size_t array_size, double tsc_hz,
+                  membw_result_t *res);
+
+/* membw_report: Prints result (header if res is NULL). */
+void membw_report(const membw_result_t *res, FILE *f);
+
+/* membw_kernel_name: Returns name of the kernel. */
+const char *membw_kernel_name(int kernel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMBW_H */
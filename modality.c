@@ -0,0 +1,229 @@
+/*
+ * modality.c: Detection of modes of timing distributions.
+ *
+ * Density is estimated by Gaussian kernel on a grid (linear binning of
+ * values + convolution with truncated kernel, O(n + grid * kernel)).
+ * Bandwidth by Silverman's rule: h = 0.9 * min(s, IQR / 1.34) * n^(-1/5).
+ * Grid covers [P0.1, P99.9]: rare far outliers (interrupts) would squeeze
+ * the main part of distribution into a few grid points; they are counted
+ * in weights of the outermost modes.
+ *
+ * Every local maximum of density is a candidate mode bounded by minima
+ * of density. Neighbour modes are merged while the valley between them is
+ * higher than VALLEY_RATIO of the lower peak or one of them holds less
+ * than min_weight of values (or less than MODE_COUNT_MIN values).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mathstat.h"
+#include "modality.h"
+
+enum {
+    NGRID = 512,
+    NPEAKS_MAX = NGRID / 2
+};
+
+#define VALLEY_RATIO 0.8
+#define MODE_COUNT_MIN 5        /* Less values are outliers, not a mode */
+#define KERNEL_CUTOFF 4.0       /* Kernel is truncated at 4 bandwidths */
+
+typedef struct {
+    int peak;                   /* Grid index of the maximum */
+    int low;                    /* Grid index of the left bound */
+    int high;                   /* Grid index of the right bound (exclusive) */
+    int count;
+} segment_t;
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static double sorted_percentile(const double *v, int n, double p)
+{
+    double pos = p / 100.0 * (n - 1);
+    int i = (int)pos;
+    if (i >= n - 1)
+        return v[n - 1];
+    return v[i] + (pos - i) * (v[i + 1] - v[i]);
+}
+
+/* valley: Returns grid index of density minimum between peaks a and b. */
+static int valley(const double *dens, int a, int b)
+{
+    int m = a;
+    for (int i = a; i <= b; i++) {
+        if (dens[i] < dens[m])
+            m = i;
+    }
+    return m;
+}
+
+/*
+ * modality_find: Finds modes of the values by Gaussian kernel density
+ * estimate (Silverman's bandwidth). Peaks separated by shallow valleys or
+ * holding less than min_weight of values are merged with neighbours.
+ * Returns number of modes (modes are sorted by location), -1 on error.
+ */
+int modality_find(const double *values, int n, double min_weight,
+                  modality_mode_t *modes, int maxmodes, double *bandwidth)
+{
+    if (n < 2 || maxmodes < 1)
+        return -1;
+
+    double *v = malloc(sizeof(*v) * n);
+    double *dens = calloc(NGRID, sizeof(*dens));
+    double *bins = calloc(NGRID, sizeof(*bins));
+    segment_t *segs = malloc(sizeof(*segs) * NPEAKS_MAX);
+    if (v == NULL || dens == NULL || bins == NULL || segs == NULL) {
+        free(v);
+        free(dens);
+        free(bins);
+        free(segs);
+        return -1;
+    }
+    memcpy(v, values, sizeof(*v) * n);
+    qsort(v, n, sizeof(*v), cmp_double);
+
+    double lo = sorted_percentile(v, n, 0.1), hi = sorted_percentile(v, n, 99.9);
+    double iqr = sorted_percentile(v, n, 75.0) - sorted_percentile(v, n, 25.0);
+    double sd = stat_stddev(v, n);
+    double spread = (iqr > 0.0 && iqr / 1.34 < sd) ? iqr / 1.34 : sd;
+    double h = 0.9 * spread * pow(n, -0.2);
+
+    /* Ticks are integers: bandwidth is not less than the grid step and one tick */
+    if (h < 1.0)
+        h = 1.0;
+    double left = lo - 3.0 * h, right = hi + 3.0 * h;
+    double step = (right - left) / (NGRID - 1);
+    if (h < step)
+        h = step;
+    *bandwidth = h;
+
+    /* Linear binning (values out of the grid are not binned) */
+    for (int i = 0; i < n; i++) {
+        double pos = (v[i] - left) / step;
+        if (pos < 0.0 || pos > NGRID - 1)
+            continue;
+        int j = (int)pos;
+        double frac = pos - j;
+        bins[j] += 1.0 - frac;
+        if (j + 1 < NGRID)
+            bins[j + 1] += frac;
+    }
+
+    /* Convolution with Gaussian kernel */
+    int width = (int)(KERNEL_CUTOFF * h / step) + 1;
+    for (int i = 0; i < NGRID; i++) {
+        if (bins[i] == 0.0)
+            continue;
+        int first = i - width > 0 ? i - width : 0;
+        int last = i + width < NGRID - 1 ? i + width : NGRID - 1;
+        for (int j = first; j <= last; j++) {
+            double u = (j - i) * step / h;
+            dens[j] += bins[i] * exp(-0.5 * u * u);
+        }
+    }
+
+    /* Candidate modes: local maxima */
+    int nsegs = 0;
+    for (int i = 0; i < NGRID && nsegs < NPEAKS_MAX; i++) {
+        double l = i > 0 ? dens[i - 1] : -1.0;
+        double r = i < NGRID - 1 ? dens[i + 1] : -1.0;
+        if (dens[i] > l && dens[i] >= r && dens[i] > 0.0)
+            segs[nsegs++].peak = i;
+    }
+    if (nsegs == 0)
+        segs[nsegs++].peak = 0;
+
+    /* Merge neighbours until all modes are significant */
+    for (;;) {
+        for (int s = 0; s < nsegs; s++) {
+            segs[s].low = s == 0 ? 0 : valley(dens, segs[s - 1].peak, segs[s].peak);
+            segs[s].high = s == nsegs - 1 ? NGRID : valley(dens, segs[s].peak, segs[s + 1].peak);
+        }
+        int merge = -1;             /* Merge segments merge and merge + 1 */
+        double worst = 0.0;
+        for (int s = 0; s + 1 < nsegs; s++) {
+            double lower = fmin(dens[segs[s].peak], dens[segs[s + 1].peak]);
+            double ratio = dens[segs[s].high] / lower;
+            if (ratio > VALLEY_RATIO && ratio > worst) {
+                worst = ratio;
+                merge = s;
+            }
+        }
+        if (merge < 0) {
+            /* Light modes: merge with neighbour across the higher valley */
+            double minweight = 1.0;
+            for (int s = 0; s < nsegs && nsegs > 1; s++) {
+                double w = 0.0;
+                for (int j = segs[s].low; j < segs[s].high; j++)
+                    w += bins[j];
+                w /= n;
+                if ((w < min_weight || w * n < MODE_COUNT_MIN) && w < minweight) {
+                    minweight = w;
+                    if (s == 0)
+                        merge = 0;
+                    else if (s == nsegs - 1)
+                        merge = s - 1;
+                    else
+                        merge = dens[segs[s].low] > dens[segs[s].high] ? s - 1 : s;
+                }
+            }
+        }
+        if (merge < 0)
+            break;
+        if (dens[segs[merge + 1].peak] > dens[segs[merge].peak])
+            segs[merge].peak = segs[merge + 1].peak;
+        memmove(&segs[merge + 1], &segs[merge + 2], sizeof(*segs) * (nsegs - merge - 2));
+        nsegs--;
+    }
+
+    /* Statistics of values in bounds of the modes */
+    int nmodes = nsegs < maxmodes ? nsegs : maxmodes;
+    int k = 0;
+    for (int s = 0; s < nmodes; s++) {
+        modality_mode_t *m = &modes[s];
+        double low = s == 0 ? -INFINITY : left + segs[s].low * step;
+        double high = s == nsegs - 1 ? INFINITY : left + segs[s].high * step;
+        int first = k;
+        while (k < n && v[k] < high)
+            k++;
+        m->count = k - first;
+        m->location = left + segs[s].peak * step;
+        m->weight = (double)m->count / n;
+        m->mean = m->count > 0 ? stat_mean(&v[first], m->count) : 0.0;
+        m->stddev = m->count > 1 ? stat_stddev(&v[first], m->count) : 0.0;
+        m->low = m->count > 0 ? v[first] : low;
+        m->high = m->count > 0 ? v[k - 1] : high;
+    }
+
+    free(v);
+    free(dens);
+    free(bins);
+    free(segs);
+    return nmodes;
+}
+
+/* modality_report: Prints modes; warns if the distribution is multimodal. */
+void modality_report(const modality_mode_t *modes, int nmodes, double bandwidth, FILE *f)
+{
+    fprintf(f, "# Modes of distribution (KDE, bandwidth %.2f)\n", bandwidth);
+    fprintf(f, "# [Mode] [Location]         [Weight, %%] [Mean]             [StdDev]           [Low]              [High]\n");
+    for (int i = 0; i < nmodes; i++) {
+        const modality_mode_t *m = &modes[i];
+        fprintf(f, "  %-6d %-18.2f %-11.2f %-18.2f %-18.2f %-18.2f %-18.2f\n",
+                i, m->location, m->weight * 100.0, m->mean, m->stddev, m->low, m->high);
+    }
+    if (nmodes > 1) {
+        fprintf(f, "# [Warning!] Distribution has %d modes: mean and stddev mix different"
+                   " behaviours, compare modes separately\n", nmodes);
+    }
+}
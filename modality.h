@@ -0,0 +1,44 @@
+/*
+ * modality.h: Detection of modes of timing distributions.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef MODALITY_H
+#define MODALITY_H
+
+#include <stdio.h>
+
+#define MODALITY_MODES_MAX 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    double location;            /* Peak of the density */
+    double weight;              /* Fraction of all values in the mode */
+    double mean;
+    double stddev;
+    double low;                 /* Bounds of the mode (minima of density) */
+    double high;
+    int count;
+} modality_mode_t;
+
+/*
+ * modality_find: Finds modes of the values by Gaussian kernel density
+ * estimate (Silverman's bandwidth). Peaks separated by shallow valleys or
+ * holding less than min_weight of values are merged with neighbours.
+ * Returns number of modes (modes are sorted by location), -1 on error.
+ */
+int modality_find(const double *values, int n, double min_weight,
+                  modality_mode_t *modes, int maxmodes, double *bandwidth);
+
+/* modality_report: Prints modes; warns if the distribution is multimodal. */
+void modality_report(const modality_mode_t *modes, int nmodes, double bandwidth, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODALITY_H */
@@ -0,0 +1,209 @@
+/*
+ * numa_mem.c: NUMA placement of kernel working sets (mbind/set_mempolicy
+ *             syscalls, no libnuma).
+ *
+ * Working set is mapped without access, bound to the node by
+ * mbind(MPOL_BIND) and only then made writable: with mlockall(MCL_FUTURE)
+ * (preflight.c) a writable mapping is populated at once, on the node of the
+ * CPU which maps it, and placement would rely on migration of the pages.
+ * Pages are allocated on the node when they are populated (by mprotect if
+ * memory is locked, on first touch otherwise).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "numa_mem.h"
+
+/* Memory policies and flags from <linux/mempolicy.h> */
+#define MPOL_BIND 2
+#define MPOL_LOCAL 4
+#define MPOL_F_NODE (1 << 0)
+#define MPOL_F_ADDR (1 << 1)
+#define MPOL_MF_STRICT (1 << 0)
+#define MPOL_MF_MOVE (1 << 1)
+
+#define NODEMASK_WORDS (NUMA_MEM_NODES_MAX / (8 * sizeof(unsigned long)))
+
+/* numa_mem_parse_list: Parses list of nodes or CPUs ("0-1,3"). Returns number of items. */
+int numa_mem_parse_list(const char *list, int *nodes, int maxnodes)
+{
+    int n = 0;
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long i = first; i <= last && n < maxnodes; i++)
+            nodes[n++] = i;
+        if (*p == ',')
+            p++;
+        else
+            break;
+    }
+    return n;
+}
+
+/*
+ * numa_mem_nodes: Stores ids of online nodes with memory into nodes.
+ *                 Returns number of nodes (1 with node 0 if NUMA is not
+ *                 supported by the kernel).
+ */
+int numa_mem_nodes(int *nodes, int maxnodes)
+{
+    char buf[256];
+    int n = 0;
+
+    FILE *f = fopen("/sys/devices/system/node/has_memory", "r");
+    if (f == NULL)
+        f = fopen("/sys/devices/system/node/online", "r");
+    if (f != NULL) {
+        if (fgets(buf, sizeof(buf), f) != NULL)
+            n = numa_mem_parse_list(buf, nodes, maxnodes);
+        fclose(f);
+    }
+    if (n == 0 && maxnodes > 0) {
+        nodes[0] = 0;
+        n = 1;
+    }
+    return n;
+}
+
+/* numa_mem_node_of_cpu: Returns node of the CPU (0 if unknown). */
+int numa_mem_node_of_cpu(int cpu)
+{
+    char path[128];
+    int node = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "node", 4) == 0 && sscanf(de->d_name + 4, "%d", &node) == 1)
+            break;
+    }
+    closedir(dir);
+    return node;
+}
+
+/*
+ * numa_mem_node_cpus: Stores online CPUs of the node into cpus. Returns
+ *                     number of CPUs (0 for memory-only node).
+ */
+int numa_mem_node_cpus(int node, int *cpus, int maxcpus)
+{
+    char path[128], buf[1024];
+    int n = 0;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        /* No NUMA support: all CPUs of the process are on node 0 */
+        cpu_set_t set;
+        if (node != 0 || sched_getaffinity(0, sizeof(set), &set) != 0)
+            return 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE && n < maxcpus; cpu++) {
+            if (CPU_ISSET(cpu, &set))
+                cpus[n++] = cpu;
+        }
+        return n;
+    }
+    if (fgets(buf, sizeof(buf), f) != NULL)
+        n = numa_mem_parse_list(buf, cpus, maxcpus);
+    fclose(f);
+    return n;
+}
+
+/* numa_mem_node_cpu: Returns the first CPU of the node or -1 (memory-only node). */
+int numa_mem_node_cpu(int node)
+{
+    int cpu;
+    return numa_mem_node_cpus(node, &cpu, 1) > 0 ? cpu : -1;
+}
+
+/* numa_mem_node_of_addr: Returns node of the page with address addr or -1. */
+int numa_mem_node_of_addr(void *addr)
+{
+    int node = -1;
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+        return -1;
+    return node;
+}
+
+/* numa_mem_set_local: Sets memory policy of the thread to local allocation. Returns 0 on success. */
+int numa_mem_set_local()
+{
+    return syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) == 0 ? 0 : -1;
+}
+
+/*
+ * numa_mem_bind: Binds pages of [addr, addr + size) to the node (pages are
+ *                moved if already allocated). Returns 0 on success.
+ */
+int numa_mem_bind(void *addr, size_t size, int node)
+{
+    unsigned long mask[NODEMASK_WORDS];
+    const int bits = 8 * sizeof(unsigned long);
+
+    if (node < 0 || node >= NUMA_MEM_NODES_MAX)
+        return -1;
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] |= 1UL << (node % bits);
+    if (syscall(SYS_mbind, addr, size, MPOL_BIND, mask, NUMA_MEM_NODES_MAX + 1,
+                MPOL_MF_STRICT | MPOL_MF_MOVE) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * numa_mem_alloc: Allocates size bytes bound to the node (node < 0: local
+ *                 allocation). Policy is set before pages are populated
+ *                 (mapping is writable only after mbind). Returns NULL on error.
+ */
+void *numa_mem_alloc(size_t size, int node)
+{
+    void *addr = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+    if (node >= 0) {
+        if (numa_mem_bind(addr, size, node) != 0) {
+            munmap(addr, size);
+            return NULL;
+        }
+    } else {
+        syscall(SYS_mbind, addr, size, MPOL_LOCAL, NULL, 0, 0);
+    }
+    if (mprotect(addr, size, PROT_READ | PROT_WRITE) != 0) {
+        munmap(addr, size);
+        return NULL;
+    }
+    return addr;
+}
+
+/* numa_mem_free: Frees memory allocated by numa_mem_alloc. */
+void numa_mem_free(void *addr, size_t size)
+{
+    if (addr != NULL)
+        munmap(addr, size);
+}
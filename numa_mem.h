@@ -0,0 +1,67 @@
+/*
+ * numa_mem.h: NUMA placement of kernel working sets (mbind/set_mempolicy
+ *             syscalls, no libnuma).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef NUMA_MEM_H
+#define NUMA_MEM_H
+
+#include <stddef.h>
+
+#define NUMA_MEM_NODES_MAX 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* numa_mem_parse_list: Parses list of nodes or CPUs ("0-1,3"). Returns number of items. */
+int numa_mem_parse_list(const char *list, int *nodes, int maxnodes);
+
+/*
+ * numa_mem_nodes: Stores ids of online nodes with memory into nodes.
+ *                 Returns number of nodes (1 with node 0 if NUMA is not
+ *                 supported by the kernel).
+ */
+int numa_mem_nodes(int *nodes, int maxnodes);
+
+/* numa_mem_node_of_cpu: Returns node of the CPU (0 if unknown). */
+int numa_mem_node_of_cpu(int cpu);
+
+/*
+ * numa_mem_node_cpus: Stores online CPUs of the node into cpus. Returns
+ *                     number of CPUs (0 for memory-only node).
+ */
+int numa_mem_node_cpus(int node, int *cpus, int maxcpus);
+
+/* numa_mem_node_cpu: Returns the first CPU of the node or -1 (memory-only node). */
+int numa_mem_node_cpu(int node);
+
+/* numa_mem_node_of_addr: Returns node of the page with address addr or -1. */
+int numa_mem_node_of_addr(void *addr);
+
+/* numa_mem_set_local: Sets memory policy of the thread to local allocation. Returns 0 on success. */
+int numa_mem_set_local();
+
+/*
+ * numa_mem_bind: Binds pages of [addr, addr + size) to the node (pages are
+ *                moved if already allocated). Returns 0 on success.
+ */
+int numa_mem_bind(void *addr, size_t size, int node);
+
+/*
+ * numa_mem_alloc: Allocates size bytes bound to the node (node < 0: local
+ *                 allocation). Policy is set before pages are populated
+ *                 (mapping is writable only after mbind). Returns NULL on error.
+ */
+void *numa_mem_alloc(size_t size, int node);
+
+/* numa_mem_free: Frees memory allocated by numa_mem_alloc. */
+void numa_mem_free(void *addr, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NUMA_MEM_H */
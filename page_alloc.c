@@ -0,0 +1,194 @@
+/*
+ * page_alloc.c: Allocation of kernel buffers on 4K, transparent huge
+ *               or hugetlbfs (2M/1G) pages.
+ *
+ * hugetlbfs pages come from the pool reserved by vm.nr_hugepages (or
+ * /sys/kernel/mm/hugepages/hugepages-*kB/nr_hugepages), mmap fails if
+ * the pool is empty. THP are not guaranteed: madvise only marks the range,
+ * so the real coverage is taken from /proc/self/smaps.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "numa_mem.h"
+#include "page_alloc.h"
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+
+#define SIZE_2M (2UL << 20)
+#define SIZE_1G (1UL << 30)
+
+static const char *kind_names[PAGE_KIND_COUNT] = {"4k", "thp", "2m", "1g"};
+
+static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+/* thp_enabled: Returns 1 if THP can be used by madvise ("always" or "madvise" mode). */
+static int thp_enabled()
+{
+    char buf[128];
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f == NULL)
+        return 0;
+    int enabled = fgets(buf, sizeof(buf), f) != NULL && strstr(buf, "[never]") == NULL;
+    fclose(f);
+    return enabled;
+}
+
+/* map_pages: Maps buffer on pages of the kind. Returns 0 on success. */
+static int map_pages(page_buf_t *buf, size_t size, int kind)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    switch (kind) {
+    case PAGE_KIND_1G:
+        buf->mapsize = round_up(size, SIZE_1G);
+        flags |= MAP_HUGETLB | MAP_HUGE_1GB;
+        break;
+    case PAGE_KIND_2M:
+        buf->mapsize = round_up(size, SIZE_2M);
+        flags |= MAP_HUGETLB | MAP_HUGE_2MB;
+        break;
+    case PAGE_KIND_THP:
+        if (!thp_enabled())
+            return -1;
+        /* Extra huge page for alignment of the buffer */
+        buf->mapsize = round_up(size, SIZE_2M) + SIZE_2M;
+        break;
+    default:
+        buf->mapsize = round_up(size, sysconf(_SC_PAGESIZE));
+        break;
+    }
+
+    /*
+     * Mapping is made writable by page_buf_alloc after madvise (THP) and
+     * binding to the node: with mlockall(MCL_FUTURE) mmap populates
+     * writable mapping immediately
+     */
+    buf->map = mmap(NULL, buf->mapsize, PROT_NONE, flags, -1, 0);
+    if (buf->map == MAP_FAILED)
+        return -1;
+    buf->addr = buf->map;
+    if (kind == PAGE_KIND_THP) {
+        buf->addr = (void *)round_up((uintptr_t)buf->map, SIZE_2M);
+        if (madvise(buf->addr, round_up(size, SIZE_2M), MADV_HUGEPAGE) != 0) {
+            munmap(buf->map, buf->mapsize);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * page_buf_alloc: Allocates buffer on pages of given kind bound to the node
+ *                 (node < 0: no binding). Falls back 1G -> 2M -> THP -> 4K
+ *                 if pages are not available. All pages are touched. Returns 0 on success.
+ */
+int page_buf_alloc(page_buf_t *buf, size_t size, int kind, int node)
+{
+    memset(buf, 0, sizeof(*buf));
+    if (kind < 0 || kind >= PAGE_KIND_COUNT || size == 0)
+        return -1;
+    buf->size = size;
+    buf->requested = kind;
+
+    for (buf->kind = kind; buf->kind >= 0; buf->kind--) {
+        if (map_pages(buf, size, buf->kind) == 0)
+            break;
+    }
+    if (buf->kind < 0)
+        return -1;
+
+    /* Bind before pages are populated (hugetlb pages are allocated on fault too) */
+    if (node >= 0 && numa_mem_bind(buf->map, buf->mapsize, node) != 0)
+        fprintf(stderr, "# [Warning!] Can't bind buffer to NUMA node %d\n", node);
+    if (mprotect(buf->map, buf->mapsize, PROT_READ | PROT_WRITE) != 0) {
+        page_buf_free(buf);
+        return -1;
+    }
+
+    /* Touch all pages: page faults are excluded from measurements */
+    memset(buf->addr, 0, size);
+    return 0;
+}
+
+/* page_buf_free: Frees the buffer. */
+void page_buf_free(page_buf_t *buf)
+{
+    if (buf->map != NULL && buf->map != MAP_FAILED)
+        munmap(buf->map, buf->mapsize);
+    buf->map = NULL;
+    buf->addr = NULL;
+}
+
+/* smaps_anon_huge: Returns AnonHugePages (bytes) of the mapping which contains addr. */
+static size_t smaps_anon_huge(void *addr)
+{
+    char line[256];
+    size_t kb = 0;
+    int found = 0;
+
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        uintptr_t start, end;
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2) {
+            found = (uintptr_t)addr >= start && (uintptr_t)addr < end;
+        } else if (found && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb * 1024;
+}
+
+/*
+ * page_buf_huge_bytes: Returns number of bytes of the buffer backed by huge
+ *                      pages (AnonHugePages of /proc/self/smaps for THP).
+ */
+size_t page_buf_huge_bytes(page_buf_t *buf)
+{
+    switch (buf->kind) {
+    case PAGE_KIND_1G:
+    case PAGE_KIND_2M:
+        return buf->size;
+    case PAGE_KIND_THP: {
+        size_t huge = smaps_anon_huge(buf->addr);
+        return huge < buf->size ? huge : buf->size;
+    }
+    default:
+        return 0;
+    }
+}
+
+/* page_kind_name: Returns name of the kind of pages ("4k", "thp", "2m", "1g"). */
+const char *page_kind_name(int kind)
+{
+    return kind >= 0 && kind < PAGE_KIND_COUNT ? kind_names[kind] : "none";
+}
+
+/* page_kind_parse: Returns kind of pages by name or -1. */
+int page_kind_parse(const char *name)
+{
+    for (int i = 0; i < PAGE_KIND_COUNT; i++) {
+        if (strcmp(kind_names[i], name) == 0)
+            return i;
+    }
+    return -1;
+}
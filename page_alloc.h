@@ -0,0 +1,60 @@
+/*
+ * page_alloc.h: Allocation of kernel buffers on 4K, transparent huge
+ *               or hugetlbfs (2M/1G) pages.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef PAGE_ALLOC_H
+#define PAGE_ALLOC_H
+
+#include <stddef.h>
+
+enum {
+    PAGE_KIND_4K = 0,
+    PAGE_KIND_THP = 1,          /* Transparent huge pages by madvise(MADV_HUGEPAGE) */
+    PAGE_KIND_2M = 2,           /* MAP_HUGETLB | MAP_HUGE_2MB */
+    PAGE_KIND_1G = 3,           /* MAP_HUGETLB | MAP_HUGE_1GB */
+    PAGE_KIND_COUNT = 4
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    void *addr;                 /* Buffer (aligned to page size) */
+    size_t size;                /* Requested size */
+    void *map;                  /* Mapping which contains the buffer */
+    size_t mapsize;
+    int requested;              /* Requested kind of pages */
+    int kind;                   /* Kind of pages after fallback */
+} page_buf_t;
+
+/*
+ * page_buf_alloc: Allocates buffer on pages of given kind bound to the node
+ *                 (node < 0: no binding). Falls back 1G -> 2M -> THP -> 4K
+ *                 if pages are not available. All pages are touched. Returns 0 on success.
+ */
+int page_buf_alloc(page_buf_t *buf, size_t size, int kind, int node);
+
+/* page_buf_free: Frees the buffer. */
+void page_buf_free(page_buf_t *buf);
+
+/*
+ * page_buf_huge_bytes: Returns number of bytes of the buffer backed by huge
+ *                      pages (AnonHugePages of /proc/self/smaps for THP).
+ */
+size_t page_buf_huge_bytes(page_buf_t *buf);
+
+/* page_kind_name: Returns name of the kind of pages ("4k", "thp", "2m", "1g"). */
+const char *page_kind_name(int kind);
+
+/* page_kind_parse: Returns kind of pages by name or -1. */
+int page_kind_parse(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PAGE_ALLOC_H */
@@ -0,0 +1,364 @@
+/*
+ * preflight.c: Checks of benchmarking environment and isolation setup.
+ *
+ * Checks follow STEPS-ru.txt: performance governor, no online SMT siblings,
+ * CPU in isolcpus and nohz_full lists, irqbalance stopped, THP not forced,
+ * no IRQs routed to the measurement CPU.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "numa_mem.h"
+#include "preflight.h"
+
+/* read_line: Reads first line of the file without '\n'. Returns 0 on success. */
+static int read_line(const char *path, char *buf, int size)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    if (fgets(buf, size, f) == NULL) {
+        fclose(f);
+        buf[0] = '\0';
+        return 0;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/* cpulist_contains: Returns 1 if CPU list ("0-3,8,10-11") contains cpu. */
+static int cpulist_contains(const char *list, int cpu)
+{
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        if (cpu >= first && cpu <= last)
+            return 1;
+        if (*p == ',')
+            p++;
+        else
+            break;
+    }
+    return 0;
+}
+
+/* cpulist_count: Returns number of CPUs in the list. */
+static int cpulist_count(const char *list)
+{
+    int n = 0;
+    const char *p = list;
+    while (*p != '\0') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        n += last - first + 1;
+        if (*p == ',')
+            p++;
+        else
+            break;
+    }
+    return n;
+}
+
+static preflight_check_t *add_check(preflight_t *pf, const char *name, int status)
+{
+    preflight_check_t *c = &pf->checks[pf->nchecks++];
+    c->name = name;
+    c->status = status;
+    c->detail[0] = '\0';
+    return c;
+}
+
+static void check_governor(preflight_t *pf)
+{
+    char path[128], buf[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", pf->cpu);
+    if (read_line(path, buf, sizeof(buf)) != 0) {
+        snprintf(add_check(pf, "governor", PREFLIGHT_NA)->detail, 128, "cpufreq is not available");
+        return;
+    }
+    preflight_check_t *c = add_check(pf, "governor",
+                                     strcmp(buf, "performance") == 0 ? PREFLIGHT_OK : PREFLIGHT_FAIL);
+    snprintf(c->detail, sizeof(c->detail), "%s", buf);
+}
+
+static void check_smt(preflight_t *pf)
+{
+    char path[128], buf[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", pf->cpu);
+    if (read_line(path, buf, sizeof(buf)) != 0) {
+        snprintf(add_check(pf, "smt", PREFLIGHT_NA)->detail, 128, "topology is not available");
+        return;
+    }
+    int n = cpulist_count(buf);
+    preflight_check_t *c = add_check(pf, "smt", n <= 1 ? PREFLIGHT_OK : PREFLIGHT_FAIL);
+    snprintf(c->detail, sizeof(c->detail), "siblings %.100s", buf);
+}
+
+static void check_cpulist(preflight_t *pf, const char *name, const char *path)
+{
+    char buf[256];
+    if (read_line(path, buf, sizeof(buf)) != 0) {
+        snprintf(add_check(pf, name, PREFLIGHT_NA)->detail, 128, "%s is not available", path);
+        return;
+    }
+    preflight_check_t *c = add_check(pf, name, cpulist_contains(buf, pf->cpu) ? PREFLIGHT_OK
+                                                                           : PREFLIGHT_FAIL);
+    snprintf(c->detail, sizeof(c->detail), "[%.120s]", buf);
+}
+
+static void check_irqbalance(preflight_t *pf)
+{
+    DIR *dir = opendir("/proc");
+    if (dir == NULL) {
+        add_check(pf, "irqbalance", PREFLIGHT_NA);
+        return;
+    }
+
+    int found = 0;
+    struct dirent *de;
+    while (!found && (de = readdir(dir)) != NULL) {
+        char path[300], comm[64];
+        if (!isdigit((unsigned char)de->d_name[0]))
+            continue;
+        snprintf(path, sizeof(path), "/proc/%s/comm", de->d_name);
+        if (read_line(path, comm, sizeof(comm)) == 0 && strcmp(comm, "irqbalance") == 0)
+            found = 1;
+    }
+    closedir(dir);
+    preflight_check_t *c = add_check(pf, "irqbalance", found ? PREFLIGHT_FAIL : PREFLIGHT_OK);
+    snprintf(c->detail, sizeof(c->detail), found ? "running" : "not running");
+}
+
+static void check_thp(preflight_t *pf)
+{
+    char buf[128];
+    if (read_line("/sys/kernel/mm/transparent_hugepage/enabled", buf, sizeof(buf)) != 0) {
+        snprintf(add_check(pf, "thp", PREFLIGHT_NA)->detail, 128, "THP is not available");
+        return;
+    }
+    /* khugepaged collapses pages at random moments when THP is forced */
+    preflight_check_t *c = add_check(pf, "thp", strstr(buf, "[always]") ? PREFLIGHT_FAIL
+                                                                      : PREFLIGHT_OK);
+    snprintf(c->detail, sizeof(c->detail), "%s", buf);
+}
+
+static void check_irq_affinity(preflight_t *pf)
+{
+    DIR *dir = opendir("/proc/irq");
+    if (dir == NULL) {
+        snprintf(add_check(pf, "irq_affinity", PREFLIGHT_NA)->detail, 128, "/proc/irq is not available");
+        return;
+    }
+
+    int nirqs = 0, ntarget = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        char path[300], buf[256];
+        if (!isdigit((unsigned char)de->d_name[0]))
+            continue;
+        snprintf(path, sizeof(path), "/proc/irq/%s/smp_affinity_list", de->d_name);
+        if (read_line(path, buf, sizeof(buf)) != 0)
+            continue;
+        nirqs++;
+        if (cpulist_contains(buf, pf->cpu))
+            ntarget++;
+    }
+    closedir(dir);
+    if (nirqs == 0) {
+        snprintf(add_check(pf, "irq_affinity", PREFLIGHT_NA)->detail, 128, "no access to IRQ affinity");
+        return;
+    }
+    preflight_check_t *c = add_check(pf, "irq_affinity", ntarget == 0 ? PREFLIGHT_OK : PREFLIGHT_FAIL);
+    snprintf(c->detail, sizeof(c->detail), "%d of %d IRQs can be delivered to CPU %d",
+             ntarget, nirqs, pf->cpu);
+}
+
+/* is_cpu_online: Returns 1 if the CPU is online. */
+static int is_cpu_online(int cpu)
+{
+    char buf[256];
+    if (read_line("/sys/devices/system/cpu/online", buf, sizeof(buf)) == 0)
+        return cpulist_contains(buf, cpu);
+    return cpu < sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+/*
+ * preflight_check: Checks environment of the CPU: frequency governor,
+ * SMT siblings, isolcpus/nohz_full, irqbalance, THP, IRQ affinity.
+ * cpu < 0 selects current CPU. Returns 0 on success, -1 if the given
+ * CPU is not online.
+ */
+int preflight_check(preflight_t *pf, int cpu)
+{
+    memset(pf, 0, sizeof(*pf));
+    pf->cpu = cpu >= 0 ? cpu : sched_getcpu();
+    pf->requested = cpu >= 0;
+    pf->dma_latency_fd = -1;
+    if (pf->requested && (cpu >= CPU_SETSIZE || !is_cpu_online(cpu))) {
+        fprintf(stderr, "# Error: CPU %d is not online\n", cpu);
+        return -1;
+    }
+
+    check_governor(pf);
+    check_smt(pf);
+    check_cpulist(pf, "isolcpus", "/sys/devices/system/cpu/isolated");
+    check_cpulist(pf, "nohz_full", "/sys/devices/system/cpu/nohz_full");
+    check_irqbalance(pf);
+    check_thp(pf);
+    check_irq_affinity(pf);
+
+    int napplicable = 0, npassed = 0;
+    for (int i = 0; i < pf->nchecks; i++) {
+        if (pf->checks[i].status != PREFLIGHT_NA) {
+            napplicable++;
+            if (pf->checks[i].status == PREFLIGHT_OK)
+                npassed++;
+        }
+    }
+    pf->score = napplicable > 0 ? npassed * 100 / napplicable : 0;
+    return 0;
+}
+
+/*
+ * preflight_apply: Applies isolation in process: affinity to the CPU,
+ * local memory policy, /dev/cpu_dma_latency hold, SCHED_FIFO with max
+ * priority and locked pages. Returns mask of applied settings or -1 if
+ * the process can't be bound to the given CPU.
+ */
+int preflight_apply(preflight_t *pf)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(pf->cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == 0) {
+        pf->applied |= PREFLIGHT_APPLIED_AFFINITY;
+    } else if (pf->requested) {
+        /* Measurements on another CPU than requested are meaningless */
+        fprintf(stderr, "# Error: can't bind process to CPU %d\n", pf->cpu);
+        return -1;
+    } else {
+        fprintf(stderr, "# [Warning!] Error binding process to CPU %d\n", pf->cpu);
+    }
+
+    /* Allocate memory on the node of the CPU */
+    if (numa_mem_set_local() == 0)
+        pf->applied |= PREFLIGHT_APPLIED_MEMPOLICY;
+
+    /* Prevent the processor from entering deep sleep states while fd is open */
+    if (pf->dma_latency_fd < 0) {
+        int32_t target = 0;
+        pf->dma_latency_fd = open("/dev/cpu_dma_latency", O_RDWR);
+        if (pf->dma_latency_fd >= 0) {
+            if (write(pf->dma_latency_fd, &target, sizeof(target)) == sizeof(target)) {
+                pf->applied |= PREFLIGHT_APPLIED_DMA_LATENCY;
+            } else {
+                close(pf->dma_latency_fd);
+                pf->dma_latency_fd = -1;
+            }
+        }
+    }
+
+    if (geteuid() == 0) {
+        /* Only ROOT can change scheduling policy to RT class */
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        if (sched_setscheduler(0, SCHED_FIFO, &sp) == 0)
+            pf->applied |= PREFLIGHT_APPLIED_RT;
+        else
+            fprintf(stderr, "# [Warning!] Error changing scheduling policy to RT class\n");
+
+        /* Disable paging to swap area */
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+            pf->applied |= PREFLIGHT_APPLIED_MLOCK;
+        else
+            fprintf(stderr, "# [Warning!] Error locking pages\n");
+    } else {
+        fprintf(stderr, "# [Warning!] Benchmark is launched without ROOT permissions:\n"
+                        "#            default scheduler, default priority, pages are not locked\n");
+    }
+    return pf->applied;
+}
+
+/* preflight_release: Releases /dev/cpu_dma_latency hold. */
+void preflight_release(preflight_t *pf)
+{
+    if (pf->dma_latency_fd >= 0)
+        close(pf->dma_latency_fd);
+    pf->dma_latency_fd = -1;
+    pf->applied &= ~PREFLIGHT_APPLIED_DMA_LATENCY;
+}
+
+/* preflight_applied_str: Returns applied settings as a compact string ("aff,mpol,..."). */
+const char *preflight_applied_str(int applied, char *buf, int size)
+{
+    static const struct {
+        int flag;
+        const char *name;
+    } names[] = {
+        {PREFLIGHT_APPLIED_AFFINITY, "aff"},
+        {PREFLIGHT_APPLIED_MEMPOLICY, "mpol"},
+        {PREFLIGHT_APPLIED_DMA_LATENCY, "dma"},
+        {PREFLIGHT_APPLIED_RT, "rt"},
+        {PREFLIGHT_APPLIED_MLOCK, "mlock"}
+    };
+
+    buf[0] = '\0';
+    for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+        if (applied & names[i].flag) {
+            int len = strlen(buf);
+            snprintf(buf + len, size - len, "%s%s", len > 0 ? "," : "", names[i].name);
+        }
+    }
+    if (buf[0] == '\0')
+        snprintf(buf, size, "none");
+    return buf;
+}
+
+/* preflight_report: Prints results of the checks and applied settings. */
+void preflight_report(preflight_t *pf, FILE *f)
+{
+    static const char *status[] = {"n/a", "FAIL", "ok"};
+    char buf[64];
+
+    fprintf(f, "# Environment preflight (CPU %d): score %d%%\n", pf->cpu, pf->score);
+    for (int i = 0; i < pf->nchecks; i++) {
+        fprintf(f, "#   %-14s %-5s %s\n", pf->checks[i].name,
+                status[pf->checks[i].status + 1], pf->checks[i].detail);
+    }
+    fprintf(f, "# Applied: %s\n", preflight_applied_str(pf->applied, buf, sizeof(buf)));
+}
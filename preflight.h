@@ -0,0 +1,78 @@
+/*
+ * preflight.h: Checks of benchmarking environment and isolation setup.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <stdio.h>
+
+enum {
+    PREFLIGHT_NA = -1,          /* Check is not applicable (no information) */
+    PREFLIGHT_FAIL = 0,
+    PREFLIGHT_OK = 1
+};
+
+/* Isolation settings applied in process */
+enum {
+    PREFLIGHT_APPLIED_AFFINITY = 1 << 0,
+    PREFLIGHT_APPLIED_MEMPOLICY = 1 << 1,
+    PREFLIGHT_APPLIED_DMA_LATENCY = 1 << 2,
+    PREFLIGHT_APPLIED_RT = 1 << 3,
+    PREFLIGHT_APPLIED_MLOCK = 1 << 4
+};
+
+#define PREFLIGHT_CHECKS_MAX 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *name;
+    int status;
+    char detail[128];
+} preflight_check_t;
+
+typedef struct {
+    int cpu;                    /* Measurement CPU */
+    int requested;              /* CPU is given explicitly */
+    preflight_check_t checks[PREFLIGHT_CHECKS_MAX];
+    int nchecks;
+    int score;                  /* Percent of passed applicable checks */
+    int applied;                /* PREFLIGHT_APPLIED_* */
+    int dma_latency_fd;
+} preflight_t;
+
+/*
+ * preflight_check: Checks environment of the CPU: frequency governor,
+ * SMT siblings, isolcpus/nohz_full, irqbalance, THP, IRQ affinity.
+ * cpu < 0 selects current CPU. Returns 0 on success, -1 if the given
+ * CPU is not online.
+ */
+int preflight_check(preflight_t *pf, int cpu);
+
+/*
+ * preflight_apply: Applies isolation in process: affinity to the CPU,
+ * local memory policy, /dev/cpu_dma_latency hold, SCHED_FIFO with max
+ * priority and locked pages. Returns mask of applied settings or -1 if
+ * the process can't be bound to the given CPU.
+ */
+int preflight_apply(preflight_t *pf);
+
+/* preflight_release: Releases /dev/cpu_dma_latency hold. */
+void preflight_release(preflight_t *pf);
+
+/* preflight_report: Prints results of the checks and applied settings. */
+void preflight_report(preflight_t *pf, FILE *f);
+
+/* preflight_applied_str: Returns applied settings as a compact string ("aff,mpol,..."). */
+const char *preflight_applied_str(int applied, char *buf, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PREFLIGHT_H */
@@ -0,0 +1,336 @@
+/*
+ * rapl.c: Energy accounting of batches by RAPL counters (powercap or MSR).
+ *
+ * RAPL counters are read at the bounds of a batch of runs: energy of a run
+ * is energy of the batch divided by the number of runs (TSC reads and
+ * rejected runs included). Counters are updated about every millisecond,
+ * so batches shorter than RAPL_BATCH_MIN_MSEC are not used for the totals.
+ * Package counter accounts all cores of the package, i.e. other activity
+ * on the package is attributed to the measured code. Only the package of
+ * the measurement CPU (and its DRAM) is read.
+ *
+ * Counters wrap: powercap energy_uj at max_energy_range_uj, 32-bit MSRs at
+ * 2^32 energy units (minutes at high power); one wraparound per batch is
+ * handled.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "rapl.h"
+
+#define MSR_RAPL_POWER_UNIT 0x606
+#define MSR_PKG_ENERGY_STATUS 0x611
+#define MSR_DRAM_ENERGY_STATUS 0x619
+
+/* read_file_u64: Reads integer from file. Returns 0 on success. */
+static int read_file_u64(const char *path, uint64_t *val)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    int rc = fscanf(f, "%" SCNu64, val) == 1 ? 0 : -1;
+    fclose(f);
+    return rc;
+}
+
+static int read_msr(int fd, uint32_t reg, uint64_t *val)
+{
+    return pread(fd, val, sizeof(*val), reg) == sizeof(*val) ? 0 : -1;
+}
+
+/* read_counter: Reads raw counter of the domain. Returns 0 on success. */
+static int read_counter(rapl_t *rapl, rapl_domain_t *d, uint64_t *val)
+{
+    if (rapl->source == RAPL_SOURCE_MSR) {
+        if (read_msr(rapl->msr_fd, d->msr, val) != 0)
+            return -1;
+        *val &= 0xFFFFFFFF;
+        return 0;
+    }
+    return read_file_u64(d->path, val);
+}
+
+static int domain_cmp(const void *a, const void *b)
+{
+    return strcmp(((const rapl_domain_t *)a)->name, ((const rapl_domain_t *)b)->name);
+}
+
+/* read_zone_name: Reads name of powercap zone (intel-rapl:N[:M]). Returns 0 on success. */
+static int read_zone_name(const char *dir, const char *zone, char *name)
+{
+    char path[576];
+    snprintf(path, sizeof(path), "%s/%s/name", dir, zone);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    int rc = fscanf(f, "%31s", name) == 1 ? 0 : -1;
+    fclose(f);
+    return rc;
+}
+
+/*
+ * package_zone: Returns N of powercap zone intel-rapl:N of the package of
+ *               the CPU (topology/physical_package_id, package 0 if unknown).
+ */
+static int package_zone(rapl_t *rapl, DIR *d)
+{
+    char path[384], name[32], want[32];
+    struct dirent *ent;
+    uint64_t package;
+
+    snprintf(path, sizeof(path), "%s/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+             rapl->sysfs_root, rapl->cpu);
+    if (read_file_u64(path, &package) != 0)
+        package = 0;
+    snprintf(want, sizeof(want), "package-%" PRIu64, package);
+
+    /* Zone is matched by name: numbers of zones and packages may differ */
+    snprintf(path, sizeof(path), "%s/sys/class/powercap", rapl->sysfs_root);
+    int zone = (int)package;
+    while ( (ent = readdir(d)) != NULL) {
+        if (strncmp(ent->d_name, "intel-rapl:", 11) != 0 || strchr(ent->d_name + 11, ':') != NULL)
+            continue;
+        if (read_zone_name(path, ent->d_name, name) == 0 && strcmp(name, want) == 0) {
+            zone = atoi(ent->d_name + 11);
+            break;
+        }
+    }
+    rewinddir(d);
+    return zone;
+}
+
+/*
+ * open_sysfs: Adds package zone of the CPU and its DRAM subzone of powercap.
+ *             Returns number of domains.
+ */
+static int open_sysfs(rapl_t *rapl)
+{
+    char dir[288], path[576], name[32];
+    struct dirent *ent;
+
+    snprintf(dir, sizeof(dir), "%s/sys/class/powercap", rapl->sysfs_root);
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return 0;
+    int zone = package_zone(rapl, d);
+    while ( (ent = readdir(d)) != NULL && rapl->ndomains < RAPL_DOMAINS_MAX) {
+        /* Zones are intel-rapl:N (package), subzones intel-rapl:N:M (core, uncore, dram) */
+        if (strncmp(ent->d_name, "intel-rapl:", 11) != 0 || atoi(ent->d_name + 11) != zone)
+            continue;
+        if (read_zone_name(dir, ent->d_name, name) != 0)
+            continue;
+
+        rapl_domain_t *dom = &rapl->domains[rapl->ndomains];
+        memset(dom, 0, sizeof(*dom));
+        if (strncmp(name, "package", 7) == 0)
+            dom->kind = RAPL_PACKAGE;
+        else if (strcmp(name, "dram") == 0)
+            dom->kind = RAPL_DRAM;
+        else
+            continue;
+
+        uint64_t range, val;
+        snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", dir, ent->d_name);
+        if (read_file_u64(path, &range) != 0)
+            continue;
+        snprintf(dom->path, sizeof(dom->path), "%s/%s/energy_uj", dir, ent->d_name);
+        if (read_file_u64(dom->path, &val) != 0)
+            continue;       /* energy_uj is readable only by root on recent kernels */
+
+        snprintf(dom->name, sizeof(dom->name), "%s", name);
+        dom->range = range + 1;
+        dom->unit = 1E-6;
+        rapl->ndomains++;
+    }
+    closedir(d);
+    qsort(rapl->domains, rapl->ndomains, sizeof(rapl->domains[0]), domain_cmp);
+    return rapl->ndomains;
+}
+
+/* open_msr: Adds package and DRAM counters of the CPU's package. Returns number of domains. */
+static int open_msr(rapl_t *rapl)
+{
+    char path[64];
+    uint64_t units, val;
+    static const struct {
+        const char *name;
+        int kind;
+        uint32_t msr;
+    } counters[] = {
+        {"package", RAPL_PACKAGE, MSR_PKG_ENERGY_STATUS},
+        {"dram", RAPL_DRAM, MSR_DRAM_ENERGY_STATUS}
+    };
+
+    snprintf(path, sizeof(path), "/dev/cpu/%d/msr", rapl->cpu);
+    if ( (rapl->msr_fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    if (read_msr(rapl->msr_fd, MSR_RAPL_POWER_UNIT, &units) != 0) {
+        close(rapl->msr_fd);
+        rapl->msr_fd = -1;
+        return 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (read_msr(rapl->msr_fd, counters[i].msr, &val) != 0)
+            continue;
+        rapl_domain_t *dom = &rapl->domains[rapl->ndomains++];
+        memset(dom, 0, sizeof(*dom));
+        snprintf(dom->name, sizeof(dom->name), "%s", counters[i].name);
+        dom->kind = counters[i].kind;
+        dom->msr = counters[i].msr;
+        dom->range = (uint64_t)1 << 32;
+        /* Energy status unit (bits 12:8): 1 / 2^ESU J */
+        dom->unit = 1.0 / (double)((uint64_t)1 << ((units >> 8) & 0x1F));
+    }
+    return rapl->ndomains;
+}
+
+/*
+ * rapl_open: Finds package and DRAM energy counters: powercap zones under
+ *            sysfs_root (NULL or "" for real sysfs), MSR of the CPU if
+ *            powercap is not available. Returns 0 on success.
+ */
+int rapl_open(rapl_t *rapl, int cpu, const char *sysfs_root)
+{
+    memset(rapl, 0, sizeof(*rapl));
+    rapl->cpu = cpu;
+    rapl->msr_fd = -1;
+    rapl->source = RAPL_SOURCE_NONE;
+    snprintf(rapl->sysfs_root, sizeof(rapl->sysfs_root), "%s", sysfs_root ? sysfs_root : "");
+
+    if (open_sysfs(rapl) > 0) {
+        rapl->source = RAPL_SOURCE_SYSFS;
+    } else if (rapl->sysfs_root[0] == '\0' && open_msr(rapl) > 0) {
+        rapl->source = RAPL_SOURCE_MSR;
+    } else {
+        rapl_close(rapl);
+        return -1;
+    }
+    rapl->tsc_hz = tsc_frequency();
+    return 0;
+}
+
+/* rapl_close: Releases resources of the reader. */
+void rapl_close(rapl_t *rapl)
+{
+    if (rapl->msr_fd >= 0)
+        close(rapl->msr_fd);
+    rapl->msr_fd = -1;
+}
+
+/*
+ * rapl_counter_delta: Returns increment of counter from begin to end which
+ *                     wraps at range (one wraparound at most).
+ */
+uint64_t rapl_counter_delta(uint64_t begin, uint64_t end, uint64_t range)
+{
+    return end >= begin ? end - begin : range - begin + end;
+}
+
+/* rapl_batch_begin: Starts batch of measurements. */
+void rapl_batch_begin(rapl_t *rapl)
+{
+    for (int i = 0; i < rapl->ndomains; i++)
+        read_counter(rapl, &rapl->domains[i], &rapl->domains[i].begin);
+    rapl->tsc_begin = rdtsc();
+}
+
+/* rapl_batch_end: Finishes batch: computes energy of every domain. */
+void rapl_batch_end(rapl_t *rapl, int nruns)
+{
+    uint64_t tsc = rdtsc();
+    uint64_t val;
+
+    if (rapl->nbatches >= RAPL_BATCHES_MAX)
+        return;
+    rapl_batch_t *batch = &rapl->batches[rapl->nbatches++];
+    batch->nruns = nruns;
+    batch->seconds = rapl->tsc_hz > 0.0 ? (tsc - rapl->tsc_begin) / rapl->tsc_hz : 0.0;
+    for (int i = 0; i < rapl->ndomains; i++) {
+        rapl_domain_t *d = &rapl->domains[i];
+        batch->joules[i] = 0.0;
+        if (read_counter(rapl, d, &val) == 0)
+            batch->joules[i] = rapl_counter_delta(d->begin, val, d->range) * d->unit;
+    }
+}
+
+/*
+ * rapl_energy: Returns energy (J), time (s) and runs of the batches of at
+ *              least RAPL_BATCH_MIN_MSEC (all batches if there are no such)
+ *              for the domain.
+ */
+double rapl_energy(rapl_t *rapl, int domain, double *seconds, uint64_t *nruns)
+{
+    double joules = 0.0;
+
+    *seconds = 0.0;
+    *nruns = 0;
+    for (int pass = 0; pass < 2 && *nruns == 0; pass++) {
+        for (int i = 0; i < rapl->nbatches; i++) {
+            rapl_batch_t *b = &rapl->batches[i];
+            if (pass == 0 && b->seconds < RAPL_BATCH_MIN_MSEC / 1E3)
+                continue;
+            joules += b->joules[domain];
+            *seconds += b->seconds;
+            *nruns += b->nruns;
+        }
+    }
+    return joules;
+}
+
+/* rapl_report: Prints energy of batches, energy per run and average power. */
+void rapl_report(rapl_t *rapl, FILE *f)
+{
+    char col[48];
+
+    fprintf(f, "# Energy (RAPL %s, CPU %d)\n", rapl_source_name(rapl->source), rapl->cpu);
+    fprintf(f, "# [Batch] [Runs]   [Time, ms]  ");
+    for (int i = 0; i < rapl->ndomains; i++) {
+        snprintf(col, sizeof(col), "[%s, J]", rapl->domains[i].name);
+        fprintf(f, " %-16s", col);
+    }
+    fprintf(f, "\n");
+    for (int i = 0; i < rapl->nbatches; i++) {
+        rapl_batch_t *b = &rapl->batches[i];
+        fprintf(f, "#  %-7d %-8d %-12.3f", i, b->nruns, b->seconds * 1E3);
+        for (int j = 0; j < rapl->ndomains; j++)
+            fprintf(f, " %-16.6f", b->joules[j]);
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "# [Domain]       [Energy, J]    [Per run, uJ]  [Power, W]\n");
+    int short_batches = 0;
+    for (int i = 0; i < rapl->ndomains; i++) {
+        double seconds;
+        uint64_t nruns;
+        double joules = rapl_energy(rapl, i, &seconds, &nruns);
+        fprintf(f, "  %-14s %-14.6f %-14.3f %.2f\n", rapl->domains[i].name, joules,
+                nruns > 0 ? joules / nruns * 1E6 : 0.0, seconds > 0.0 ? joules / seconds : 0.0);
+        if (seconds < RAPL_BATCH_MIN_MSEC / 1E3)
+            short_batches = 1;
+    }
+    if (short_batches)
+        fprintf(f, "# [Warning!] Batches are shorter than %d ms: energy is below resolution"
+                   " of RAPL counters\n", RAPL_BATCH_MIN_MSEC);
+}
+
+/* rapl_source_name: Returns name of energy counters source. */
+const char *rapl_source_name(int source)
+{
+    switch (source) {
+    case RAPL_SOURCE_SYSFS: return "powercap";
+    case RAPL_SOURCE_MSR: return "MSR";
+    default: return "none";
+    }
+}
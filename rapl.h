@@ -0,0 +1,100 @@
+/*
+ * rapl.h: Energy accounting of batches by RAPL counters (powercap or MSR).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef RAPL_H
+#define RAPL_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define RAPL_DOMAINS_MAX 8
+#define RAPL_BATCHES_MAX 64
+#define RAPL_BATCH_MIN_MSEC 10      /* Shorter batches are below resolution of counters */
+
+enum {
+    RAPL_SOURCE_NONE = 0,
+    RAPL_SOURCE_SYSFS = 1,          /* /sys/class/powercap/intel-rapl:* */
+    RAPL_SOURCE_MSR = 2             /* MSR_PKG_ENERGY_STATUS, MSR_DRAM_ENERGY_STATUS */
+};
+
+enum {
+    RAPL_PACKAGE = 0,
+    RAPL_DRAM = 1
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    char name[32];                  /* "package-0", "dram" */
+    int kind;                       /* RAPL_PACKAGE or RAPL_DRAM */
+    char path[576];                 /* energy_uj of powercap zone */
+    uint32_t msr;
+    uint64_t range;                 /* Counter wraps at range (counts) */
+    double unit;                    /* Joules per count */
+    uint64_t begin;
+} rapl_domain_t;
+
+typedef struct {
+    int nruns;
+    double seconds;
+    double joules[RAPL_DOMAINS_MAX];
+} rapl_batch_t;
+
+typedef struct {
+    int cpu;
+    int source;
+    int msr_fd;
+    char sysfs_root[256];
+    rapl_domain_t domains[RAPL_DOMAINS_MAX];
+    int ndomains;
+    double tsc_hz;
+    uint64_t tsc_begin;
+    rapl_batch_t batches[RAPL_BATCHES_MAX];
+    int nbatches;
+} rapl_t;
+
+/*
+ * rapl_open: Finds package and DRAM energy counters: powercap zones under
+ *            sysfs_root (NULL or "" for real sysfs), MSR of the CPU if
+ *            powercap is not available. Returns 0 on success.
+ */
+int rapl_open(rapl_t *rapl, int cpu, const char *sysfs_root);
+
+/* rapl_close: Releases resources of the reader. */
+void rapl_close(rapl_t *rapl);
+
+/*
+ * rapl_counter_delta: Returns increment of counter from begin to end which
+ *                     wraps at range (one wraparound at most).
+ */
+uint64_t rapl_counter_delta(uint64_t begin, uint64_t end, uint64_t range);
+
+/* rapl_batch_begin: Starts batch of measurements. */
+void rapl_batch_begin(rapl_t *rapl);
+
+/* rapl_batch_end: Finishes batch: computes energy of every domain. */
+void rapl_batch_end(rapl_t *rapl, int nruns);
+
+/*
+ * rapl_energy: Returns energy (J), time (s) and runs of the batches of at
+ *              least RAPL_BATCH_MIN_MSEC (all batches if there are no such)
+ *              for the domain.
+ */
+double rapl_energy(rapl_t *rapl, int domain, double *seconds, uint64_t *nruns);
+
+/* rapl_report: Prints energy of batches, energy per run and average power. */
+void rapl_report(rapl_t *rapl, FILE *f);
+
+/* rapl_source_name: Returns name of energy counters source. */
+const char *rapl_source_name(int source);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RAPL_H */
@@ -0,0 +1,276 @@
+/*
+ * results_store.c: Append-only store of benchmark results and regression
+ *                  detection against a baseline.
+ *
+ * Regression test: difference of means d = m1 - m0 is significant if
+ * |d| > z * sqrt(s0^2 / n0 + s1^2 / n1) (Welch's statistic, normal
+ * approximation for large samples), i.e. uncertainty of both runs is taken
+ * into account. Small differences (less than min_change percents) are not
+ * reported even if significant: run-to-run variation of the system is
+ * usually larger than within-run standard error.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <link.h>
+#include <elf.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <inttypes.h>
+
+#include "results_store.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/*
+ * results_host_fingerprint: Returns hash of CPU model, number of CPUs,
+ *                           kernel release and host name.
+ */
+uint64_t results_host_fingerprint()
+{
+    uint64_t hash = FNV_OFFSET;
+    char line[256];
+
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (f != NULL) {
+        while (fgets(line, sizeof(line), f) != NULL) {
+            if (strncmp(line, "model name", 10) == 0) {
+                hash = fnv1a(hash, line, strlen(line));
+                break;
+            }
+        }
+        fclose(f);
+    }
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    hash = fnv1a(hash, &ncpus, sizeof(ncpus));
+
+    struct utsname uts;
+    if (uname(&uts) == 0) {
+        hash = fnv1a(hash, uts.release, strlen(uts.release));
+        hash = fnv1a(hash, uts.nodename, strlen(uts.nodename));
+    }
+    return hash;
+}
+
+/* find_build_id: Callback of dl_iterate_phdr: NT_GNU_BUILD_ID note of the executable. */
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+    uint64_t *id = data;
+
+    /* The first object is the executable */
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_NOTE)
+            continue;
+        const char *p = (const char *)(info->dlpi_addr + ph->p_vaddr);
+        const char *end = p + ph->p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *nh = (const ElfW(Nhdr) *)p;
+            const char *name = p + sizeof(*nh);
+            const char *desc = name + ((nh->n_namesz + 3) & ~3);
+            if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                *id = fnv1a(FNV_OFFSET, desc, nh->n_descsz);
+                return 1;
+            }
+            p = desc + ((nh->n_descsz + 3) & ~3);
+        }
+    }
+    return 1;
+}
+
+/* results_build_id: Returns GNU build ID of the executable (hash of the file if absent). */
+uint64_t results_build_id()
+{
+    uint64_t id = 0;
+    dl_iterate_phdr(find_build_id, &id);
+    if (id != 0)
+        return id;
+
+    /* Linked without --build-id */
+    char buf[4096];
+    size_t n;
+    FILE *f = fopen("/proc/self/exe", "rb");
+    if (f == NULL)
+        return 0;
+    id = FNV_OFFSET;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        id = fnv1a(id, buf, n);
+    fclose(f);
+    return id;
+}
+
+/*
+ * results_record_init: Fills key of the record (host, build, time, kernel,
+ *                      method); statistics are filled by caller.
+ */
+void results_record_init(results_record_t *rec, const char *kernel, const char *method)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->host = results_host_fingerprint();
+    rec->build = results_build_id();
+    rec->time = (uint64_t)time(NULL);
+    snprintf(rec->kernel, sizeof(rec->kernel), "%s", kernel);
+    snprintf(rec->method, sizeof(rec->method), "%s", method);
+}
+
+/* results_store_append: Appends record to the store (created if needed). Returns 0 on success. */
+int results_store_append(const char *path, const results_record_t *rec)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        results_store_header_t hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, RESULTS_STORE_MAGIC, sizeof(hdr.magic));
+        hdr.version = RESULTS_STORE_VERSION;
+        hdr.record_size = sizeof(*rec);
+        if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+            close(fd);
+            return -1;
+        }
+    }
+    int rc = write(fd, rec, sizeof(*rec)) == sizeof(*rec) ? 0 : -1;
+    close(fd);
+    return rc;
+}
+
+/*
+ * results_store_load: Loads all records of the store (*recs is allocated
+ *                     by malloc). Returns number of records or -1 on error.
+ */
+int results_store_load(const char *path, results_record_t **recs)
+{
+    results_store_header_t hdr;
+    struct stat st;
+
+    *recs = NULL;
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, RESULTS_STORE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != RESULTS_STORE_VERSION || hdr.record_size != sizeof(results_record_t) ||
+        fstat(fileno(f), &st) != 0)
+    {
+        fclose(f);
+        return -1;
+    }
+
+    /* Partially written last record is ignored */
+    int n = (st.st_size - sizeof(hdr)) / sizeof(results_record_t);
+    if ( (*recs = malloc(sizeof(results_record_t) * (n > 0 ? n : 1))) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    n = fread(*recs, sizeof(results_record_t), n, f);
+    fclose(f);
+    return n;
+}
+
+static int same_key(const results_record_t *a, const results_record_t *b)
+{
+    return a->host == b->host && strcmp(a->kernel, b->kernel) == 0 &&
+           strcmp(a->method, b->method) == 0;
+}
+
+/*
+ * results_compare: Compares the latest record of every key (host, kernel,
+ * method) with its baseline: the latest earlier record of another build
+ * (build != 0: of that build). Change is significant if it exceeds both
+ * z * sqrt(se1^2 + se2^2) (standard errors of both runs) and min_change
+ * percents. Returns number of comparisons stored into cmps.
+ */
+int results_compare(const results_record_t *recs, int nrecs, uint64_t build,
+                    double z, double min_change, results_cmp_t *cmps, int maxcmps)
+{
+    int ncmps = 0;
+
+    for (int i = nrecs - 1; i >= 0 && ncmps < maxcmps; i--) {
+        /* Only the latest record of the key */
+        int latest = 1;
+        for (int j = i + 1; j < nrecs && latest; j++) {
+            if (same_key(&recs[i], &recs[j]))
+                latest = 0;
+        }
+        if (!latest)
+            continue;
+
+        results_cmp_t *cmp = &cmps[ncmps++];
+        memset(cmp, 0, sizeof(*cmp));
+        cmp->current = &recs[i];
+        cmp->status = RESULTS_NO_BASELINE;
+        for (int j = i - 1; j >= 0; j--) {
+            if (same_key(&recs[i], &recs[j]) &&
+                (build != 0 ? recs[j].build == build : recs[j].build != recs[i].build))
+            {
+                cmp->baseline = &recs[j];
+                break;
+            }
+        }
+        const results_record_t *b = cmp->baseline, *c = cmp->current;
+        if (b == NULL || b->mean <= 0.0 || b->nruns == 0 || c->nruns == 0)
+            continue;
+
+        double se = sqrt(b->stddev * b->stddev / b->nruns + c->stddev * c->stddev / c->nruns);
+        double diff = c->mean - b->mean;
+        cmp->change = diff / b->mean * 100.0;
+        cmp->margin = fmax(z * se / b->mean * 100.0, min_change);
+        if (fabs(cmp->change) <= cmp->margin)
+            cmp->status = RESULTS_SAME;
+        else
+            cmp->status = diff > 0.0 ? RESULTS_REGRESSION : RESULTS_IMPROVEMENT;
+    }
+    return ncmps;
+}
+
+/* results_compare_report: Prints comparisons. Returns number of regressions. */
+int results_compare_report(const results_cmp_t *cmps, int ncmps, FILE *f)
+{
+    static const char *status[] = {"same", "REGRESSION", "improvement", "no baseline"};
+    int nregressions = 0;
+
+    fprintf(f, "# [Host]           [Kernel]         [Method]       [Build]          [Baseline build] [Mean]             [Baseline mean]    [Change, %%] [Margin, %%] [Status]\n");
+    for (int i = 0; i < ncmps; i++) {
+        const results_cmp_t *cmp = &cmps[i];
+        const results_record_t *c = cmp->current, *b = cmp->baseline;
+        if (b == NULL) {
+            fprintf(f, "  %016" PRIx64 " %-16s %-14s %016" PRIx64 " %-16s %-18.2f %-18s %-11s %-11s %s\n",
+                    c->host, c->kernel, c->method, c->build, "-", c->mean, "-", "-", "-",
+                    status[cmp->status]);
+            continue;
+        }
+        fprintf(f, "  %016" PRIx64 " %-16s %-14s %016" PRIx64 " %016" PRIx64 " %-18.2f %-18.2f %-+11.2f %-11.2f %s\n",
+                c->host, c->kernel, c->method, c->build, b->build, c->mean, b->mean,
+                cmp->change, cmp->margin, status[cmp->status]);
+        if (cmp->status == RESULTS_REGRESSION)
+            nregressions++;
+    }
+    return nregressions;
+}
@@ -0,0 +1,103 @@
+/*
+ * results_store.h: Append-only store of benchmark results and regression
+ *                  detection against a baseline.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef RESULTS_STORE_H
+#define RESULTS_STORE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/*
+ * Store file: header followed by fixed-size records in the byte order
+ * of the host. Records are only appended (O_APPEND), one write per record.
+ */
+#define RESULTS_STORE_MAGIC "TSCSTORE"
+#define RESULTS_STORE_VERSION 1
+#define RESULTS_STORE_DEFAULT "tscbench.store"
+#define RESULTS_KERNEL_MAX 32
+#define RESULTS_METHOD_MAX 16
+
+enum {
+    RESULTS_SAME = 0,
+    RESULTS_REGRESSION = 1,
+    RESULTS_IMPROVEMENT = 2,
+    RESULTS_NO_BASELINE = 3
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} results_store_header_t;
+
+typedef struct {
+    uint64_t host;                  /* Host fingerprint */
+    uint64_t build;                 /* Build ID of tscbench */
+    uint64_t time;                  /* Unix time of the run */
+    uint64_t nruns;
+    double mean;
+    double stddev;
+    double min;
+    double tsc_overhead;
+    char kernel[RESULTS_KERNEL_MAX];
+    char method[RESULTS_METHOD_MAX];
+} results_record_t;
+
+typedef struct {
+    const results_record_t *current;
+    const results_record_t *baseline;   /* NULL if not found */
+    double change;                  /* (current - baseline) / baseline, percents */
+    double margin;                  /* Significance margin of the change, percents */
+    int status;                     /* RESULTS_* */
+} results_cmp_t;
+
+/*
+ * results_host_fingerprint: Returns hash of CPU model, number of CPUs,
+ *                           kernel release and host name.
+ */
+uint64_t results_host_fingerprint();
+
+/* results_build_id: Returns GNU build ID of the executable (hash of the file if absent). */
+uint64_t results_build_id();
+
+/*
+ * results_record_init: Fills key of the record (host, build, time, kernel,
+ *                      method); statistics are filled by caller.
+ */
+void results_record_init(results_record_t *rec, const char *kernel, const char *method);
+
+/* results_store_append: Appends record to the store (created if needed). Returns 0 on success. */
+int results_store_append(const char *path, const results_record_t *rec);
+
+/*
+ * results_store_load: Loads all records of the store (*recs is allocated
+ *                     by malloc). Returns number of records or -1 on error.
+ */
+int results_store_load(const char *path, results_record_t **recs);
+
+/*
+ * results_compare: Compares the latest record of every key (host, kernel,
+ * method) with its baseline: the latest earlier record of another build
+ * (build != 0: of that build). Change is significant if it exceeds both
+ * z * sqrt(se1^2 + se2^2) (standard errors of both runs) and min_change
+ * percents. Returns number of comparisons stored into cmps.
+ */
+int results_compare(const results_record_t *recs, int nrecs, uint64_t build,
+                    double z, double min_change, results_cmp_t *cmps, int maxcmps);
+
+/* results_compare_report: Prints comparisons. Returns number of regressions. */
+int results_compare_report(const results_cmp_t *cmps, int ncmps, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESULTS_STORE_H */
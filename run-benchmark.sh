@@ -3,5 +3,5 @@
 # Bind benchmark to cpu and memory node
 LASTCPU=`cat /proc/cpuinfo | grep processor | tail -n1 | cut -d':' -f2`
 
-#taskset 2 ./tscbench
-numactl --physcpubind="$LASTCPU" --localalloc ./tscbench
+# tscbench binds itself to the CPU and sets local memory policy (preflight.c)
+./tscbench -c $LASTCPU
@@ -9,13 +9,17 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
+#include <math.h>
 
 #include "tsc_x86.h"
+#include "rapl.h"
+#include "results_store.h"
 
 static inline void writetsc(uint64_t newtsc)
 {
@@ -164,6 +168,169 @@ void check_migration_cpuid()
         fprintf(stderr, "Migration is occurred\n");            
 }
 
+static int write_fake_file(const char *dir, const char *file, const char *value)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+    fprintf(f, "%s\n", value);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* remove_fake_tree: Removes files and directories of the fake sysfs tree (ndirs created). */
+static void remove_fake_tree(char dirs[][128], int ndirs)
+{
+    static const char *files[] = {"name", "max_energy_range_uj", "energy_uj", "physical_package_id"};
+    char path[512];
+
+    for (int i = ndirs - 1; i >= 0; i--) {
+        for (int j = 0; j < 4; j++) {
+            snprintf(path, sizeof(path), "%s/%s", dirs[i], files[j]);
+            unlink(path);
+        }
+        if (rmdir(dirs[i]) != 0)
+            fprintf(stderr, "Error removing fake sysfs tree %s\n", dirs[i]);
+    }
+}
+
+/*
+ * check_rapl_wraparound: Reads energy of fake powercap tree with wrapped
+ *                        counters. Zones of package 1 must not be read by
+ *                        CPU 0 of package 0. Returns 0 on success.
+ */
+int check_rapl_wraparound()
+{
+    enum { ROOT, SYS, CLASS, POWERCAP, PKG, DRAM, PKG1, DRAM1, DEVICES, SYSTEM, CPUS, CPU0, TOPOLOGY, NDIRS };
+    char dirs[NDIRS][128];
+    int ndirs = 0, rc = -1;
+    rapl_t rapl;
+
+    snprintf(dirs[ROOT], sizeof(dirs[ROOT]), "/tmp/tscbench-rapl-XXXXXX");
+    if (mkdtemp(dirs[ROOT]) == NULL) {
+        fprintf(stderr, "Error creating fake sysfs tree\n");
+        return -1;
+    }
+    snprintf(dirs[SYS], sizeof(dirs[SYS]), "%.64s/sys", dirs[ROOT]);
+    snprintf(dirs[CLASS], sizeof(dirs[CLASS]), "%.64s/sys/class", dirs[ROOT]);
+    snprintf(dirs[POWERCAP], sizeof(dirs[POWERCAP]), "%.64s/sys/class/powercap", dirs[ROOT]);
+    snprintf(dirs[PKG], sizeof(dirs[PKG]), "%.64s/sys/class/powercap/intel-rapl:0", dirs[ROOT]);
+    snprintf(dirs[DRAM], sizeof(dirs[DRAM]), "%.64s/sys/class/powercap/intel-rapl:0:0", dirs[ROOT]);
+    snprintf(dirs[PKG1], sizeof(dirs[PKG1]), "%.64s/sys/class/powercap/intel-rapl:1", dirs[ROOT]);
+    snprintf(dirs[DRAM1], sizeof(dirs[DRAM1]), "%.64s/sys/class/powercap/intel-rapl:1:0", dirs[ROOT]);
+    snprintf(dirs[DEVICES], sizeof(dirs[DEVICES]), "%.64s/sys/devices", dirs[ROOT]);
+    snprintf(dirs[SYSTEM], sizeof(dirs[SYSTEM]), "%.64s/sys/devices/system", dirs[ROOT]);
+    snprintf(dirs[CPUS], sizeof(dirs[CPUS]), "%.64s/sys/devices/system/cpu", dirs[ROOT]);
+    snprintf(dirs[CPU0], sizeof(dirs[CPU0]), "%.64s/sys/devices/system/cpu/cpu0", dirs[ROOT]);
+    snprintf(dirs[TOPOLOGY], sizeof(dirs[TOPOLOGY]), "%.64s/sys/devices/system/cpu/cpu0/topology", dirs[ROOT]);
+    for (ndirs = 1; ndirs < NDIRS; ndirs++) {
+        if (mkdir(dirs[ndirs], 0700) != 0)
+            break;
+    }
+    if (ndirs < NDIRS ||
+        write_fake_file(dirs[PKG], "name", "package-0") != 0 ||
+        write_fake_file(dirs[PKG], "max_energy_range_uj", "999999") != 0 ||
+        write_fake_file(dirs[PKG], "energy_uj", "999000") != 0 ||
+        write_fake_file(dirs[DRAM], "name", "dram") != 0 ||
+        write_fake_file(dirs[DRAM], "max_energy_range_uj", "999999") != 0 ||
+        write_fake_file(dirs[DRAM], "energy_uj", "1000") != 0 ||
+        write_fake_file(dirs[PKG1], "name", "package-1") != 0 ||
+        write_fake_file(dirs[PKG1], "max_energy_range_uj", "999999") != 0 ||
+        write_fake_file(dirs[PKG1], "energy_uj", "0") != 0 ||
+        write_fake_file(dirs[DRAM1], "name", "dram") != 0 ||
+        write_fake_file(dirs[DRAM1], "max_energy_range_uj", "999999") != 0 ||
+        write_fake_file(dirs[DRAM1], "energy_uj", "0") != 0 ||
+        write_fake_file(dirs[TOPOLOGY], "physical_package_id", "0") != 0)
+    {
+        fprintf(stderr, "Error creating fake sysfs tree\n");
+        remove_fake_tree(dirs, ndirs);
+        return -1;
+    }
+
+    if (rapl_open(&rapl, 0, dirs[ROOT]) != 0 || rapl.ndomains != 2) {
+        fprintf(stderr, "RAPL: fake powercap tree is not found\n");
+    } else {
+        rapl_batch_begin(&rapl);
+        write_fake_file(dirs[PKG], "energy_uj", "500");        /* Wrapped: 1000 + 500 uJ */
+        write_fake_file(dirs[DRAM], "energy_uj", "3000");
+        write_fake_file(dirs[PKG1], "energy_uj", "500000");    /* Other package */
+        write_fake_file(dirs[DRAM1], "energy_uj", "500000");
+        rapl_batch_end(&rapl, 10);
+        /* Domains are sorted by name: dram, package-0 */
+        printf("# RAPL wraparound: dram %.6f J (expected 0.002), package %.6f J (expected 0.0015)\n",
+               rapl.batches[0].joules[0], rapl.batches[0].joules[1]);
+        if (fabs(rapl.batches[0].joules[0] - 0.002) > 1E-9 ||
+            fabs(rapl.batches[0].joules[1] - 0.0015) > 1E-9)
+        {
+            fprintf(stderr, "RAPL: wrong energy of fake counters\n");
+        } else {
+            rc = 0;
+        }
+        rapl_close(&rapl);
+    }
+    remove_fake_tree(dirs, ndirs);
+    return rc;
+}
+
+/*
+ * check_results_compare: Compares in-memory records of two builds
+ *                        (regression, improvement, same, no baseline).
+ *                        Returns 0 on success.
+ */
+int check_results_compare()
+{
+    static const struct {
+        const char *kernel;
+        uint64_t build;
+        double mean;
+        double stddev;
+        int expected;           /* Status of the latest record of the kernel */
+    } runs[] = {
+        {"regression", 1, 100.0, 1.0, -1},
+        {"improvement", 1, 100.0, 1.0, -1},
+        {"same", 1, 100.0, 10.0, -1},
+        {"regression", 2, 120.0, 1.0, RESULTS_REGRESSION},
+        {"improvement", 2, 80.0, 1.0, RESULTS_IMPROVEMENT},
+        {"same", 2, 100.5, 10.0, RESULTS_SAME},
+        {"new", 2, 100.0, 1.0, RESULTS_NO_BASELINE}
+    };
+    enum { NRUNS = sizeof(runs) / sizeof(runs[0]) };
+    results_record_t recs[NRUNS];
+    results_cmp_t cmps[NRUNS];
+    int rc = 0;
+
+    for (int i = 0; i < NRUNS; i++) {
+        memset(&recs[i], 0, sizeof(recs[i]));
+        recs[i].host = 1;
+        recs[i].build = runs[i].build;
+        recs[i].time = i;
+        recs[i].nruns = 100;
+        recs[i].mean = runs[i].mean;
+        recs[i].stddev = runs[i].stddev;
+        recs[i].min = runs[i].mean;
+        snprintf(recs[i].kernel, sizeof(recs[i].kernel), "%s", runs[i].kernel);
+        snprintf(recs[i].method, sizeof(recs[i].method), "std");
+    }
+
+    /* Margin: 3 standard errors, at least 1% */
+    int ncmps = results_compare(recs, NRUNS, 0, 3.0, 1.0, cmps, NRUNS);
+    if (ncmps != 4) {
+        fprintf(stderr, "Results compare: %d comparisons (expected 4)\n", ncmps);
+        return -1;
+    }
+    for (int i = 0; i < ncmps; i++) {
+        int idx = cmps[i].current - recs;
+        printf("# Results compare: %-12s status %d (expected %d), change %+.2f%%, margin %.2f%%\n",
+               recs[idx].kernel, cmps[i].status, runs[idx].expected, cmps[i].change, cmps[i].margin);
+        if (cmps[i].status != runs[idx].expected) {
+            fprintf(stderr, "Results compare: wrong status of %s\n", recs[idx].kernel);
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
 int main()
 {
     show_tsc_info();
@@ -172,6 +339,9 @@ int main()
 
     check_migration();
     check_migration_cpuid();
-    
+    if (check_rapl_wraparound() != 0)
+        return 1;
+    if (check_results_compare() != 0)
+        return 1;
     return 0;
 }
@@ -0,0 +1,85 @@
+/*
+ * throughput.c: Reciprocal throughput of kernels by unserialized streams.
+ *
+ * Latency is the time of one call between serialized TSC reads. In a stream
+ * of back-to-back calls out-of-order execution overlaps consecutive calls,
+ * so time of the stream is T(len) = a + b * len, where b is the reciprocal
+ * throughput and a is the fixed cost (TSC reads, pipeline fill and drain).
+ * b is the slope of least squares fit over streams of several lengths.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mathstat.h"
+#include "throughput.h"
+
+typedef struct {
+    void (*func)(void *);
+    void *arg;
+    int len;
+} stream_t;
+
+/* stream_run: Runs len calls of the kernel back to back. */
+static void stream_run(void *arg)
+{
+    stream_t *s = arg;
+    for (int i = 0; i < s->len; i++)
+        s->func(s->arg);
+}
+
+/*
+ * throughput_measure: Measures streams of 1, 2, 4, ..., maxlen calls of
+ * func(arg) without serialization between calls and fits time of stream
+ * against its length. Latency of one call is measured by the same harness
+ * (read method with its overhead). Returns 0 on success.
+ */
+int throughput_measure(void (*func)(void *), void *arg, int maxlen,
+                       const tsc_read_method_t *method, uint64_t overhead, throughput_t *tp)
+{
+    kernel_result_t res;
+    double x[THROUGHPUT_POINTS_MAX], y[THROUGHPUT_POINTS_MAX];
+
+    memset(tp, 0, sizeof(*tp));
+    if (kernel_measure(method, func, arg, overhead, &res) != 0)
+        return -1;
+    tp->latency = res.mean;
+
+    for (int len = 1; len <= maxlen && tp->npoints < THROUGHPUT_POINTS_MAX; len *= 2) {
+        stream_t stream = {func, arg, len};
+        throughput_point_t *pt = &tp->points[tp->npoints];
+        pt->len = len;
+        if (kernel_measure(method, stream_run, &stream, overhead, &pt->res) != 0)
+            return -1;
+        x[tp->npoints] = len;
+        y[tp->npoints] = pt->res.mean;
+        tp->npoints++;
+    }
+    if (tp->npoints < 2)
+        return -1;
+    tp->r2 = stat_linear_regression(x, y, tp->npoints, &tp->slope, &tp->intercept);
+    return 0;
+}
+
+/* throughput_report: Prints streams, regression, latency and reciprocal throughput. */
+void throughput_report(const throughput_t *tp, const char *name, FILE *f)
+{
+    fprintf(f, "# Streams of %s (ticks)\n", name);
+    fprintf(f, "# [Length] [Runs]  [Mean]             [StdDev]           [RSE]    [Min]              [Mean/Length]\n");
+    for (int i = 0; i < tp->npoints; i++) {
+        const throughput_point_t *pt = &tp->points[i];
+        fprintf(f, "  %-8d %-7d %-18.2f %-18.2f %-8.2f %-18.2f %-18.2f\n",
+                pt->len, pt->res.nruns, pt->res.mean, pt->res.stddev, pt->res.rse,
+                pt->res.min, pt->res.mean / pt->len);
+    }
+    fprintf(f, "# Fit: T(len) = %.2f + %.2f * len, R^2 = %.4f\n", tp->intercept, tp->slope, tp->r2);
+    fprintf(f, "# [Kernel]         [Latency]          [Recip. throughput] [Latency/Throughput]\n");
+    fprintf(f, "  %-16s %-18.2f %-19.2f %-8.2f\n", name, tp->latency, tp->slope,
+            tp->slope > 0.0 ? tp->latency / tp->slope : 0.0);
+    if (tp->r2 < 0.99)
+        fprintf(f, "# [Warning!] Time of stream is not linear in its length (R^2 < 0.99)\n");
+}
@@ -0,0 +1,50 @@
+/*
+ * throughput.h: Reciprocal throughput of kernels by unserialized streams.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef THROUGHPUT_H
+#define THROUGHPUT_H
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "kernel_measure.h"
+
+#define THROUGHPUT_POINTS_MAX 16
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int len;                    /* Number of back-to-back calls in the stream */
+    kernel_result_t res;        /* Execution time of the stream */
+} throughput_point_t;
+
+typedef struct {
+    throughput_point_t points[THROUGHPUT_POINTS_MAX];
+    int npoints;
+    double slope;               /* Reciprocal throughput: ticks per call */
+    double intercept;           /* Fixed cost of the stream */
+    double r2;
+    double latency;             /* Mean time of one serialized call */
+} throughput_t;
+
+/*
+ * throughput_measure: Measures streams of 1, 2, 4, ..., maxlen calls of
+ * func(arg) without serialization between calls and fits time of stream
+ * against its length. Latency of one call is measured by the same harness
+ * (read method with its overhead). Returns 0 on success.
+ */
+int throughput_measure(void (*func)(void *), void *arg, int maxlen,
+                       const tsc_read_method_t *method, uint64_t overhead, throughput_t *tp);
+
+/* throughput_report: Prints streams, regression, latency and reciprocal throughput. */
+void throughput_report(const throughput_t *tp, const char *name, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* THROUGHPUT_H */
@@ -0,0 +1,267 @@
+/*
+ * tick_align.c: Sampling aligned to periodic interrupts (scheduler tick).
+ *
+ * Probe: TSC is read in a tight loop, a difference of consecutive reads
+ * larger than the threshold (1 us or 20 x minimal difference) is a gap
+ * (the CPU was taken by an interrupt). Intervals between gaps up to 8
+ * apart are candidates of the period, a candidate is scored by the number
+ * of gaps followed by another gap one interval later. The period is the
+ * shortest candidate scored at least half of the best one whose chain of
+ * gaps spans half of the probe: a multiple of the tick period (common with
+ * other periodic interrupts) scores higher, coincidences make no chains.
+ *
+ * Sampling: the next interrupt is predicted by the period from the latest
+ * observed one. If a sample (of the duration of the previous one) can't
+ * finish before the prediction, TSC is spun until the interrupt and its
+ * following gaps are over, so the sample starts just after the interrupt.
+ * Samples overlapping a predicted interrupt are rejected and kept apart.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "mathstat.h"
+#include "tick_align.h"
+
+enum {
+    CANDIDATE_SPAN = 8,         /* Interval candidates: gap i to gaps i+1..i+8 */
+    PERIOD_MIN_USEC = 100,      /* Interrupts up to 10 kHz */
+    QUIET_USEC = 20,            /* Interrupt is over after 20 us without gaps */
+    CONTAMINATED_MAX_RATIO = 10 /* Disable when rejects exceed accepted samples 10 times */
+};
+
+#define REGULARITY_MIN 0.25
+#define CHAIN_COVERAGE_MIN 0.5      /* Periodic gaps span half of the probe at least */
+
+/* count_followed: Returns number of gaps followed by a gap at distance period +- tol. */
+static int count_followed(const uint64_t *gaps, int n, uint64_t period, uint64_t tol)
+{
+    int count = 0;
+    for (int i = 0, j = 0; i < n; i++) {
+        while (j < n && gaps[j] + tol < gaps[i] + period)
+            j++;
+        if (j < n && gaps[j] <= gaps[i] + period + tol)
+            count++;
+    }
+    return count;
+}
+
+/*
+ * longest_chain: Returns time span of the longest chain of gaps following
+ *                one another at the period, *len is number of its intervals.
+ */
+static uint64_t longest_chain(const uint64_t *gaps, int n, uint64_t period, uint64_t threshold,
+                              int *len)
+{
+    uint64_t tol = period / 200 + threshold, span = 0;
+
+    *len = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t last = gaps[i];
+        int k = 0;
+        for (int j = i + 1; j < n; j++) {
+            if (gaps[j] + tol < last + period)
+                continue;
+            if (gaps[j] > last + period + tol)
+                break;
+            last = gaps[j];
+            k++;
+        }
+        if (k > *len) {
+            *len = k;
+            span = last - gaps[i];
+        }
+    }
+    return span;
+}
+
+/*
+ * tick_align_probe: Detects period of interrupts on the current CPU by gaps
+ * of continuously read TSC during msec. Returns 0 if periodic interrupts
+ * are found (sampling is enabled).
+ */
+int tick_align_probe(tick_align_t *ta, int msec)
+{
+    uint64_t *gaps = malloc(sizeof(*gaps) * TICK_ALIGN_GAPS_MAX);
+
+    memset(ta, 0, sizeof(*ta));
+    if (gaps == NULL || (ta->contaminated = stat_sample_create()) == NULL) {
+        free(gaps);
+        return -1;
+    }
+    ta->tsc_hz = tsc_frequency();
+
+    uint64_t mindelta = UINT64_MAX, prev = rdtsc();
+    for (int i = 0; i < 1000; i++) {
+        uint64_t now = rdtsc();
+        if (now - prev < mindelta)
+            mindelta = now - prev;
+        prev = now;
+    }
+    ta->threshold = mindelta * 20;
+    if (ta->threshold < (uint64_t)(ta->tsc_hz / 1E6))
+        ta->threshold = ta->tsc_hz / 1E6;
+
+    uint64_t end = rdtsc() + (uint64_t)(ta->tsc_hz * msec / 1E3);
+    prev = rdtsc();
+    while (prev < end && ta->ngaps < TICK_ALIGN_GAPS_MAX) {
+        uint64_t now = rdtsc();
+        if (now - prev > ta->threshold)
+            gaps[ta->ngaps++] = prev;
+        prev = now;
+    }
+
+    /* Largest number of gaps followed by a candidate interval */
+    uint64_t probe = prev - (end - (uint64_t)(ta->tsc_hz * msec / 1E3));
+    int best = 0, len;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < ta->ngaps; i++) {
+            for (int j = i + 1; j < ta->ngaps && j <= i + CANDIDATE_SPAN; j++) {
+                uint64_t period = gaps[j] - gaps[i];
+                if (period < ta->tsc_hz * PERIOD_MIN_USEC / 1E6)
+                    continue;
+                int count = count_followed(gaps, ta->ngaps, period, period / 200 + ta->threshold);
+                if (pass == 0 && count > best)
+                    best = count;
+                /* Shortest of strong candidates: multiples of the period lose */
+                if (pass == 1 && count * 2 >= best && (ta->period == 0 || period < ta->period) &&
+                    longest_chain(gaps, ta->ngaps, period, ta->threshold, &len) > probe * CHAIN_COVERAGE_MIN)
+                {
+                    ta->period = period;
+                    ta->regularity = (double)count / ta->ngaps;
+                }
+            }
+        }
+    }
+
+    /* Refine the period by the longest chain of gaps following it */
+    uint64_t span = ta->period > 0 ? longest_chain(gaps, ta->ngaps, ta->period, ta->threshold, &len) : 0;
+    if (len >= 2)
+        ta->period = span / len;
+    free(gaps);
+
+    if (ta->period == 0 || best < 3 || ta->regularity < REGULARITY_MIN) {
+        ta->period = 0;
+        return -1;
+    }
+    ta->jitter = ta->period / 100 + ta->threshold;
+    ta->burst = ta->tsc_hz * QUIET_USEC / 1E6;
+    ta->next = 0;
+    ta->enabled = 1;
+    return 0;
+}
+
+/* tick_align_free: Frees statistic of contaminated samples. */
+void tick_align_free(tick_align_t *ta)
+{
+    stat_sample_free(ta->contaminated);
+    ta->contaminated = NULL;
+}
+
+/* wait_interrupt: Spins until an interrupt and its following gaps are over. */
+static void wait_interrupt(tick_align_t *ta)
+{
+    uint64_t quiet = ta->tsc_hz * QUIET_USEC / 1E6;
+    uint64_t start = rdtsc(), prev = start, first = 0, last = 0;
+
+    for (;;) {
+        uint64_t now = rdtsc();
+        if (now - prev > ta->threshold) {
+            if (first == 0)
+                first = prev;
+            last = now;
+        }
+        prev = now;
+        if (first != 0 && now - last > quiet)
+            break;
+        /* Interrupt is missed: predict from now */
+        if (first == 0 && now - start > 2 * ta->period) {
+            first = now;
+            last = now;
+            break;
+        }
+    }
+    ta->next = first + ta->period;
+    /* Long stalls (not the periodic interrupt) do not widen the window */
+    if (last - first + quiet > ta->burst && last - first + quiet < ta->period / 10)
+        ta->burst = last - first + quiet;
+    ta->nwaits++;
+}
+
+/*
+ * tick_align_before: Waits for the next interrupt (and its following gaps)
+ * if the sample can't finish before it.
+ */
+void tick_align_before(tick_align_t *ta)
+{
+    if (!ta->enabled)
+        return;
+    uint64_t now = rdtsc();
+    if (ta->next == 0) {
+        wait_interrupt(ta);
+        return;
+    }
+    while (now > ta->next + ta->burst)
+        ta->next += ta->period;
+    if (now + ta->expected + ta->jitter >= ta->next)
+        wait_interrupt(ta);
+}
+
+/*
+ * tick_align_after: Returns 1 if sample [t0, t1] overlaps predicted
+ * interrupt (value is stored into contaminated samples), 0 otherwise.
+ */
+int tick_align_after(tick_align_t *ta, uint64_t t0, uint64_t t1, double value)
+{
+    if (!ta->enabled)
+        return 0;
+    ta->expected = t1 - t0;
+    if (ta->expected > ta->period / 2) {
+        fprintf(stderr, "# [Warning!] Samples are longer than half of period of interrupts:"
+                        " tick alignment is disabled\n");
+        ta->enabled = 0;
+        return 0;
+    }
+    if (t1 + ta->jitter < ta->next || t0 > ta->next + ta->burst) {
+        ta->naccepted++;
+        return 0;
+    }
+    stat_sample_add(ta->contaminated, value);
+
+    /* Prediction does not work (interrupts are not periodic) */
+    int n = stat_sample_size(ta->contaminated);
+    if (n > 100 && n > ta->naccepted * CONTAMINATED_MAX_RATIO) {
+        fprintf(stderr, "# [Warning!] Most samples overlap predicted interrupts:"
+                        " tick alignment is disabled\n");
+        ta->enabled = 0;
+    }
+    return 1;
+}
+
+/* tick_align_report: Prints detected cadence and contaminated samples. */
+void tick_align_report(tick_align_t *ta, FILE *f)
+{
+    fprintf(f, "# Tick alignment: gap threshold %" PRIu64 " ticks, %d gaps in probe\n",
+            ta->threshold, ta->ngaps);
+    if (ta->period == 0) {
+        fprintf(f, "# No periodic interrupts detected (nohz_full CPU?): samples are not aligned\n");
+        return;
+    }
+    fprintf(f, "# Period of interrupts: %" PRIu64 " ticks (%.1f us, %.1f Hz), regularity %.2f,"
+               " burst %.1f us\n", ta->period, ta->period / ta->tsc_hz * 1E6,
+            ta->tsc_hz / ta->period, ta->regularity, ta->burst / ta->tsc_hz * 1E6);
+    int n = ta->contaminated ? stat_sample_size(ta->contaminated) : 0;
+    fprintf(f, "# [Accepted] [Waits]    [Contaminated] [Mean]             [StdDev]           [Min]              [Max]\n");
+    fprintf(f, "  %-10" PRIu64 " %-10" PRIu64 " %-14d ", ta->naccepted, ta->nwaits, n);
+    if (n > 0)
+        fprintf(f, "%-18.2f %-18.2f %-18.2f %-18.2f\n", stat_sample_mean_knuth(ta->contaminated),
+                stat_sample_stddev_knuth(ta->contaminated), stat_sample_min(ta->contaminated),
+                stat_sample_max(ta->contaminated));
+    else
+        fprintf(f, "-\n");
+}
@@ -0,0 +1,66 @@
+/*
+ * tick_align.h: Sampling aligned to periodic interrupts (scheduler tick).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef TICK_ALIGN_H
+#define TICK_ALIGN_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "mathstat.h"
+
+#define TICK_ALIGN_GAPS_MAX 4096
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    double tsc_hz;
+    uint64_t threshold;         /* TSC gap of interrupt (ticks) */
+    uint64_t period;            /* Period of interrupts (ticks), 0 if not detected */
+    uint64_t burst;             /* Duration of interrupt with following gaps */
+    uint64_t jitter;            /* Tolerance of predicted interrupt */
+    int ngaps;                  /* Gaps found by the probe */
+    double regularity;          /* Fraction of gaps which follow the period */
+    int enabled;                /* Samples are aligned and checked */
+    uint64_t next;              /* Predicted TSC of the next interrupt */
+    uint64_t expected;          /* Expected duration of a sample */
+    uint64_t nwaits;            /* Samples started after a waited interrupt */
+    uint64_t naccepted;
+    stat_sample_t *contaminated;    /* Samples overlapped by predicted interrupt */
+} tick_align_t;
+
+/*
+ * tick_align_probe: Detects period of interrupts on the current CPU by gaps
+ * of continuously read TSC during msec. Returns 0 if periodic interrupts
+ * are found (sampling is enabled).
+ */
+int tick_align_probe(tick_align_t *ta, int msec);
+
+/* tick_align_free: Frees statistic of contaminated samples. */
+void tick_align_free(tick_align_t *ta);
+
+/*
+ * tick_align_before: Waits for the next interrupt (and its following gaps)
+ * if the sample can't finish before it.
+ */
+void tick_align_before(tick_align_t *ta);
+
+/*
+ * tick_align_after: Returns 1 if sample [t0, t1] overlaps predicted
+ * interrupt (value is stored into contaminated samples), 0 otherwise.
+ */
+int tick_align_after(tick_align_t *ta, uint64_t t0, uint64_t t1, double value);
+
+/* tick_align_report: Prints detected cadence and contaminated samples. */
+void tick_align_report(tick_align_t *ta, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TICK_ALIGN_H */
@@ -0,0 +1,85 @@
+/*
+ * tsc_autotune.c: Selection of TSC read method by startup calibration.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#include <stdio.h>
+#include <float.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "mathstat.h"
+#include "tsc_autotune.h"
+
+/*
+ * tsc_autotune: Measures overhead of every read method and returns index
+ * of the best one in scores (-1 on error). Methods with rejected
+ * measurements are disqualified; others are ranked by min + stddev.
+ */
+int tsc_autotune(tsc_autotune_score_t *scores, int maxscores, int *nscores)
+{
+    stat_sample_t *stat = stat_sample_create();
+    if (stat == NULL) {
+        fprintf(stderr, "# No enough memory for statistics\n");
+        return -1;
+    }
+
+    int rdtscp = is_rdtscp_available();
+    int n = 0;
+    for (int i = 0; tsc_read_methods[i].name != NULL && n < maxscores; i++, n++) {
+        tsc_autotune_score_t *s = &scores[n];
+        s->method = &tsc_read_methods[i];
+        s->available = !(s->method->need_rdtscp && !rdtscp);
+        s->nruns = 0;
+        s->nrejects = 0;
+        s->min = s->mean = s->stddev = 0.0;
+        s->score = DBL_MAX;
+        if (!s->available)
+            continue;
+
+        s->nrejects = s->method->overhead_stat(stat);
+        s->nruns = stat_sample_size(stat);
+        s->min = stat_sample_min(stat);
+        s->mean = stat_sample_mean_knuth(stat);
+        s->stddev = stat_sample_stddev_knuth(stat);
+        s->score = s->min + s->stddev;
+    }
+    stat_sample_free(stat);
+    *nscores = n;
+
+    /* Prefer methods without rejects */
+    int best = -1;
+    for (int pass = 0; pass < 2 && best < 0; pass++) {
+        for (int i = 0; i < n; i++) {
+            if (!scores[i].available || (pass == 0 && scores[i].nrejects > 0))
+                continue;
+            if (best < 0 || scores[i].score < scores[best].score)
+                best = i;
+        }
+    }
+    return best;
+}
+
+/* tsc_autotune_report: Prints TSC features, scores and selected method. */
+void tsc_autotune_report(tsc_autotune_score_t *scores, int nscores, int best, FILE *f)
+{
+    fprintf(f, "# TSC read method autotuning: RDTSCP %s, invariant TSC %s\n",
+            is_rdtscp_available() ? "supported" : "not supported",
+            is_tsc_invariant() ? "yes" : "no");
+    if (!is_tsc_invariant())
+        fprintf(f, "# [Warning!] TSC is not invariant: rate depends on core frequency\n");
+    fprintf(f, "# [Method]       [Runs]  [Min]      [Mean]             [StdDev]           [Rejects]  [Score]\n");
+    for (int i = 0; i < nscores; i++) {
+        if (!scores[i].available) {
+            fprintf(f, "#  %-14s (RDTSCP is not supported)\n", scores[i].method->name);
+            continue;
+        }
+        fprintf(f, "#  %-14s %-7d %-10.0f %-18.2f %-18.2f %-10d %-10.2f%s\n",
+                scores[i].method->name, scores[i].nruns, scores[i].min, scores[i].mean,
+                scores[i].stddev, scores[i].nrejects, scores[i].score,
+                i == best ? " <- selected" : "");
+    }
+    if (best >= 0 && scores[best].nrejects > 0)
+        fprintf(f, "# [Warning!] All read methods have rejected measurements\n");
+}
@@ -0,0 +1,42 @@
+/*
+ * tsc_autotune.h: Selection of TSC read method by startup calibration.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef TSC_AUTOTUNE_H
+#define TSC_AUTOTUNE_H
+
+#include <stdio.h>
+#include "tsc_x86.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const tsc_read_method_t *method;
+    int available;        /* 0 if method needs RDTSCP which is not supported */
+    int nruns;
+    int nrejects;         /* Measurements with second TSC value <= first one */
+    double min;
+    double mean;
+    double stddev;
+    double score;         /* Lower is better */
+} tsc_autotune_score_t;
+
+/*
+ * tsc_autotune: Measures overhead of every read method and returns index
+ * of the best one in scores (-1 on error). Methods with rejected
+ * measurements are disqualified; others are ranked by min + stddev.
+ */
+int tsc_autotune(tsc_autotune_score_t *scores, int maxscores, int *nscores);
+
+/* tsc_autotune_report: Prints TSC features, scores and selected method. */
+void tsc_autotune_report(tsc_autotune_score_t *scores, int nscores, int best, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSC_AUTOTUNE_H */
@@ -0,0 +1,304 @@
+/*
+ * tsc_hist.c: Log-linear histogram of tick values (HDR-style).
+ *
+ * Bucket index of value v with most significant bit m:
+ *     shift = max(m - p, 0), index = (shift << p) + (v >> shift).
+ * Buckets [0, 2^(p+1)) hold single values, every next group of 2^p buckets
+ * covers twice wider range. Number of buckets is (65 - p) * 2^p.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "mathstat.h"
+#include "tsc_hist.h"
+
+enum {
+    LOCAL_CACHE_SIZE = 8
+};
+
+struct tsc_hist {
+    int precision;
+    uint64_t generation;        /* Unique id: address of freed histogram may be reused */
+    tsc_hist_shard_t *shards;
+};
+
+typedef struct {
+    tsc_hist_t *hist;
+    uint64_t generation;
+    tsc_hist_shard_t *shard;
+} local_shard_t;
+
+static uint64_t next_generation = 1;
+
+/*
+ * Shards of calling thread: small cache, owner of shard is found by tid on miss.
+ * Entries are matched by address and generation of histogram: entries of other
+ * threads are not cleared by tsc_hist_free and may refer to a freed histogram.
+ */
+static __thread local_shard_t local_shards[LOCAL_CACHE_SIZE];
+static __thread int local_next = 0;
+
+/* Shard of histogram is extended by id of owner thread */
+typedef struct {
+    tsc_hist_shard_t shard;
+    uint32_t owner;
+} owned_shard_t;
+
+static tsc_hist_shard_t *shard_init(tsc_hist_shard_t *shard, int precision)
+{
+    memset(shard, 0, sizeof(*shard));
+    shard->precision = precision;
+    shard->nbuckets = (65 - precision) << precision;
+    shard->min = UINT64_MAX;
+    if ( (shard->counts = calloc(shard->nbuckets, sizeof(uint64_t))) == NULL)
+        return NULL;
+    return shard;
+}
+
+/* tsc_hist_create: Creates histogram with precision of p bits. Returns NULL on error. */
+tsc_hist_t *tsc_hist_create(int precision)
+{
+    tsc_hist_t *hist;
+
+    if (precision < TSC_HIST_PRECISION_MIN || precision > TSC_HIST_PRECISION_MAX)
+        return NULL;
+    if ( (hist = malloc(sizeof(*hist))) == NULL)
+        return NULL;
+    hist->precision = precision;
+    hist->generation = __atomic_fetch_add(&next_generation, 1, __ATOMIC_RELAXED);
+    hist->shards = NULL;
+    return hist;
+}
+
+/* tsc_hist_free: Frees histogram and all its shards (recording must be finished). */
+void tsc_hist_free(tsc_hist_t *hist)
+{
+    if (hist == NULL)
+        return;
+
+    tsc_hist_shard_t *shard = hist->shards;
+    while (shard != NULL) {
+        tsc_hist_shard_t *next = shard->next;
+        free(shard->counts);
+        free(shard);
+        shard = next;
+    }
+    for (int i = 0; i < LOCAL_CACHE_SIZE; i++) {
+        if (local_shards[i].hist == hist)
+            local_shards[i].hist = NULL;
+    }
+    free(hist);
+}
+
+/* tsc_hist_shard_create: Creates new shard of the histogram. */
+tsc_hist_shard_t *tsc_hist_shard_create(tsc_hist_t *hist)
+{
+    owned_shard_t *os = malloc(sizeof(*os));
+    if (os == NULL)
+        return NULL;
+    if (shard_init(&os->shard, hist->precision) == NULL) {
+        free(os);
+        return NULL;
+    }
+    os->owner = (uint32_t)syscall(SYS_gettid);
+
+    /* Lock-free push into the list of shards */
+    tsc_hist_shard_t *shard = &os->shard;
+    shard->next = __atomic_load_n(&hist->shards, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&hist->shards, &shard->next, shard, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    return shard;
+}
+
+/* tsc_hist_local: Returns shard of calling thread (creates it on first call). */
+tsc_hist_shard_t *tsc_hist_local(tsc_hist_t *hist)
+{
+    for (int i = 0; i < LOCAL_CACHE_SIZE; i++) {
+        if (local_shards[i].hist == hist && local_shards[i].generation == hist->generation)
+            return local_shards[i].shard;
+    }
+
+    /* Slow path: find shard of the thread or create new one */
+    uint32_t tid = (uint32_t)syscall(SYS_gettid);
+    tsc_hist_shard_t *shard;
+    for (shard = __atomic_load_n(&hist->shards, __ATOMIC_ACQUIRE);
+         shard != NULL; shard = shard->next)
+    {
+        if (((owned_shard_t *)shard)->owner == tid)
+            break;
+    }
+    if (shard == NULL && (shard = tsc_hist_shard_create(hist)) == NULL)
+        return NULL;
+
+    local_shards[local_next].hist = hist;
+    local_shards[local_next].generation = hist->generation;
+    local_shards[local_next].shard = shard;
+    local_next = (local_next + 1) % LOCAL_CACHE_SIZE;
+    return shard;
+}
+
+/* tsc_hist_shard_alloc: Creates standalone shard (not linked to histogram). */
+tsc_hist_shard_t *tsc_hist_shard_alloc(int precision)
+{
+    tsc_hist_shard_t *shard;
+
+    if (precision < TSC_HIST_PRECISION_MIN || precision > TSC_HIST_PRECISION_MAX)
+        return NULL;
+    if ( (shard = malloc(sizeof(*shard))) == NULL)
+        return NULL;
+    if (shard_init(shard, precision) == NULL) {
+        free(shard);
+        return NULL;
+    }
+    return shard;
+}
+
+/* tsc_hist_shard_free: Frees standalone shard. */
+void tsc_hist_shard_free(tsc_hist_shard_t *shard)
+{
+    if (shard) {
+        free(shard->counts);
+        free(shard);
+    }
+}
+
+/* tsc_hist_merge: Adds counts of src to dst (shards must have the same precision). */
+int tsc_hist_merge(tsc_hist_shard_t *dst, tsc_hist_shard_t *src)
+{
+    if (dst->precision != src->precision)
+        return -1;
+
+    uint64_t count = __atomic_load_n(&src->count, __ATOMIC_ACQUIRE);
+    if (count == 0)
+        return 0;
+    for (int i = 0; i < src->nbuckets; i++)
+        dst->counts[i] += __atomic_load_n(&src->counts[i], __ATOMIC_RELAXED);
+    dst->count += count;
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    uint64_t min = __atomic_load_n(&src->min, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (min < dst->min)
+        dst->min = min;
+    if (max > dst->max)
+        dst->max = max;
+    return 0;
+}
+
+/* tsc_hist_snapshot: Returns standalone shard with merged counts of all shards. */
+tsc_hist_shard_t *tsc_hist_snapshot(tsc_hist_t *hist)
+{
+    tsc_hist_shard_t *snap = tsc_hist_shard_alloc(hist->precision);
+    if (snap == NULL)
+        return NULL;
+
+    for (tsc_hist_shard_t *shard = __atomic_load_n(&hist->shards, __ATOMIC_ACQUIRE);
+         shard != NULL; shard = shard->next)
+    {
+        tsc_hist_merge(snap, shard);
+    }
+    return snap;
+}
+
+/* tsc_hist_bucket_low: Returns the lowest value of the bucket. */
+uint64_t tsc_hist_bucket_low(int precision, int index)
+{
+    if (index < (2 << precision))
+        return index;
+    int shift = (index >> precision) - 1;
+    return (uint64_t)(index - (shift << precision)) << shift;
+}
+
+/* tsc_hist_bucket_high: Returns the highest value of the bucket. */
+uint64_t tsc_hist_bucket_high(int precision, int index)
+{
+    if (index < (2 << precision))
+        return index;
+    int shift = (index >> precision) - 1;
+    return tsc_hist_bucket_low(precision, index) + (((uint64_t)1 << shift) - 1);
+}
+
+/* bucket_mid: Returns midpoint of the bucket. */
+static double bucket_mid(int precision, int index)
+{
+    return ((double)tsc_hist_bucket_low(precision, index) +
+            (double)tsc_hist_bucket_high(precision, index)) / 2.0;
+}
+
+/*
+ * tsc_hist_percentile: Returns p-th percentile (by stat_hist_percentile),
+ *                      value of the bucket is its midpoint.
+ */
+double tsc_hist_percentile(tsc_hist_shard_t *shard, double p)
+{
+    int n = 0;
+    for (int i = 0; i < shard->nbuckets; i++) {
+        if (shard->counts[i] > 0)
+            n++;
+    }
+    if (n == 0)
+        return 0.0;
+
+    double *values = malloc(sizeof(*values) * n);
+    uint64_t *counts = malloc(sizeof(*counts) * n);
+    if (values == NULL || counts == NULL) {
+        free(values);
+        free(counts);
+        return 0.0;
+    }
+    for (int i = 0, j = 0; i < shard->nbuckets; i++) {
+        if (shard->counts[i] > 0) {
+            values[j] = bucket_mid(shard->precision, i);
+            counts[j] = shard->counts[i];
+            j++;
+        }
+    }
+    double res = stat_hist_percentile(values, counts, n, p);
+    free(values);
+    free(counts);
+
+    /* Midpoint of the bucket can be out of observed range */
+    if (res < (double)shard->min)
+        res = (double)shard->min;
+    if (res > (double)shard->max)
+        res = (double)shard->max;
+    return res;
+}
+
+/* tsc_hist_to_sample: Adds values of the shard (bucket midpoints) to sample. */
+void tsc_hist_to_sample(tsc_hist_shard_t *shard, stat_sample_t *sample)
+{
+    for (int i = 0; i < shard->nbuckets; i++) {
+        if (shard->counts[i] > 0)
+            stat_sample_add_weighted(sample, bucket_mid(shard->precision, i), shard->counts[i]);
+    }
+}
+
+/* tsc_hist_report: Prints count, mean, percentiles and maximum. */
+void tsc_hist_report(tsc_hist_shard_t *shard, FILE *f)
+{
+    stat_sample_t *stat = stat_sample_create();
+    if (stat == NULL) {
+        fprintf(stderr, "# No enough memory for statistics\n");
+        return;
+    }
+    tsc_hist_to_sample(shard, stat);
+
+    fprintf(f, "# Histogram (ticks), precision %d bits\n", shard->precision);
+    fprintf(f, "# [Count]    [Mean]             [StdDev]           [Min]              [P50]              [P90]              [P99]              [P99.9]            [Max]\n");
+    fprintf(f, "  %-10" PRIu64 " %-18.2f %-18.2f %-18" PRIu64 " %-18.2f %-18.2f %-18.2f %-18.2f %-18" PRIu64 "\n",
+            shard->count, shard->count > 0 ? (double)shard->sum / shard->count : 0.0,
+            stat_sample_stddev_knuth(stat), shard->count > 0 ? shard->min : 0,
+            tsc_hist_percentile(shard, 50.0), tsc_hist_percentile(shard, 90.0),
+            tsc_hist_percentile(shard, 99.0), tsc_hist_percentile(shard, 99.9), shard->max);
+    stat_sample_free(stat);
+}
@@ -0,0 +1,112 @@
+/*
+ * tsc_hist.h: Log-linear histogram of tick values (HDR-style).
+ *
+ * Values below 2^p are counted exactly, larger values are counted with
+ * relative precision 2^-p (p is precision in bits). Every recording thread
+ * owns a shard; recording is a few instructions without atomic
+ * read-modify-write operations. Snapshot merges shards without locks.
+ *
+ * Usage:
+ *     tsc_hist_t *hist = tsc_hist_create(7);
+ *     ...
+ *     tsc_hist_record(tsc_hist_local(hist), ticks);
+ *     ...
+ *     tsc_hist_shard_t *snap = tsc_hist_snapshot(hist);
+ *     tsc_hist_percentile(snap, 99.0);
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef TSC_HIST_H
+#define TSC_HIST_H
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "mathstat.h"
+
+#define TSC_HIST_PRECISION_MIN 1
+#define TSC_HIST_PRECISION_MAX 14
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tsc_hist_shard {
+    uint64_t *counts;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    int precision;
+    int nbuckets;
+    struct tsc_hist_shard *next;
+} tsc_hist_shard_t;
+
+typedef struct tsc_hist tsc_hist_t;
+
+/* tsc_hist_create: Creates histogram with precision of p bits. Returns NULL on error. */
+tsc_hist_t *tsc_hist_create(int precision);
+
+/* tsc_hist_free: Frees histogram and all its shards (recording must be finished). */
+void tsc_hist_free(tsc_hist_t *hist);
+
+/* tsc_hist_shard_create: Creates new shard of the histogram. */
+tsc_hist_shard_t *tsc_hist_shard_create(tsc_hist_t *hist);
+
+/* tsc_hist_local: Returns shard of calling thread (creates it on first call). */
+tsc_hist_shard_t *tsc_hist_local(tsc_hist_t *hist);
+
+/* tsc_hist_shard_alloc: Creates standalone shard (not linked to histogram). */
+tsc_hist_shard_t *tsc_hist_shard_alloc(int precision);
+
+/* tsc_hist_shard_free: Frees standalone shard. */
+void tsc_hist_shard_free(tsc_hist_shard_t *shard);
+
+/* tsc_hist_snapshot: Returns standalone shard with merged counts of all shards. */
+tsc_hist_shard_t *tsc_hist_snapshot(tsc_hist_t *hist);
+
+/* tsc_hist_merge: Adds counts of src to dst (shards must have the same precision). */
+int tsc_hist_merge(tsc_hist_shard_t *dst, tsc_hist_shard_t *src);
+
+/* tsc_hist_bucket_low, tsc_hist_bucket_high: Returns range of values of the bucket. */
+uint64_t tsc_hist_bucket_low(int precision, int index);
+uint64_t tsc_hist_bucket_high(int precision, int index);
+
+/* tsc_hist_percentile: Returns p-th percentile (by stat_hist_percentile). */
+double tsc_hist_percentile(tsc_hist_shard_t *shard, double p);
+
+/* tsc_hist_to_sample: Adds values of the shard (bucket midpoints) to sample. */
+void tsc_hist_to_sample(tsc_hist_shard_t *shard, stat_sample_t *sample);
+
+/* tsc_hist_report: Prints count, mean, percentiles and maximum. */
+void tsc_hist_report(tsc_hist_shard_t *shard, FILE *f);
+
+/* tsc_hist_index: Returns index of the bucket for value. */
+static inline int tsc_hist_index(int precision, uint64_t val)
+{
+    int msb = 63 - __builtin_clzll(val | 1);
+    int shift = msb > precision ? msb - precision : 0;
+    return (shift << precision) + (int)(val >> shift);
+}
+
+/*
+ * tsc_hist_record: Adds value to the shard. Only owner thread may record
+ *                  into the shard; stores are atomic (not torn) for readers.
+ */
+static inline void tsc_hist_record(tsc_hist_shard_t *shard, uint64_t val)
+{
+    int i = tsc_hist_index(shard->precision, val);
+    __atomic_store_n(&shard->counts[i], shard->counts[i] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&shard->sum, shard->sum + val, __ATOMIC_RELAXED);
+    if (val < shard->min)
+        __atomic_store_n(&shard->min, val, __ATOMIC_RELAXED);
+    if (val > shard->max)
+        __atomic_store_n(&shard->max, val, __ATOMIC_RELAXED);
+    __atomic_store_n(&shard->count, shard->count + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSC_HIST_H */
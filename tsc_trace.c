@@ -0,0 +1,340 @@
+/*
+ * tsc_trace.c: Per-thread TSC event tracing.
+ *
+ * Buffers of live threads are never freed: a producer can be in the middle
+ * of writing after tracing is stopped. Buffers are reused by the next
+ * session. Buffer of an exited thread (destructor of the thread key) is
+ * unlinked and freed by the next drain, i.e. by the flusher or the final
+ * drain of tsc_trace_stop(). Producers push buffers without locks; only
+ * drains and readers of the list take buffers_lock.
+ *
+ * Flushing thread runs with SCHED_OTHER policy on CPUs other than the CPU
+ * of tsc_trace_start() caller: the traced process may be pinned with
+ * SCHED_FIFO (preflight.c), and an inherited policy and affinity would
+ * leave the flusher no time to drain buffers while traced thread spins.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "tsc_trace.h"
+
+enum {
+    FLUSH_INTERVAL_USEC = 1000
+};
+
+int tsc_trace_enabled = 0;
+__thread tsc_trace_buffer_t *tsc_trace_self = NULL;
+
+static tsc_trace_buffer_t *buffers = NULL;
+static uint64_t buffer_nrecords = TSC_TRACE_NRECORDS_DEFAULT;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t retired_ndropped = 0;      /* Dropped events of freed buffers */
+static pthread_key_t self_key;
+static pthread_once_t self_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+static char region_names[TSC_TRACE_REGIONS_MAX][TSC_TRACE_REGION_NAME_MAX];
+static uint32_t nregions = 0;
+static uint32_t nregions_written = 0;
+static uint32_t nregions_overflowed = 0;
+
+static FILE *trace_file = NULL;
+static pthread_t flusher;
+static int flusher_stop = 0;
+static int traced_cpu = -1;
+
+/*
+ * tsc_trace_region: Returns id of the region with given name (registers new
+ *                   region). Returns TSC_TRACE_REGION_OVERFLOW if limit of
+ *                   regions is exceeded: events of the id are dropped.
+ */
+uint32_t tsc_trace_region(const char *name)
+{
+    uint32_t id;
+
+    pthread_mutex_lock(&regions_lock);
+    for (id = 0; id < nregions; id++) {
+        if (strncmp(region_names[id], name, TSC_TRACE_REGION_NAME_MAX - 1) == 0)
+            break;
+    }
+    if (id == nregions) {
+        if (nregions < TSC_TRACE_REGIONS_MAX) {
+            strncpy(region_names[id], name, TSC_TRACE_REGION_NAME_MAX - 1);
+            region_names[id][TSC_TRACE_REGION_NAME_MAX - 1] = '\0';
+            __atomic_store_n(&nregions, nregions + 1, __ATOMIC_RELEASE);
+        } else {
+            if (nregions_overflowed++ == 0)
+                fprintf(stderr, "# [Warning!] Limit of trace regions (%d) is exceeded:"
+                                " events of new regions are dropped\n", TSC_TRACE_REGIONS_MAX);
+            id = TSC_TRACE_REGION_OVERFLOW;
+        }
+    }
+    pthread_mutex_unlock(&regions_lock);
+    return id;
+}
+
+/* tsc_trace_regions_overflowed: Returns number of registrations rejected by the limit. */
+uint32_t tsc_trace_regions_overflowed()
+{
+    pthread_mutex_lock(&regions_lock);
+    uint32_t n = nregions_overflowed;
+    pthread_mutex_unlock(&regions_lock);
+    return n;
+}
+
+/* buffer_exit: Destructor of the thread key: marks buffer of exited thread. */
+static void buffer_exit(void *arg)
+{
+    tsc_trace_buffer_t *buf = arg;
+
+    tsc_trace_self = NULL;
+    __atomic_store_n(&buf->exited, 1, __ATOMIC_RELEASE);
+}
+
+static void self_key_create()
+{
+    pthread_key_create(&self_key, buffer_exit);
+}
+
+/* tsc_trace_buffer_create: Creates ring buffer for calling thread. */
+tsc_trace_buffer_t *tsc_trace_buffer_create()
+{
+    tsc_trace_buffer_t *buf;
+
+    pthread_once(&self_key_once, self_key_create);
+    if (posix_memalign((void **)&buf, 64, sizeof(*buf)) != 0)
+        return NULL;
+    memset(buf, 0, sizeof(*buf));
+    buf->mask = buffer_nrecords - 1;
+    buf->tid = (uint32_t)syscall(SYS_gettid);
+    if ( (buf->records = malloc(sizeof(*buf->records) * buffer_nrecords)) == NULL) {
+        free(buf);
+        return NULL;
+    }
+
+    /* Lock-free push into the list of buffers */
+    buf->next = __atomic_load_n(&buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&buffers, &buf->next, buf, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+    tsc_trace_self = buf;
+    pthread_setspecific(self_key, buf);
+    return buf;
+}
+
+/* tsc_trace_dropped: Returns total number of events lost on buffer overflow. */
+uint64_t tsc_trace_dropped()
+{
+    pthread_mutex_lock(&buffers_lock);
+    uint64_t ndropped = retired_ndropped;
+    for (tsc_trace_buffer_t *buf = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+         buf != NULL; buf = buf->next)
+    {
+        ndropped += __atomic_load_n(&buf->ndropped, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&buffers_lock);
+    return ndropped;
+}
+
+static void write_block(uint32_t type, const void *data, uint32_t size)
+{
+    tsc_trace_block_t block = {type, size};
+    fwrite(&block, sizeof(block), 1, trace_file);
+    fwrite(data, size, 1, trace_file);
+}
+
+static void write_dropped(tsc_trace_buffer_t *buf)
+{
+    uint64_t ndropped = __atomic_load_n(&buf->ndropped, __ATOMIC_RELAXED);
+    if (ndropped > 0) {
+        char payload[sizeof(uint32_t) + sizeof(uint64_t)];
+        memcpy(payload, &buf->tid, sizeof(uint32_t));
+        memcpy(payload + sizeof(uint32_t), &ndropped, sizeof(uint64_t));
+        write_block(TSC_TRACE_BLOCK_DROPPED, payload, sizeof(payload));
+    }
+}
+
+/* drain_buffer: Writes events of the buffer to the trace file. */
+static void drain_buffer(tsc_trace_buffer_t *buf)
+{
+    uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = buf->tail;
+    if (head == tail)
+        return;
+
+    uint64_t count = head - tail;
+    tsc_trace_block_t block = {TSC_TRACE_BLOCK_EVENTS,
+                               sizeof(uint32_t) + count * sizeof(tsc_trace_rec_t)};
+    fwrite(&block, sizeof(block), 1, trace_file);
+    fwrite(&buf->tid, sizeof(buf->tid), 1, trace_file);
+
+    /* Records [tail, head) may wrap around the end of buffer */
+    uint64_t first = tail & buf->mask;
+    uint64_t n1 = buf->mask + 1 - first;
+    if (n1 > count)
+        n1 = count;
+    fwrite(&buf->records[first], sizeof(tsc_trace_rec_t), n1, trace_file);
+    if (count > n1)
+        fwrite(&buf->records[0], sizeof(tsc_trace_rec_t), count - n1, trace_file);
+
+    __atomic_store_n(&buf->tail, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * release_buffer: Unlinks drained buffer of exited thread (prev is its
+ *                 predecessor or NULL) and frees it. Called under buffers_lock.
+ */
+static void release_buffer(tsc_trace_buffer_t *prev, tsc_trace_buffer_t *buf)
+{
+    /* Head of the list may be replaced by concurrent push: then buf has a predecessor */
+    tsc_trace_buffer_t *expected = buf;
+    if (prev != NULL || !__atomic_compare_exchange_n(&buffers, &expected, buf->next, 0,
+                                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        if (prev == NULL) {
+            for (prev = expected; prev->next != buf; prev = prev->next)
+                ;
+        }
+        prev->next = buf->next;
+    }
+    write_dropped(buf);
+    retired_ndropped += __atomic_load_n(&buf->ndropped, __ATOMIC_RELAXED);
+    free(buf->records);
+    free(buf);
+}
+
+/*
+ * drain_buffers: Writes new regions and events of all threads to the trace
+ *                file, frees drained buffers of exited threads.
+ */
+static void drain_buffers()
+{
+    uint32_t n = __atomic_load_n(&nregions, __ATOMIC_ACQUIRE);
+    for (; nregions_written < n; nregions_written++) {
+        tsc_trace_region_rec_t rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.id = nregions_written;
+        memcpy(rec.name, region_names[rec.id], TSC_TRACE_REGION_NAME_MAX);
+        write_block(TSC_TRACE_BLOCK_REGION, &rec, sizeof(rec));
+    }
+
+    pthread_mutex_lock(&buffers_lock);
+    tsc_trace_buffer_t *prev = NULL;
+    tsc_trace_buffer_t *buf = __atomic_load_n(&buffers, __ATOMIC_ACQUIRE);
+    while (buf != NULL) {
+        tsc_trace_buffer_t *next = buf->next;
+        drain_buffer(buf);
+        /* Exited thread wrote all its events before the flag */
+        if (__atomic_load_n(&buf->exited, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE) == buf->tail)
+        {
+            release_buffer(prev, buf);
+        } else {
+            prev = buf;
+        }
+        buf = next;
+    }
+    pthread_mutex_unlock(&buffers_lock);
+}
+
+static void *flusher_thread(void *arg)
+{
+    struct timespec interval = {0, FLUSH_INTERVAL_USEC * 1000};
+    cpu_set_t set;
+
+    /* All CPUs except the traced one (kept if it is the only CPU) */
+    CPU_ZERO(&set);
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    for (int cpu = 0; cpu < ncpus && cpu < CPU_SETSIZE; cpu++) {
+        if (cpu != traced_cpu)
+            CPU_SET(cpu, &set);
+    }
+    if (CPU_COUNT(&set) > 0)
+        sched_setaffinity(0, sizeof(set), &set);
+
+    while (!__atomic_load_n(&flusher_stop, __ATOMIC_ACQUIRE)) {
+        drain_buffers();
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+/*
+ * tsc_trace_start: Opens trace file and starts background flushing thread.
+ *                  nrecords is capacity of per-thread buffers (power of 2,
+ *                  0 for default). Returns 0 on success.
+ */
+int tsc_trace_start(const char *path, uint64_t nrecords)
+{
+    if (trace_file != NULL)
+        return -1;
+    if (nrecords != 0) {
+        /* Size of EVENTS block (uint32_t) must hold the whole buffer */
+        if ((nrecords & (nrecords - 1)) || nrecords > TSC_TRACE_NRECORDS_MAX)
+            return -1;
+        buffer_nrecords = nrecords;
+    }
+    if ( (trace_file = fopen(path, "wb")) == NULL)
+        return -1;
+
+    tsc_trace_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TSC_TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TSC_TRACE_VERSION;
+    hdr.pid = (uint32_t)getpid();
+    hdr.tsc_hz = measure_tsc_frequency(100);
+    hdr.tsc_start = rdtsc();
+    fwrite(&hdr, sizeof(hdr), 1, trace_file);
+
+    nregions_written = 0;
+    flusher_stop = 0;
+    traced_cpu = sched_getcpu();
+
+    pthread_attr_t attr;
+    struct sched_param param = {.sched_priority = 0};
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+    pthread_attr_setschedparam(&attr, &param);
+    int rc = pthread_create(&flusher, &attr, flusher_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        fclose(trace_file);
+        trace_file = NULL;
+        return -1;
+    }
+    __atomic_store_n(&tsc_trace_enabled, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* tsc_trace_stop: Stops flushing thread, drains buffers and closes trace file. */
+void tsc_trace_stop()
+{
+    if (trace_file == NULL)
+        return;
+
+    __atomic_store_n(&tsc_trace_enabled, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&flusher_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+    drain_buffers();
+
+    pthread_mutex_lock(&buffers_lock);
+    for (tsc_trace_buffer_t *buf = buffers; buf != NULL; buf = buf->next)
+        write_dropped(buf);
+    pthread_mutex_unlock(&buffers_lock);
+    fclose(trace_file);
+    trace_file = NULL;
+}
@@ -0,0 +1,175 @@
+/*
+ * tsc_trace.h: Per-thread TSC event tracing.
+ *
+ * Every thread writes events into its own single-producer/single-consumer
+ * ring buffer; background thread drains buffers to the binary trace file
+ * (see tsctrace2json.c for conversion to Chrome trace JSON).
+ *
+ * Usage:
+ *     tsc_trace_start("app.trace", 0);
+ *     uint32_t id = tsc_trace_region("parse");
+ *     tsc_trace_begin(id);
+ *     ... traced code ...
+ *     tsc_trace_end(id);
+ *     tsc_trace_stop();
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef TSC_TRACE_H
+#define TSC_TRACE_H
+
+#include <inttypes.h>
+#include "tsc_x86.h"
+
+#define TSC_TRACE_REGIONS_MAX 1024
+#define TSC_TRACE_REGION_OVERFLOW UINT32_MAX     /* Id of regions over the limit */
+#define TSC_TRACE_REGION_NAME_MAX 64
+#define TSC_TRACE_NRECORDS_DEFAULT (1 << 16)
+#define TSC_TRACE_NRECORDS_MAX (1 << 27)        /* Events of a buffer fit into one block */
+
+/*
+ * Trace file: header followed by blocks (block header + payload).
+ * All values are in the byte order of the host.
+ */
+#define TSC_TRACE_MAGIC "TSCTRACE"
+#define TSC_TRACE_VERSION 1
+
+enum {
+    TSC_TRACE_BEGIN = 0,
+    TSC_TRACE_END = 1,
+    TSC_TRACE_INSTANT = 2
+};
+
+enum {
+    TSC_TRACE_BLOCK_REGION = 1,     /* Payload: tsc_trace_region_rec_t */
+    TSC_TRACE_BLOCK_EVENTS = 2,     /* Payload: uint32_t tid, tsc_trace_rec_t[] */
+    TSC_TRACE_BLOCK_DROPPED = 3     /* Payload: uint32_t tid, uint64_t ndropped */
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    double tsc_hz;
+    uint64_t tsc_start;
+} tsc_trace_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;                  /* Size of payload in bytes */
+} tsc_trace_block_t;
+
+typedef struct {
+    uint32_t id;
+    char name[TSC_TRACE_REGION_NAME_MAX];
+} tsc_trace_region_rec_t;
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t region;
+    uint32_t type;
+} tsc_trace_rec_t;
+
+/* Ring buffer of one thread: head is written by producer, tail by consumer */
+typedef struct tsc_trace_buffer {
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail_cache;            /* Last observed tail (producer only) */
+    uint64_t ndropped;
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t mask;
+    uint32_t tid;
+    int exited;                     /* Thread exited: buffer is freed when drained */
+    struct tsc_trace_buffer *next;
+    tsc_trace_rec_t *records;
+} tsc_trace_buffer_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int tsc_trace_enabled;
+extern __thread tsc_trace_buffer_t *tsc_trace_self;
+
+/*
+ * tsc_trace_start: Opens trace file and starts background flushing thread.
+ *                  nrecords is capacity of per-thread buffers (power of 2
+ *                  up to TSC_TRACE_NRECORDS_MAX, 0 for default). Returns 0
+ *                  on success.
+ */
+int tsc_trace_start(const char *path, uint64_t nrecords);
+
+/* tsc_trace_stop: Stops flushing thread, drains buffers and closes trace file. */
+void tsc_trace_stop();
+
+/*
+ * tsc_trace_region: Returns id of the region with given name (registers new
+ *                   region). Returns TSC_TRACE_REGION_OVERFLOW if limit of
+ *                   regions is exceeded: events of the id are dropped.
+ */
+uint32_t tsc_trace_region(const char *name);
+
+/* tsc_trace_regions_overflowed: Returns number of registrations rejected by the limit. */
+uint32_t tsc_trace_regions_overflowed();
+
+/* tsc_trace_buffer_create: Creates ring buffer for calling thread. */
+tsc_trace_buffer_t *tsc_trace_buffer_create();
+
+/* tsc_trace_dropped: Returns total number of events lost on buffer overflow. */
+uint64_t tsc_trace_dropped();
+
+/*
+ * tsc_trace_event: Writes event into the buffer of calling thread.
+ *                  Event is dropped if buffer is full or region is
+ *                  TSC_TRACE_REGION_OVERFLOW.
+ */
+static inline void tsc_trace_event(uint32_t region, uint32_t type)
+{
+    if (__builtin_expect(!tsc_trace_enabled, 0))
+        return;
+
+    tsc_trace_buffer_t *buf = tsc_trace_self;
+    if (__builtin_expect(buf == NULL, 0)) {
+        if ( (buf = tsc_trace_buffer_create()) == NULL)
+            return;
+    }
+
+    if (__builtin_expect(region == TSC_TRACE_REGION_OVERFLOW, 0)) {
+        buf->ndropped++;
+        return;
+    }
+    uint64_t head = buf->head;
+    if (__builtin_expect(head - buf->tail_cache > buf->mask, 0)) {
+        buf->tail_cache = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+        if (head - buf->tail_cache > buf->mask) {
+            buf->ndropped++;
+            return;
+        }
+    }
+    tsc_trace_rec_t *rec = &buf->records[head & buf->mask];
+    rec->tsc = rdtsc();
+    rec->region = region;
+    rec->type = type;
+    __atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static inline void tsc_trace_begin(uint32_t region)
+{
+    tsc_trace_event(region, TSC_TRACE_BEGIN);
+}
+
+static inline void tsc_trace_end(uint32_t region)
+{
+    tsc_trace_event(region, TSC_TRACE_END);
+}
+
+static inline void tsc_trace_instant(uint32_t region)
+{
+    tsc_trace_event(region, TSC_TRACE_INSTANT);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSC_TRACE_H */
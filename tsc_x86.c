@@ -3,7 +3,9 @@
  *
  * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
  */
- 
+
+#define _GNU_SOURCE
+#include <time.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include "tsc_x86.h"
@@ -150,6 +152,81 @@ uint64_t measure_tsc_overhead_rse()
     return overhead;
 }
 
+/*
+ * DEFINE_OVERHEAD_FUNCS: Defines overhead_min_<method>() and
+ * overhead_stat_<method>() -- measurement loops of measure_tsc_overhead() and
+ * measure_tsc_overhead_rse() instantiated for the pair of read functions
+ * (reads are inlined as in the measured code).
+ */
+#define DEFINE_OVERHEAD_FUNCS(method, before, after)                                \
+static uint64_t overhead_min_##method()                                             \
+{                                                                                   \
+    volatile uint64_t t0, t1, minticks = (uint64_t)~0x1;                            \
+    for (int i = 0; i < 100; ) {                                                    \
+        t0 = before();                                                              \
+        t1 = after();                                                               \
+        if (t1 > t0) {                                                              \
+            if (t1 - t0 < minticks)                                                 \
+                minticks = t1 - t0;                                                 \
+            i++;                                                                    \
+        }                                                                           \
+    }                                                                               \
+    return minticks;                                                                \
+}                                                                                   \
+                                                                                    \
+static int overhead_stat_##method(stat_sample_t *stat)                              \
+{                                                                                   \
+    enum {                                                                          \
+        NRUNS_MIN = 100,                                                            \
+        NRUNS_MAX = 1000000                                                         \
+    };                                                                              \
+    volatile uint64_t t0, t1;                                                       \
+    int nrejects = 0;                                                               \
+                                                                                    \
+    for (int i = 0; i < 10; i++) {                                                  \
+        t0 = before();                                                              \
+        t1 = after();                                                               \
+    }                                                                               \
+    int nruns = NRUNS_MIN;                                                          \
+    do {                                                                            \
+        stat_sample_clean(stat);                                                    \
+        for (int i = 0; i < nruns; ) {                                              \
+            t0 = before();                                                          \
+            t1 = after();                                                           \
+            if (t1 > t0) {                                                          \
+                stat_sample_add(stat, (double)(t1 - t0));                           \
+                i++;                                                                \
+            } else {                                                                \
+                nrejects++;                                                         \
+            }                                                                       \
+        }                                                                           \
+        nruns *= 4;                                                                 \
+    } while (stat_sample_size(stat) < NRUNS_MAX &&                                  \
+             stat_sample_rel_stderr_knuth(stat) > RSE_MAX);                         \
+    return nrejects;                                                                \
+}
+
+DEFINE_OVERHEAD_FUNCS(std, read_tsc_before_std, read_tsc_after_std)
+DEFINE_OVERHEAD_FUNCS(intel, read_tsc_before_intel, read_tsc_after_intel)
+DEFINE_OVERHEAD_FUNCS(lfence, read_tsc_before_lfence, read_tsc_after_lfence)
+DEFINE_OVERHEAD_FUNCS(mfence, read_tsc_before_mfence, read_tsc_after_mfence)
+DEFINE_OVERHEAD_FUNCS(cpuid4, read_tsc_cpuid2, read_tsc_cpuid2)
+DEFINE_OVERHEAD_FUNCS(lfence2, read_tsc_lfence2, read_tsc_lfence2)
+DEFINE_OVERHEAD_FUNCS(rdtscp, read_tsc_rdtscp_lfence, read_tsc_rdtscp_lfence)
+DEFINE_OVERHEAD_FUNCS(mfence_lfence, read_tsc_mfence_lfence, read_tsc_mfence_lfence)
+
+const tsc_read_method_t tsc_read_methods[] = {
+    {"std", 0, overhead_min_std, overhead_stat_std},
+    {"intel", 1, overhead_min_intel, overhead_stat_intel},
+    {"lfence", 0, overhead_min_lfence, overhead_stat_lfence},
+    {"mfence", 0, overhead_min_mfence, overhead_stat_mfence},
+    {"cpuid4", 0, overhead_min_cpuid4, overhead_stat_cpuid4},
+    {"lfence2", 0, overhead_min_lfence2, overhead_stat_lfence2},
+    {"rdtscp", 1, overhead_min_rdtscp, overhead_stat_rdtscp},
+    {"mfence_lfence", 0, overhead_min_mfence_lfence, overhead_stat_mfence_lfence},
+    {NULL, 0, NULL, NULL}
+};
+
 /*
  * normolize_ticks: Returns number of ticks between 2 reads of TSC (first & second)
  *                  minus overhead of TSC reading.
@@ -160,3 +237,42 @@ uint64_t normolize_ticks(uint64_t first, uint64_t second, uint64_t tsc_overhead)
         return (second - first) > tsc_overhead ? second - first - tsc_overhead : 0;
     return 0;
 }
+
+/*
+ * measure_tsc_frequency: Estimates TSC frequency (Hz) by comparing TSC with
+ *                        CLOCK_MONOTONIC_RAW over the interval of msec.
+ */
+double measure_tsc_frequency(int msec)
+{
+    struct timespec ts0, ts1;
+    uint64_t t0, t1;
+    double elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts0);
+    t0 = rdtsc();
+    do {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts1);
+        elapsed = (ts1.tv_sec - ts0.tv_sec) + (ts1.tv_nsec - ts0.tv_nsec) * 1E-9;
+    } while (elapsed < msec * 1E-3);
+    t1 = rdtsc();
+    return (double)(t1 - t0) / elapsed;
+}
+
+static double tsc_hz_calibrated = 0.0;
+
+/*
+ * tsc_frequency: Returns TSC frequency (Hz) given by set_tsc_frequency() or
+ *                measured once by measure_tsc_frequency(100).
+ */
+double tsc_frequency()
+{
+    if (tsc_hz_calibrated <= 0.0)
+        tsc_hz_calibrated = measure_tsc_frequency(100);
+    return tsc_hz_calibrated;
+}
+
+/* set_tsc_frequency: Sets calibrated TSC frequency (e.g. from calibration cache). */
+void set_tsc_frequency(double hz)
+{
+    tsc_hz_calibrated = hz;
+}
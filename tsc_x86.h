@@ -8,22 +8,40 @@
 #define TSC_X86_H
 
 #include <inttypes.h>
+#include "mathstat.h"
 
 #define TSC_READ_METHOD_STD
 
 #if defined(TSC_READ_METHOD_INTEL)
+    #define TSC_READ_METHOD_NAME "intel"
     #define read_tsc_before read_tsc_before_intel
     #define read_tsc_after read_tsc_after_intel
 #elif defined(TSC_READ_METHOD_LFENCE)
+    #define TSC_READ_METHOD_NAME "lfence"
     #define read_tsc_before read_tsc_before_lfence
     #define read_tsc_after read_tsc_after_lfence
 #elif defined(TSC_READ_METHOD_MFENCE)
+    #define TSC_READ_METHOD_NAME "mfence"
     #define read_tsc_before read_tsc_before_mfence
     #define read_tsc_after read_tsc_after_mfence
 #elif defined(TSC_READ_METHOD_CPUID4)
+    #define TSC_READ_METHOD_NAME "cpuid4"
     #define read_tsc_before read_tsc_cpuid2
     #define read_tsc_after read_tsc_cpuid2
+#elif defined(TSC_READ_METHOD_LFENCE2)
+    #define TSC_READ_METHOD_NAME "lfence2"
+    #define read_tsc_before read_tsc_lfence2
+    #define read_tsc_after read_tsc_lfence2
+#elif defined(TSC_READ_METHOD_RDTSCP)
+    #define TSC_READ_METHOD_NAME "rdtscp"
+    #define read_tsc_before read_tsc_rdtscp_lfence
+    #define read_tsc_after read_tsc_rdtscp_lfence
+#elif defined(TSC_READ_METHOD_MFENCE_LFENCE)
+    #define TSC_READ_METHOD_NAME "mfence_lfence"
+    #define read_tsc_before read_tsc_mfence_lfence
+    #define read_tsc_after read_tsc_mfence_lfence
 #else /* STD */
+    #define TSC_READ_METHOD_NAME "std"
     #define read_tsc_before read_tsc_before_std 
     #define read_tsc_after read_tsc_after_std 
 #endif
@@ -56,6 +74,35 @@ uint64_t measure_tsc_overhead_stabilized();
 /* measure_tsc_overhead_rse: Measures overhead with given precision (RSE) */
 uint64_t measure_tsc_overhead_rse();
 
+/* Read methods available at runtime (for comparison of overheads) */
+typedef struct {
+    const char *name;
+    int need_rdtscp;                 /* Method uses RDTSCP instruction */
+    uint64_t (*overhead)();          /* Same as measure_tsc_overhead() */
+    /*
+     * Collects statistic of overhead with given precision (RSE), returns
+     * number of rejected measurements (second TSC value <= first one).
+     */
+    int (*overhead_stat)(stat_sample_t *stat);
+} tsc_read_method_t;
+
+extern const tsc_read_method_t tsc_read_methods[];   /* Terminated by {NULL, ...} */
+
+/*
+ * measure_tsc_frequency: Estimates TSC frequency (Hz) by comparing TSC with
+ * CLOCK_MONOTONIC_RAW over the interval of msec.
+ */
+double measure_tsc_frequency(int msec);
+
+/*
+ * tsc_frequency: Returns TSC frequency (Hz) given by set_tsc_frequency() or
+ *                measured once by measure_tsc_frequency(100).
+ */
+double tsc_frequency();
+
+/* set_tsc_frequency: Sets calibrated TSC frequency (e.g. from calibration cache). */
+void set_tsc_frequency(double hz);
+
 /*
  * normolize_ticks: Returns number of ticks between 2 reads of TSC (first & second)
  * minus overhead of TSC reading.
@@ -65,13 +112,11 @@ uint64_t normolize_ticks(uint64_t first, uint64_t second, uint64_t tsc_overhead)
 /* rdtsc: Reads and returns TSC value by RDTSC instruction. */
 static inline uint64_t rdtsc()
 {
-    register uint32_t high, low;
+    uint32_t high, low;
     __asm__ __volatile__ (
-        "rdtsc\n"                     
-        "movl %%edx, %0\n"
-        "movl %%eax, %1\n"
-        : "=r" (high), "=r" (low)
-        :: "%rax", "%rbx", "%rcx", "%rdx"
+        "rdtsc\n"
+        : "=a" (low), "=d" (high)
+        :: "memory"
     );
     return ((uint64_t)high << 32) | low;
 }
@@ -79,14 +124,12 @@ static inline uint64_t rdtsc()
 /* rdtscp: Reads TSC value by RDTSCP instruction. */
 static inline uint64_t rdtscp()
 {
-    register uint32_t high, low;
+    uint32_t high, low;
     __asm__ __volatile__ (
-        "rdtscp\n" 
-        "movl %%edx, %0\n"
-        "movl %%eax, %1\n"
-        : "=r" (high), "=r" (low)
-        :: "%rax", "%rbx", "%rcx", "%rdx"
-    );    
+        "rdtscp\n"
+        : "=a" (low), "=d" (high)
+        :: "%rcx", "memory"              /* IA32_TSC_AUX */
+    );
     return ((uint64_t)high << 32) | low;
 }
 
@@ -96,58 +139,49 @@ static inline uint64_t rdtscp()
  */
 static inline uint64_t rdtscp_aux(uint32_t *tsc_aux)
 {
-    register uint32_t high, low;
+    uint32_t high, low;
     __asm__ __volatile__ (
-        "rdtscp\n" 
-        "movl %%edx, %0\n"
-        "movl %%eax, %1\n"
-        "movl %%ecx, %2\n"
-        : "=r" (high), "=r" (low), "=r" (*tsc_aux)
-        :: "%rax", "%rbx", "%rcx", "%rdx"
-    );    
+        "rdtscp\n"
+        : "=a" (low), "=d" (high), "=c" (*tsc_aux)
+        :: "memory"
+    );
     return ((uint64_t)high << 32) | low;
 }
 
 /* read_tsc_before_std: Standard approach (cpuid + rdtsc). */
 static inline uint64_t read_tsc_before_std()
 {
-    register uint32_t high, low;
+    uint32_t high, low;
     /* 
      * 1. Prevent out-of-order execution (serializing by CPUID(0)):
      *    wait for the completion of all previous operations (before measured code)
      * 2. Read TSC value
      */
     __asm__ __volatile__ (
-        "xorl %%eax, %%eax\n"
         "cpuid\n"                        /* Serialize execution */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"               /*   - high 32 bits */
-        "movl %%eax, %1\n"               /*   - low 32 bits */
-        : "=r" (high), "=r" (low)        /* Output */
-        :                                /* Input */ 
-        : "%rax", "%rbx", "%rcx", "%rdx" /* Clobbered registers */       
-    );    
+        : "=a" (low), "=d" (high)        /* Output */
+        : "a" (0)                        /* Input: CPUID(0) */
+        : "%rbx", "%rcx", "memory"       /* Clobbered registers, compiler barrier */
+    );
     return ((uint64_t)high << 32) | low;
 }
 
 /* read_tsc_after_std: Standard approach (cpuid + rdtsc). */
 static inline uint64_t read_tsc_after_std()
 {
-    register uint32_t high, low;
+    uint32_t high, low;
     /*
      * 1. Serialize by CPUID(0): wait for the completion of all operations in measured block
      * 2. Read TSC value
      */     
     __asm__ __volatile__ (
-        "xorl %%eax, %%eax\n"
         "cpuid\n"                        /* Serialize: wait for all prev. ops */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"               /*   - high 32 bits */
-        "movl %%eax, %1\n"               /*   - low 32 bits */
-        : "=r" (high), "=r" (low)        /* Output */
-        :                                /* Input */
-        : "%rax", "%rbx", "%rcx", "%rdx" /* Clobbered registers */         
-    );    
+        : "=a" (low), "=d" (high)        /* Output */
+        : "a" (0)                        /* Input: CPUID(0) */
+        : "%rbx", "%rcx", "memory"       /* Clobbered registers, compiler barrier */
+    );
     return ((uint64_t)high << 32) | low;
 }
 
@@ -158,17 +192,14 @@ static inline uint64_t read_tsc_after_std()
  */
 static inline uint64_t read_tsc_before_intel()
 {
-    register uint32_t high, low;     
+    uint32_t high, low;     
     __asm__ __volatile__ (
-        "xorl %%eax, %%eax\n"
         "cpuid\n"                        /* Serialize execution */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"               /*   - high 32 bits */
-        "movl %%eax, %1\n"               /*   - low 32 bits */
-        : "=r" (high), "=r" (low)        /* Output */
-        :                                /* Input */ 
-        : "%rax", "%rbx", "%rcx", "%rdx" /* Clobbered registers */       
-    );    
+        : "=a" (low), "=d" (high)        /* Output */
+        : "a" (0)                        /* Input: CPUID(0) */
+        : "%rbx", "%rcx", "memory"       /* Clobbered registers, compiler barrier */
+    );
     return ((uint64_t)high << 32) | low;
 }
 
@@ -179,102 +210,148 @@ static inline uint64_t read_tsc_before_intel()
  */
 static inline uint64_t read_tsc_after_intel()
 {
-    register uint32_t high, low;
+    uint32_t high, low, aux, eax = 0;
     __asm__ __volatile__ (
         "rdtscp\n"                       /* Wait for all prev. ops & read TSC */
-        "movl %%edx, %0\n"               
-        "movl %%eax, %1\n"              
-        "xorl %%eax, %%eax\n"
+        : "=a" (low), "=d" (high), "=c" (aux)
+        :: "memory"
+    );
+    __asm__ __volatile__ (
         "cpuid\n"                        /* Barrier */
-        : "=r" (high), "=r" (low)
-        :: "%rax", "%rbx", "%rcx", "%rdx"
-    );    
+        : "+a" (eax)
+        :: "%rbx", "%rcx", "%rdx", "memory"
+    );
     return ((uint64_t)high << 32) | low;
 }
 
 /* read_tsc_before_lfence: */
 static inline uint64_t read_tsc_before_lfence()
 {
-    register uint32_t high, low;     
+    uint32_t high, low;     
     __asm__ __volatile__ (
-        "xorl %%eax, %%eax\n"
         "cpuid\n"                        /* Serialize execution */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"               /*   - high 32 bits */
-        "movl %%eax, %1\n"               /*   - low 32 bits */
-        : "=r" (high), "=r" (low)        /* Output */
-        :                                /* Input */ 
-        : "%rax", "%rbx", "%rcx", "%rdx" /* Clobbered registers */       
-    );    
+        : "=a" (low), "=d" (high)        /* Output */
+        : "a" (0)                        /* Input: CPUID(0) */
+        : "%rbx", "%rcx", "memory"       /* Clobbered registers, compiler barrier */
+    );
     return ((uint64_t)high << 32) | low;
 }
 
 /* read_tsc_after_lfence: lfence + rdtsc + cpuid. */
 static inline uint64_t read_tsc_after_lfence()
 {
-    register uint32_t high, low;
+    uint32_t high, low, eax = 0;
     __asm__ __volatile__ (
         "lfence\n"                       /* Wait for all prev. LOAD ops. */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"               
-        "movl %%eax, %1\n"              
-        "xorl %%eax, %%eax\n"
+        : "=a" (low), "=d" (high)
+        :: "memory"
+    );
+    __asm__ __volatile__ (
         "cpuid\n"                        /* Barrier */
-        : "=r" (high), "=r" (low)
-        :: "%rax", "%rbx", "%rcx", "%rdx"
-    );    
+        : "+a" (eax)
+        :: "%rbx", "%rcx", "%rdx", "memory"
+    );
     return ((uint64_t)high << 32) | low;
 }
 
 /* read_tsc_before_mfence: */
 static inline uint64_t read_tsc_before_mfence()
 {
-    register uint32_t high, low;     
+    uint32_t high, low;     
     __asm__ __volatile__ (
-        "xorl %%eax, %%eax\n"
         "cpuid\n"                        /* Serialize execution */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"               /*   - high 32 bits */
-        "movl %%eax, %1\n"               /*   - low 32 bits */
-        : "=r" (high), "=r" (low)        /* Output */
-        :                                /* Input */ 
-        : "%rax", "%rbx", "%rcx", "%rdx" /* Clobbered registers */       
-    );    
+        : "=a" (low), "=d" (high)        /* Output */
+        : "a" (0)                        /* Input: CPUID(0) */
+        : "%rbx", "%rcx", "memory"       /* Clobbered registers, compiler barrier */
+    );
     return ((uint64_t)high << 32) | low;
 }
 
 /* read_tsc_after_mfence: cpuid + rdtsc + mfence. */
 static inline uint64_t read_tsc_after_mfence()
 {
-    register uint32_t high, low;
+    uint32_t high, low;
     __asm__ __volatile__ (
-        "xorl %%eax, %%eax\n"
         "cpuid\n"                        /* Serialize: wait for all prev. ops */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"
-        "movl %%eax, %1\n"
         "mfence\n"                       /* Wait for all prev. LOAD & STORE ops. */
-        : "=r" (high), "=r" (low)        
-        :: "%rax", "%rbx", "%rcx", "%rdx" 
-    );    
+        : "=a" (low), "=d" (high)
+        : "a" (0)
+        : "%rbx", "%rcx", "memory"
+    );
     return ((uint64_t)high << 32) | low;
 }
 
 /* read_tsc_cpuid2: cpuid + rdtsc + cpuid. */
 static inline uint64_t read_tsc_cpuid2()
 {
-    register uint32_t high, low;
+    uint32_t high, low, eax = 0;
     __asm__ __volatile__ (
-        "xorl %%eax, %%eax\n"
         "cpuid\n"                        /* Serialize execution */
         "rdtsc\n"                        /* Read TSC */
-        "movl %%edx, %0\n"
-        "movl %%eax, %1\n"
-        "xorl %%eax, %%eax\n"
+        : "=a" (low), "=d" (high)
+        : "a" (0)
+        : "%rbx", "%rcx", "memory"
+    );
+    __asm__ __volatile__ (
         "cpuid\n"                        /* Serialize execution */
-        : "=r" (high), "=r" (low)        
-        :: "%rax", "%rbx", "%rcx", "%rdx"
-    );    
+        : "+a" (eax)
+        :: "%rbx", "%rcx", "%rdx", "memory"
+    );
+    return ((uint64_t)high << 32) | low;
+}
+
+/*
+ * read_tsc_lfence2: lfence + rdtsc + lfence (Intel SDM, Vol. 3B, 17.17):
+ * first LFENCE waits for completion of all previous instructions,
+ * second one prevents later instructions from starting before RDTSC.
+ */
+static inline uint64_t read_tsc_lfence2()
+{
+    uint32_t high, low;
+    __asm__ __volatile__ (
+        "lfence\n"
+        "rdtsc\n"
+        "lfence\n"
+        : "=a" (low), "=d" (high)
+        :: "memory"
+    );
+    return ((uint64_t)high << 32) | low;
+}
+
+/*
+ * read_tsc_rdtscp_lfence: rdtscp + lfence. RDTSCP waits for completion
+ * of all previous instructions, LFENCE holds back later instructions.
+ */
+static inline uint64_t read_tsc_rdtscp_lfence()
+{
+    uint32_t high, low;
+    __asm__ __volatile__ (
+        "rdtscp\n"
+        "lfence\n"
+        : "=a" (low), "=d" (high)
+        :: "%rcx", "memory"              /* IA32_TSC_AUX */
+    );
+    return ((uint64_t)high << 32) | low;
+}
+
+/*
+ * read_tsc_mfence_lfence: mfence + lfence + rdtsc (AMD guidance: LFENCE is
+ * dispatch serializing only if enabled by MSR, MFENCE is serializing).
+ */
+static inline uint64_t read_tsc_mfence_lfence()
+{
+    uint32_t high, low;
+    __asm__ __volatile__ (
+        "mfence\n"
+        "lfence\n"
+        "rdtsc\n"
+        : "=a" (low), "=d" (high)
+        :: "memory"
+    );
     return ((uint64_t)high << 32) | low;
 }
 
@@ -3,7 +3,8 @@
  *
  * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
  */
- 
+
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -21,134 +22,1828 @@
 #include "tsc_x86.h"
 #include "mathstat.h"
 #include "measured_code.h"
+#include "code_align.h"
+#include "tscbench.h"
+#include "tsc_trace.h"
+#include "tsc_hist.h"
+#include "tsc_autotune.h"
+#include "calib_cache.h"
+#include "rapl.h"
+#include "freq_monitor.h"
+#include "ctx_monitor.h"
+#include "tick_align.h"
+#include "preflight.h"
+#include "kernel_measure.h"
+#include "numa_mem.h"
+#include "page_alloc.h"
+#include "results_store.h"
+#include "modality.h"
+#include "throughput.h"
+#include "instr_bench.h"
+#include "cold_trial.h"
+#include "membw.h"
+#include "coherence.h"
+#include "clock_backend.h"
+#include "interference.h"
+#include "campaign.h"
+
+#define STRINGIFY(x) #x
+#define CODE_NAME(code) STRINGIFY(code)
+
+/* Environment checks and isolation applied by prepare_system_for_benchmarking */
+static preflight_t preflight = {.cpu = -1, .dma_latency_fd = -1};
+
+/* Monitors attached to batches of measurements (NULL if disabled) */
+typedef struct {
+    freq_monitor_t *freq;
+    ctx_monitor_t *ctx;
+    tick_align_t *tick;
+    rapl_t *rapl;
+} batch_monitors_t;
+
+static void batch_begin(batch_monitors_t *mon)
+{
+    if (mon->freq)
+        freq_monitor_batch_begin(mon->freq);
+    if (mon->ctx)
+        ctx_monitor_batch_begin(mon->ctx);
+    if (mon->rapl)
+        rapl_batch_begin(mon->rapl);
+}
+
+static void batch_end(batch_monitors_t *mon, int nruns)
+{
+    if (mon->rapl)
+        rapl_batch_end(mon->rapl, nruns);
+    if (mon->ctx)
+        ctx_monitor_batch_end(mon->ctx, nruns);
+    if (mon->freq)
+        freq_monitor_batch_end(mon->freq, nruns);
+}
+
+/* sample_begin: Prepares the next sample (before the measurement). */
+static inline void sample_begin(batch_monitors_t *mon)
+{
+    if (mon->tick)
+        tick_align_before(mon->tick);
+}
+
+/* sample_rejected: Returns 1 if sample [t0, t1] is rejected by monitors. */
+static inline int sample_rejected(batch_monitors_t *mon, uint64_t t0, uint64_t t1, double ticks)
+{
+    return mon->tick ? tick_align_after(mon->tick, t0, t1, ticks) : 0;
+}
+
+/* batch_sample: Passes accepted sample to monitors (after the measurement). */
+static inline void batch_sample(batch_monitors_t *mon, double ticks)
+{
+    if (mon->ctx)
+        ctx_monitor_sample(mon->ctx, ticks);
+}
 
 /*
-static int pm_qos_fd = -1;
-*/
+ * DEFINE_MEASURE_CODE: Defines measure_code_<method>() -- measurement loop
+ * of CODE() for the pair of read functions. Fills stat with given precision
+ * (RSE) and returns execution time of the first run. Monitors are called
+ * at the bounds of every batch (outside of measured intervals).
+ */
+#define DEFINE_MEASURE_CODE(method, before, after)                                  \
+static uint64_t measure_code_##method(stat_sample_t *stat, uint64_t overhead,       \
+                                      batch_monitors_t *mon)                        \
+{                                                                                   \
+    enum {                                                                          \
+        NRUNS_MIN = 100,                                                            \
+        NRUNS_MAX = 1000000                                                         \
+    };                                                                              \
+                                                                                    \
+    /* Warmup code (first run) */                                               \
+    volatile uint64_t t0 = before();                                                \
+    CODE();                                                                         \
+    volatile uint64_t t1 = after();                                                 \
+    uint64_t firstrun = normolize_ticks(t0, t1, overhead);                          \
+                                                                                    \
+    int nruns = NRUNS_MIN;                                                          \
+    do {                                                                            \
+        stat_sample_clean(stat);                                                    \
+        batch_begin(mon);                                                           \
+        for (int i = 0; i < nruns; ) {                                              \
+            sample_begin(mon);                                                      \
+            t0 = before();                                                          \
+            CODE();                                                                 \
+            t1 = after();                                                           \
+            /* Accumulate only correct results */                                   \
+            if (t1 > t0) {                                                          \
+                if (t1 - t0 > overhead &&                                           \
+                    !sample_rejected(mon, t0, t1, (double)(t1 - t0 - overhead)))    \
+                {                                                                   \
+                    stat_sample_add(stat, (double)(t1 - t0 - overhead));            \
+                    batch_sample(mon, (double)(t1 - t0 - overhead));                \
+                    i++;                                                            \
+                }                                                                   \
+            }                                                                       \
+        }                                                                           \
+        batch_end(mon, nruns);                                                      \
+        /*                                                                          \
+         * Reduce measurement error by increasing number of runs                   \
+         * StdErr = StdDev / sqrt(n)                                                \
+         */                                                                         \
+        nruns *= 4;                                                                 \
+    } while (stat_sample_size(stat) < NRUNS_MAX &&                                  \
+             stat_sample_rel_stderr_knuth(stat) > RSE_MAX);                         \
+    return firstrun;                                                                \
+}
+
+#define RSE_MAX 5.0
+
+DEFINE_MEASURE_CODE(std, read_tsc_before_std, read_tsc_after_std)
+DEFINE_MEASURE_CODE(intel, read_tsc_before_intel, read_tsc_after_intel)
+DEFINE_MEASURE_CODE(lfence, read_tsc_before_lfence, read_tsc_after_lfence)
+DEFINE_MEASURE_CODE(mfence, read_tsc_before_mfence, read_tsc_after_mfence)
+DEFINE_MEASURE_CODE(cpuid4, read_tsc_cpuid2, read_tsc_cpuid2)
+DEFINE_MEASURE_CODE(lfence2, read_tsc_lfence2, read_tsc_lfence2)
+DEFINE_MEASURE_CODE(rdtscp, read_tsc_rdtscp_lfence, read_tsc_rdtscp_lfence)
+DEFINE_MEASURE_CODE(mfence_lfence, read_tsc_mfence_lfence, read_tsc_mfence_lfence)
+
+/* Measurement loops of CODE() for read methods (same order as tsc_read_methods) */
+static const struct {
+    const char *name;
+    uint64_t (*measure_code)(stat_sample_t *stat, uint64_t overhead, batch_monitors_t *mon);
+} code_methods[] = {
+    {"std", measure_code_std},
+    {"intel", measure_code_intel},
+    {"lfence", measure_code_lfence},
+    {"mfence", measure_code_mfence},
+    {"cpuid4", measure_code_cpuid4},
+    {"lfence2", measure_code_lfence2},
+    {"rdtscp", measure_code_rdtscp},
+    {"mfence_lfence", measure_code_mfence_lfence},
+    {NULL, NULL}
+};
+
+/* find_read_method: Returns index of read method in tsc_read_methods or -1. */
+static int find_read_method(const char *name)
+{
+    for (int i = 0; tsc_read_methods[i].name != NULL; i++) {
+        if (strcmp(tsc_read_methods[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+#define RAW_VALUES_MAX (1 << 20)
+#define MODE_WEIGHT_MIN 0.02
+
+/* write_raw_values: Writes values to file (one per line). Returns 0 on success. */
+static int write_raw_values(const char *path, const double *values, int n)
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+    fprintf(f, "# Raw execution time of CODE() (ticks), %d runs of the last batch\n", n);
+    for (int i = 0; i < n; i++)
+        fprintf(f, "%.0f\n", values[i]);
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* report_modes: Prints modes of the values. */
+static void report_modes(const double *values, int n, double min_weight)
+{
+    modality_mode_t modes[MODALITY_MODES_MAX];
+    double bandwidth;
+    int nmodes = modality_find(values, n, min_weight, modes, MODALITY_MODES_MAX, &bandwidth);
+    if (nmodes > 0)
+        modality_report(modes, nmodes, bandwidth, stdout);
+}
+
+/*
+ * run_benchmark: Runs measurements of CODE() execution time by given read method
+ *                with its overhead. Statistics are stored into rec (if not NULL),
+ *                raw values of the last batch are written to file raw (if not NULL).
+ */
+void run_benchmark(int method, uint64_t overhead, batch_monitors_t *mon,
+                   results_record_t *rec, const char *raw)
+{
+    stat_sample_t *stat = stat_sample_create();
+    if (stat == NULL) {
+        fprintf(stderr, "# No enough memory for statistics");
+        exit(1);
+    }
+    if (stat_sample_keep_values(stat, RAW_VALUES_MAX) != 0)
+        fprintf(stderr, "# [Warning!] No enough memory for raw values: modes are not analyzed\n");
+
+    uint64_t firstrun = code_methods[method].measure_code(stat, overhead, mon);
+    char applied[64];
+
+    printf("# Execution time statistic (ticks)\n");
+    printf("# TSC read method: %s\n", tsc_read_methods[method].name);
+    printf("# TSC overhead (ticks): %" PRIu64 "\n", overhead);
+    printf("# [Runs] [First run]        [Mean]             [StdDev]           [StdErr]           [RSE]    [Min]              [Max]              [CPU] [Score] [Applied]\n");
+    printf("  %-6d %-18" PRIu64" %-18.2f %-18.2f %-18.2f %-8.2f %-18.2f %-18.2f %-5d %-7d %s\n",
+           stat_sample_size(stat), firstrun, stat_sample_mean_knuth(stat),
+           stat_sample_stddev_knuth(stat), stat_sample_stderr_knuth(stat),
+           stat_sample_rel_stderr_knuth(stat), stat_sample_min(stat), stat_sample_max(stat),
+           preflight.cpu, preflight.score, preflight_applied_str(preflight.applied, applied, sizeof(applied)));
+
+    if (rec != NULL) {
+        rec->nruns = stat_sample_size(stat);
+        rec->mean = stat_sample_mean_knuth(stat);
+        rec->stddev = stat_sample_stddev_knuth(stat);
+        rec->min = stat_sample_min(stat);
+        rec->tsc_overhead = overhead;
+    }
+
+    int nvalues;
+    double *values = stat_sample_values(stat, &nvalues);
+    if (nvalues > 1)
+        report_modes(values, nvalues, MODE_WEIGHT_MIN);
+    if (raw != NULL && write_raw_values(raw, values, nvalues) != 0)
+        fprintf(stderr, "# [Warning!] Can't write raw values to %s\n", raw);
+    stat_sample_free(stat);
+}
+
+/*
+ * prepare_system_for_benchmarking: Checks environment of the CPU (cpu < 0 --
+ * current CPU) and applies isolation in process (see preflight.c). Exits
+ * if the given CPU is not online or the process can't be bound to it.
+ */
+void prepare_system_for_benchmarking(int cpu)
+{
+    if (preflight_check(&preflight, cpu) != 0 || preflight_apply(&preflight) < 0)
+        exit(1);
+    preflight_report(&preflight, stdout);
+}
+
+/*
+ * report_isolation: Prints measurement CPU, preflight score and applied
+ *                   settings before result rows (run records them per row).
+ */
+static void report_isolation()
+{
+    char applied[64];
+    printf("# Isolation: CPU %d, score %d, applied %s\n", preflight.cpu, preflight.score,
+           preflight_applied_str(preflight.applied, applied, sizeof(applied)));
+}
+
+/*
+ * select_read_method: Returns index of read method by name: "auto" selects
+ *                     method by calibration (see tsc_autotune.c).
+ */
+static int select_read_method(const char *name)
+{
+    if (strcmp(name, "auto") == 0) {
+        tsc_autotune_score_t scores[32];
+        int nscores;
+        int best = tsc_autotune(scores, 32, &nscores);
+        tsc_autotune_report(scores, nscores, best, stdout);
+        return best;
+    }
+
+    int method = find_read_method(name);
+    if (method < 0) {
+        fprintf(stderr, "# Error: unknown TSC read method '%s', available: auto", name);
+        for (int i = 0; tsc_read_methods[i].name != NULL; i++)
+            fprintf(stderr, " %s", tsc_read_methods[i].name);
+        fprintf(stderr, "\n");
+    } else if (tsc_read_methods[method].need_rdtscp && !is_rdtscp_available()) {
+        fprintf(stderr, "# Error: TSC read method '%s' needs RDTSCP\n", name);
+        method = -1;
+    }
+    return method;
+}
+
+/*
+ * select_mode_method: Selects read method of a mode by name (see
+ *                     select_read_method) and prints it with its overhead.
+ *                     Returns the method or NULL.
+ */
+static const tsc_read_method_t *select_mode_method(const char *name, uint64_t *overhead)
+{
+    int method = select_read_method(name);
+    if (method < 0)
+        return NULL;
+    *overhead = tsc_read_methods[method].overhead();
+    printf("# TSC read method: %s, overhead (ticks): %" PRIu64 "\n",
+           tsc_read_methods[method].name, *overhead);
+    return &tsc_read_methods[method];
+}
+
+/* run_main: Measures execution time of CODE() (default mode). */
+static int run_main(int argc, char **argv)
+{
+    const char *method_name = TSC_READ_METHOD_NAME;
+    double freq_threshold = -1.0;
+    int cpu = -1;
+    int pages = -1;
+    const char *store = NULL;
+    const char *raw = NULL;
+    const char *cache = NULL;
+    int noutliers = 0;
+    int tick_aligned = 0;
+    int energy = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "M:F:c:P:S:R:O:TC:E")) != -1) {
+        switch (opt) {
+        case 'E': energy = 1; break;
+        case 'C': cache = optarg; break;
+        case 'T': tick_aligned = 1; break;
+        case 'O': noutliers = atoi(optarg); break;
+        case 'R': raw = optarg; break;
+        case 'S': store = optarg; break;
+        case 'M': method_name = optarg; break;
+        case 'F': freq_threshold = atof(optarg); break;
+        case 'c': cpu = atoi(optarg); break;
+        case 'P':
+            if ( (pages = page_kind_parse(optarg)) < 0) {
+                fprintf(stderr, "# Error: unknown kind of pages '%s' (4k, thp, 2m, 1g)\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: tscbench [run] [-M method|auto] [-F freq_threshold%%] [-c cpu]"
+                            " [-P 4k|thp|2m|1g] [-S store] [-R raw] [-O outliers] [-T] [-C cache] [-E]\n");
+            return 1;
+        }
+    }
+
+    prepare_system_for_benchmarking(cpu);
+    int method;
+    uint64_t overhead;
+    if (cache != NULL) {
+        /* Calibration is taken from the cache if it passes re-verification */
+        calib_t calib;
+        method = -1;
+        if (strcmp(method_name, "auto") != 0 && (method = select_read_method(method_name)) < 0)
+            return 1;
+        if (calib_cache_calibrate(&calib, cache, method, preflight.cpu) != 0)
+            return 1;
+        calib_cache_report(&calib, stdout);
+        set_tsc_frequency(calib.entry.tsc_hz);
+        method = calib.method;
+        overhead = calib.entry.overhead;
+    } else {
+        if ( (method = select_read_method(method_name)) < 0)
+            return 1;
+        overhead = tsc_read_methods[method].overhead();
+    }
+
+    /* Arrays of kernels on requested pages (static arrays by default) */
+    page_buf_t buffers;
+    memset(&buffers, 0, sizeof(buffers));
+    if (pages >= 0) {
+        if (page_buf_alloc(&buffers, measured_code_buffers_size(), pages, -1) != 0) {
+            fprintf(stderr, "# Error allocating kernel buffers\n");
+            return 1;
+        }
+        measured_code_set_buffers(buffers.addr);
+        printf("# Kernel buffers: %zu KiB, pages %s (requested %s), huge pages %zu KiB\n",
+               buffers.size / 1024, page_kind_name(buffers.kind), page_kind_name(buffers.requested),
+               page_buf_huge_bytes(&buffers) / 1024);
+    }
+
+    batch_monitors_t mon;
+    memset(&mon, 0, sizeof(mon));
+    freq_monitor_t freq;
+    if (freq_threshold >= 0.0) {
+        if (freq_monitor_open(&freq, sched_getcpu(), NULL) == 0)
+            mon.freq = &freq;
+        else
+            fprintf(stderr, "# [Warning!] Frequency monitoring is not available"
+                            " (no access to /dev/cpu/N/msr and cpufreq)\n");
+    }
+    ctx_monitor_t ctx;
+    if (noutliers > 0) {
+        if (ctx_monitor_open(&ctx, sched_getcpu(), noutliers) == 0)
+            mon.ctx = &ctx;
+        else
+            fprintf(stderr, "# [Warning!] Number of outliers must be 1..%d\n", CTX_MONITOR_OUTLIERS_MAX);
+    }
+    tick_align_t tick;
+    if (tick_aligned) {
+        /* Without periodic interrupts samples are taken as usual */
+        tick_align_probe(&tick, 200);
+        mon.tick = &tick;
+    }
+    rapl_t rapl;
+    if (energy) {
+        if (rapl_open(&rapl, sched_getcpu(), NULL) == 0)
+            mon.rapl = &rapl;
+        else
+            fprintf(stderr, "# [Warning!] Energy accounting is not available"
+                            " (no access to powercap energy_uj and /dev/cpu/N/msr)\n");
+    }
+
+    /* Kernel on non-default pages is stored under the key of pages it got (fallback) */
+    char kernel[RESULTS_KERNEL_MAX];
+    snprintf(kernel, sizeof(kernel), "%s%s%s", CODE_NAME(CODE), pages >= 0 ? "@" : "",
+             pages >= 0 ? page_kind_name(buffers.kind) : "");
+    results_record_t rec;
+    results_record_init(&rec, kernel, tsc_read_methods[method].name);
+
+    run_benchmark(method, overhead, &mon, &rec, raw);
+
+    /* Result of a run with unstable frequency is not stored and fails */
+    int unstable = 0;
+    if (mon.freq) {
+        unstable = freq_monitor_report(mon.freq, freq_threshold, stdout);
+        freq_monitor_close(mon.freq);
+    }
+
+    if (store != NULL) {
+        if (unstable)
+            fprintf(stderr, "# [Warning!] Result is not stored into %s: frequency varied more than"
+                            " %.1f%% or throttling was detected\n", store, freq_threshold);
+        else if (results_store_append(store, &rec) != 0)
+            fprintf(stderr, "# [Warning!] Can't append result to store %s\n", store);
+        else
+            printf("# Result is stored into %s (host %016" PRIx64 ", build %016" PRIx64 ")\n",
+                   store, rec.host, rec.build);
+    }
+    if (mon.rapl) {
+        rapl_report(mon.rapl, stdout);
+        rapl_close(mon.rapl);
+    }
+    if (mon.ctx)
+        ctx_monitor_report(mon.ctx, rec.mean, stdout);
+    if (mon.tick) {
+        tick_align_report(mon.tick, stdout);
+        tick_align_free(mon.tick);
+    }
+    if (pages >= 0) {
+        measured_code_set_buffers(NULL);
+        page_buf_free(&buffers);
+    }
+    return unstable ? 2 : 0;
+}
+
+/* align_main: Measures relocatable kernel at a range of code offsets. */
+static int align_main(int argc, char **argv)
+{
+    enum { NRESULTS_MAX = 4096 };
+    const char *name = "sum";
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int first = 0, last = 64, step = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:f:l:s:M:")) != -1) {
+        switch (opt) {
+        case 'M': method_name = optarg; break;
+        case 'k': name = optarg; break;
+        case 'f': first = atoi(optarg); break;
+        case 'l': last = atoi(optarg); break;
+        case 's': step = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: tscbench align [-k kernel] [-f first] [-l last] [-s step] [-M method|auto]\n");
+            return 1;
+        }
+    }
+
+    const reloc_code_t *code = reloc_code_find(name);
+    if (code == NULL) {
+        fprintf(stderr, "# Error: unknown relocatable kernel '%s', available:", name);
+        for (int i = 0; reloc_codes[i].name != NULL; i++)
+            fprintf(stderr, " %s", reloc_codes[i].name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    code_align_result_t *results = malloc(sizeof(*results) * NRESULTS_MAX);
+    if (results == NULL) {
+        fprintf(stderr, "# No enough memory for results\n");
+        return 1;
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL) {
+        free(results);
+        return 1;
+    }
+    int nresults = code_align_sweep(code, method, first, last, step, results, NRESULTS_MAX);
+    if (nresults < 0) {
+        fprintf(stderr, "# Error: code alignment sweep failed\n");
+        free(results);
+        return 1;
+    }
+    code_align_report(code, results, nresults);
+    free(results);
+    return 0;
+}
+
+/* code_call: Calls CODE() by pointer for harnesses of kernels. */
+static void code_call(void *arg)
+{
+    CODE();
+}
+
+/* call_region: Empty libtscbench region (arg is the region). */
+static void call_region(void *arg)
+{
+    tscbench_region_end(arg, tscbench_region_begin());
+}
 
-/* start_low_latency: Prevents the processor from entering deep sleep states. */
 /*
-static void start_low_latency(void)
+ * region_main: Measures overhead of libtscbench region
+ *              (tscbench_region_begin + tscbench_region_end).
+ */
+static int region_main(int argc, char **argv)
 {
-    uint32_t target = 0;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int opt;
 
-    if (pm_qos_fd >= 0)
-        return;
-    pm_qos_fd = open("/dev/cpu_dma_latency", O_RDWR);
-    if (pm_qos_fd < 0) {
-        fprintf(stderr, "# Failed to open PM QOS file: %s", strerror(errno));
-        exit(errno);
+    while ((opt = getopt(argc, argv, "M:")) != -1) {
+        switch (opt) {
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench region [-M method|auto]\n");
+            return 1;
+        }
     }
-    write(pm_qos_fd, &target, sizeof(target));
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+
+    /* Warmup of kernel_measure allocates samples of the thread */
+    tscbench_region_t *region = tscbench_region("overhead");
+    kernel_result_t res;
+    if (kernel_measure(method, call_region, region, overhead, &res) != 0)
+        return 1;
+
+    printf("# Region overhead statistic (ticks)\n");
+    printf("# [Runs] [Mean]             [StdDev]           [StdErr]           [RSE]    [Min]              [Max]\n");
+    printf("  %-6d %-18.2f %-18.2f %-18.2f %-8.2f %-18.2f %-18.2f\n",
+           res.nruns, res.mean, res.stddev, res.rse * res.mean / 100.0, res.rse, res.min, res.max);
+
+    tscbench_report(stdout);
+    return 0;
 }
 
-static void stop_low_latency(void)
+/* call_trace_instant: Emits instant trace event (arg is the region id). */
+static void call_trace_instant(void *arg)
 {
-    if (pm_qos_fd >= 0)
-        close(pm_qos_fd);
+    tsc_trace_instant(*(uint32_t *)arg);
 }
-*/
 
-/* run_benchmark: Runs measurements of CODE() execution time. */
-void run_benchmark()
-{    
-    #define RSE_MAX 5.0
+/*
+ * trace_main: Measures cost of one trace event and writes trace
+ *             of CODE() runs.
+ */
+static int trace_main(int argc, char **argv)
+{
     enum {
-        NRUNS_MIN = 100,
-        NRUNS_MAX = 1000000
+        NTRACED = 100
     };
-    
-    /* Measure TSC overhead */
-    uint64_t overhead = measure_tsc_overhead();
+    const char *path = "tscbench.trace";
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int opt;
 
-    /* Warmup code (first run) */
-    volatile uint64_t t0 = read_tsc_before();
-    CODE();
-    volatile uint64_t t1 = read_tsc_after();
-    uint64_t firstrun = normolize_ticks(t0, t1, overhead);
+    while ((opt = getopt(argc, argv, "o:M:")) != -1) {
+        switch (opt) {
+        case 'o': path = optarg; break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench trace [-o trace] [-M method|auto]\n");
+            return 1;
+        }
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+
+    if (tsc_trace_start(path, 0) != 0) {
+        fprintf(stderr, "# Error: can't start tracing to %s\n", path);
+        return 1;
+    }
+    uint32_t event = tsc_trace_region("event");
+    uint32_t code = tsc_trace_region("CODE");
+
+    /* Warmup of kernel_measure allocates buffer of the thread */
+    kernel_result_t res;
+    if (kernel_measure(method, call_trace_instant, &event, overhead, &res) != 0) {
+        tsc_trace_stop();
+        return 1;
+    }
+
+    for (int i = 0; i < NTRACED; i++) {
+        tsc_trace_begin(code);
+        CODE();
+        tsc_trace_end(code);
+    }
+    tsc_trace_stop();
+
+    printf("# Trace event overhead statistic (ticks)\n");
+    printf("# [Runs] [Mean]             [StdDev]           [StdErr]           [RSE]    [Min]              [Max]\n");
+    printf("  %-6d %-18.2f %-18.2f %-18.2f %-8.2f %-18.2f %-18.2f\n",
+           res.nruns, res.mean, res.stddev, res.rse * res.mean / 100.0, res.rse, res.min, res.max);
+    printf("# Trace: %s (%d runs of CODE), dropped events: %" PRIu64 ", regions over limit: %" PRIu32 "\n",
+           path, NTRACED, tsc_trace_dropped(), tsc_trace_regions_overflowed());
+    return 0;
+}
+
+/* call_hist_record: Records varying value to histogram (arg is the shard). */
+static void call_hist_record(void *arg)
+{
+    static uint64_t value = 0;
+    tsc_hist_record(arg, value++ * 2654435761u & 0xFFFF);
+}
+
+/* hist_sample: Records time of a run to histogram (ctx is the shard). */
+static void hist_sample(void *ctx, uint64_t ticks)
+{
+    tsc_hist_record(ctx, ticks);
+}
+
+/*
+ * hist_main: Measures cost of histogram recording and prints
+ *            percentiles of CODE() execution time.
+ */
+static int hist_main(int argc, char **argv)
+{
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int precision = 7, ncode = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:n:M:")) != -1) {
+        switch (opt) {
+        case 'p': precision = atoi(optarg); break;
+        case 'n': ncode = atoi(optarg); break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench hist [-p precision] [-n runs] [-M method|auto]\n");
+            return 1;
+        }
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+
+    tsc_hist_t *hist = tsc_hist_create(precision);
+    tsc_hist_t *dummy = tsc_hist_create(precision);
+    if (hist == NULL || dummy == NULL) {
+        fprintf(stderr, "# Error creating histogram (precision %d..%d bits)\n",
+                TSC_HIST_PRECISION_MIN, TSC_HIST_PRECISION_MAX);
+        exit(1);
+    }
+
+    /* Cost of recording */
+    kernel_result_t res;
+    if (kernel_measure(method, call_hist_record, tsc_hist_local(dummy), overhead, &res) != 0) {
+        tsc_hist_free(dummy);
+        tsc_hist_free(hist);
+        return 1;
+    }
+    printf("# Histogram record overhead statistic (ticks)\n");
+    printf("# [Runs] [Mean]             [StdDev]           [Min]              [Max]\n");
+    printf("  %-6d %-18.2f %-18.2f %-18.2f %-18.2f\n",
+           res.nruns, res.mean, res.stddev, res.min, res.max);
+
+    /* Distribution of CODE() execution time */
+    kernel_measure_runs(method, code_call, NULL, overhead, ncode, hist_sample, tsc_hist_local(hist));
+    tsc_hist_shard_t *snap = tsc_hist_snapshot(hist);
+    if (snap != NULL) {
+        tsc_hist_report(snap, stdout);
+        tsc_hist_shard_free(snap);
+    }
+
+    tsc_hist_free(dummy);
+    tsc_hist_free(hist);
+    return 0;
+}
+
+/* overhead_main: Compares overhead of all TSC read methods. */
+static int overhead_main(int argc, char **argv)
+{
+    prepare_system_for_benchmarking(-1);
 
     stat_sample_t *stat = stat_sample_create();
     if (stat == NULL) {
-        fprintf(stderr, "# No enough memory for statistics");
+        fprintf(stderr, "# No enough memory for statistics\n");
         exit(1);
     }
 
-    int nruns = NRUNS_MIN;
-
-    do {
-        stat_sample_clean(stat);
-        for (int i = 0; i < nruns; ) {
-            /*
-            if (geteuid() == 0)
-                start_low_latency();
-            */
-            t0 = read_tsc_before();
-            CODE();
-            t1 = read_tsc_after();
-            /*
-            if (geteuid() == 0)
-                stop_low_latency();
-            */
-            
-            /* Accumulate only correct results */
-            if (t1 > t0) {
-                if (t1 - t0 > overhead) {
-                    stat_sample_add(stat, (double)(t1 - t0 - overhead));
-                    i++;
+    int rdtscp = is_rdtscp_available();
+    printf("# TSC overhead statistic of read methods (ticks), compiled method: %s\n",
+           TSC_READ_METHOD_NAME);
+    printf("# [Method]       [Runs]  [Min]      [Mean]             [StdDev]           [RSE]    [Max]              [Rejects]\n");
+    for (int i = 0; tsc_read_methods[i].name != NULL; i++) {
+        const tsc_read_method_t *m = &tsc_read_methods[i];
+        if (m->need_rdtscp && !rdtscp) {
+            printf("  %-14s (RDTSCP is not supported)\n", m->name);
+            continue;
+        }
+        int nrejects = m->overhead_stat(stat);
+        printf("  %-14s %-7d %-10.0f %-18.2f %-18.2f %-8.2f %-18.2f %d\n",
+               m->name, stat_sample_size(stat), stat_sample_min(stat),
+               stat_sample_mean_knuth(stat), stat_sample_stddev_knuth(stat),
+               stat_sample_rel_stderr_knuth(stat), stat_sample_max(stat), nrejects);
+    }
+    stat_sample_free(stat);
+    return 0;
+}
+
+/* numa_measure: Measures kernel with working set bound to mem_node. Returns 0 on success. */
+static int numa_measure(const reloc_code_t *code, int mem_node, int nnodes,
+                        const tsc_read_method_t *method, uint64_t overhead,
+                        kernel_result_t *res, int *placed)
+{
+    void *ws = numa_mem_alloc(code->ws_size, mem_node);
+    if (ws == NULL && nnodes == 1)
+        ws = numa_mem_alloc(code->ws_size, -1);     /* Kernel without NUMA support */
+    if (ws == NULL)
+        return -1;
+    void *arg = code->ws_init(ws);
+    if (arg == NULL) {
+        numa_mem_free(ws, code->ws_size);
+        return -1;
+    }
+    *placed = numa_mem_node_of_addr(ws);
+    int rc = kernel_measure(method, code->func, arg, overhead, res);
+    free(arg);
+    numa_mem_free(ws, code->ws_size);
+    return rc;
+}
+
+/*
+ * numa_main: Measures kernels with working set on every node from
+ *            a CPU of every node, prints local/remote penalty matrix.
+ */
+static int numa_main(int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:M:")) != -1) {
+        switch (opt) {
+        case 'k': name = optarg; break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench numa [-k kernel] [-M method|auto]\n");
+            return 1;
+        }
+    }
+    if (name != NULL && reloc_code_find(name) == NULL) {
+        fprintf(stderr, "# Error: unknown relocatable kernel '%s'\n", name);
+        return 1;
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+
+    int nodes[NUMA_MEM_NODES_MAX];
+    int nnodes = numa_mem_nodes(nodes, NUMA_MEM_NODES_MAX);
+    if (nnodes == 1)
+        printf("# Single NUMA node: only local placement is measured\n");
+
+    cpu_set_t saved;
+    sched_getaffinity(0, sizeof(saved), &saved);
+
+    for (int k = 0; reloc_codes[k].name != NULL; k++) {
+        const reloc_code_t *code = &reloc_codes[k];
+        if (name != NULL && strcmp(code->name, name) != 0)
+            continue;
+
+        static double mean[NUMA_MEM_NODES_MAX][NUMA_MEM_NODES_MAX];
+        report_isolation();
+        printf("# NUMA placement: %s, working set %zu KiB (ticks)\n", code->name, code->ws_size / 1024);
+        printf("# [CPU node] [CPU] [Mem node] [Placed] [Runs]  [Mean]             [StdDev]           [RSE]    [Min]\n");
+        for (int r = 0; r < nnodes; r++) {
+            int cpu = numa_mem_node_cpu(nodes[r]);
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (cpu >= 0)
+                CPU_SET(cpu, &set);
+            for (int m = 0; m < nnodes; m++) {
+                kernel_result_t res;
+                int placed;
+                mean[r][m] = 0.0;
+                /* Memory-only node has no CPU to run on */
+                if (cpu < 0 || sched_setaffinity(0, sizeof(set), &set) != 0)
+                    continue;
+                if (numa_measure(code, nodes[m], nnodes, method, overhead, &res, &placed) != 0) {
+                    printf("  %-10d %-5d %-10d (can't allocate memory on the node)\n", nodes[r], cpu, nodes[m]);
+                    continue;
                 }
+                mean[r][m] = res.mean;
+                printf("  %-10d %-5d %-10d %-8d %-7d %-18.2f %-18.2f %-8.2f %-18.2f\n",
+                       nodes[r], cpu, nodes[m], placed, res.nruns, res.mean, res.stddev, res.rse, res.min);
             }
         }
-        /*
-         * Reduce measurement error by increasing number of runs
-         * StdErr = StdDev / sqrt(n)
-         */
-        nruns *= 4;
-        
-    } while (stat_sample_size(stat) < NRUNS_MAX && stat_sample_rel_stderr_knuth(stat) > RSE_MAX);
 
-    printf("# Execution time statistic (ticks)\n");
-    printf("# TSC overhead (ticks): %" PRIu64 "\n", overhead);
-    printf("# [Runs] [First run]        [Mean]             [StdDev]           [StdErr]           [RSE]    [Min]              [Max]\n");
-    printf("  %-6d %-18" PRIu64" %-18.2f %-18.2f %-18.2f %-8.2f %-18.2f %-18.2f\n",
-           stat_sample_size(stat), firstrun, stat_sample_mean_knuth(stat),
-           stat_sample_stddev_knuth(stat), stat_sample_stderr_knuth(stat),
-           stat_sample_rel_stderr_knuth(stat), stat_sample_min(stat), stat_sample_max(stat));
-        
+        /* Penalty: mean time relative to the local placement of the CPU node */
+        printf("# Penalty matrix %s (rows: CPU node, columns: memory node)\n#         ", code->name);
+        for (int m = 0; m < nnodes; m++)
+            printf(" %-7d", nodes[m]);
+        printf("\n");
+        for (int r = 0; r < nnodes; r++) {
+            printf("#  %-6d ", nodes[r]);
+            for (int m = 0; m < nnodes; m++) {
+                if (mean[r][r] > 0.0 && mean[r][m] > 0.0)
+                    printf(" %-7.3f", mean[r][m] / mean[r][r]);
+                else
+                    printf(" %-7s", "-");
+            }
+            printf("\n");
+        }
+    }
+    sched_setaffinity(0, sizeof(saved), &saved);
+    return 0;
+}
+
+/*
+ * pages_main: Measures kernels with working set on 4K, transparent huge
+ *             and hugetlbfs 2M/1G pages.
+ */
+static int pages_main(int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:M:")) != -1) {
+        switch (opt) {
+        case 'k': name = optarg; break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench pages [-k kernel] [-M method|auto]\n");
+            return 1;
+        }
+    }
+    if (name != NULL && reloc_code_find(name) == NULL) {
+        fprintf(stderr, "# Error: unknown relocatable kernel '%s'\n", name);
+        return 1;
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+
+    report_isolation();
+    printf("# Kernels on pages of different size (ticks)\n");
+    printf("# [Kernel]  [WS, KiB]  [Pages] [Got] [Huge, %%] [Runs]  [Mean]             [StdDev]           [RSE]    [Min]              [Mean/4K]\n");
+    for (int k = 0; reloc_codes[k].name != NULL; k++) {
+        const reloc_code_t *code = &reloc_codes[k];
+        if (name != NULL && strcmp(code->name, name) != 0)
+            continue;
+
+        double mean4k = 0.0;
+        for (int kind = PAGE_KIND_4K; kind < PAGE_KIND_COUNT; kind++) {
+            page_buf_t buf;
+            kernel_result_t res;
+            if (page_buf_alloc(&buf, code->ws_size, kind, -1) != 0) {
+                printf("  %-9s %-10zu %-7s (can't allocate memory)\n", code->name,
+                       code->ws_size / 1024, page_kind_name(kind));
+                continue;
+            }
+            void *arg = code->ws_init(buf.addr);
+            if (arg == NULL || kernel_measure(method, code->func, arg, overhead, &res) != 0) {
+                free(arg);
+                page_buf_free(&buf);
+                continue;
+            }
+            if (kind == PAGE_KIND_4K)
+                mean4k = res.mean;
+            printf("  %-9s %-10zu %-7s %-5s %-9.1f %-7d %-18.2f %-18.2f %-8.2f %-18.2f %-8.3f\n",
+                   code->name, code->ws_size / 1024, page_kind_name(kind), page_kind_name(buf.kind),
+                   100.0 * page_buf_huge_bytes(&buf) / buf.size, res.nruns, res.mean, res.stddev,
+                   res.rse, res.min, mean4k > 0.0 ? res.mean / mean4k : 0.0);
+            free(arg);
+            page_buf_free(&buf);
+        }
+    }
+    return 0;
+}
+
+/*
+ * compare_main: Compares the latest results of the store with baseline.
+ *               Exit status is 2 if a regression is found.
+ */
+static int compare_main(int argc, char **argv)
+{
+    enum { NCMPS_MAX = 4096 };
+    const char *store = RESULTS_STORE_DEFAULT;
+    uint64_t build = 0;
+    double z = 3.0, min_change = 1.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:b:z:t:")) != -1) {
+        switch (opt) {
+        case 'f': store = optarg; break;
+        case 'b': build = strtoull(optarg, NULL, 16); break;
+        case 'z': z = atof(optarg); break;
+        case 't': min_change = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: tscbench compare [-f store] [-b baseline_build] [-z z] [-t min_change%%]\n");
+            return 1;
+        }
+    }
+
+    results_record_t *recs;
+    int nrecs = results_store_load(store, &recs);
+    if (nrecs < 0) {
+        fprintf(stderr, "# Error: can't load results store %s\n", store);
+        return 1;
+    }
+    results_cmp_t *cmps = malloc(sizeof(*cmps) * NCMPS_MAX);
+    if (cmps == NULL) {
+        fprintf(stderr, "# No enough memory for comparisons\n");
+        free(recs);
+        return 1;
+    }
+
+    int ncmps = results_compare(recs, nrecs, build, z, min_change, cmps, NCMPS_MAX);
+    printf("# Comparison with baseline: %s, %d records, significance z = %.2f, min change %.2f%%\n",
+           store, nrecs, z, min_change);
+    int nregressions = results_compare_report(cmps, ncmps, stdout);
+    if (nregressions > 0)
+        printf("# [Warning!] Regressions: %d\n", nregressions);
+    free(cmps);
+    free(recs);
+    return nregressions > 0 ? 2 : 0;
+}
+
+/*
+ * modes_main: Finds modes of captured raw values: column of a text file
+ *             (lines beginning with '#' are skipped).
+ */
+static int modes_main(int argc, char **argv)
+{
+    const char *path = NULL;
+    int column = 1;
+    double min_weight = MODE_WEIGHT_MIN * 100.0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:c:w:")) != -1) {
+        switch (opt) {
+        case 'f': path = optarg; break;
+        case 'c': column = atoi(optarg); break;
+        case 'w': min_weight = atof(optarg); break;
+        default:
+            fprintf(stderr, "Usage: tscbench modes [-f raw] [-c column] [-w min_weight%%]\n");
+            return 1;
+        }
+    }
+
+    FILE *f = path != NULL ? fopen(path, "r") : stdin;
+    if (f == NULL || column < 1) {
+        fprintf(stderr, "# Error: can't read raw values from %s\n", path);
+        return 1;
+    }
+
+    int n = 0, maxvalues = 1024;
+    double *values = malloc(sizeof(*values) * maxvalues);
+    char line[1024];
+    while (values != NULL && fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#')
+            continue;
+        char *p = line, *end;
+        double val = 0.0;
+        int col;
+        for (col = 1; col <= column; col++, p = end) {
+            val = strtod(p, &end);
+            if (end == p)
+                break;
+        }
+        if (col <= column)
+            continue;
+        if (n == maxvalues) {
+            maxvalues *= 2;
+            double *tmp = realloc(values, sizeof(*values) * maxvalues);
+            if (tmp == NULL) {
+                free(values);
+                values = NULL;
+                break;
+            }
+            values = tmp;
+        }
+        values[n++] = val;
+    }
+    if (f != stdin)
+        fclose(f);
+    if (values == NULL) {
+        fprintf(stderr, "# No enough memory for raw values\n");
+        return 1;
+    }
+
+    printf("# Raw values: %d\n", n);
+    if (n > 1)
+        report_modes(values, n, min_weight / 100.0);
+    free(values);
+    return 0;
+}
+
+/*
+ * throughput_main: Measures latency and reciprocal throughput of CODE()
+ *                  or relocatable kernel.
+ */
+static int throughput_main(int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int maxlen = 64;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:n:M:")) != -1) {
+        switch (opt) {
+        case 'k': name = optarg; break;
+        case 'n': maxlen = atoi(optarg); break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench throughput [-k kernel] [-n max_stream_length] [-M method|auto]\n");
+            return 1;
+        }
+    }
+
+    void (*func)(void *) = code_call;
+    void *arg = NULL, *ws = NULL;
+    const reloc_code_t *code = NULL;
+    if (name != NULL) {
+        if ( (code = reloc_code_find(name)) == NULL) {
+            fprintf(stderr, "# Error: unknown relocatable kernel '%s'\n", name);
+            return 1;
+        }
+        if ( (arg = reloc_code_arg_create(code, &ws)) == NULL) {
+            fprintf(stderr, "# Error allocating working set of the kernel\n");
+            return 1;
+        }
+        func = code->func;
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL) {
+        if (code != NULL)
+            reloc_code_arg_free(code, arg, ws);
+        return 1;
+    }
+    report_isolation();
+
+    throughput_t tp;
+    int rc = throughput_measure(func, arg, maxlen, method, overhead, &tp);
+    if (rc == 0)
+        throughput_report(&tp, name != NULL ? name : CODE_NAME(CODE), stdout);
+    else
+        fprintf(stderr, "# Error: throughput measurement failed (max stream length >= 2?)\n");
+    if (code != NULL)
+        reloc_code_arg_free(code, arg, ws);
+    return rc == 0 ? 0 : 1;
+}
+
+/* instr_main: Measures latency and reciprocal throughput of instructions. */
+static int instr_main(int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:M:")) != -1) {
+        switch (opt) {
+        case 'i': name = optarg; break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench instr [-i instruction] [-M method|auto]\n");
+            return 1;
+        }
+    }
+    if (name != NULL && instr_bench_find(name) == NULL) {
+        fprintf(stderr, "# Error: unknown instruction '%s', available:", name);
+        for (int i = 0; instr_benches[i].name != NULL; i++)
+            fprintf(stderr, " %s", instr_benches[i].name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+
+    report_isolation();
+    instr_bench_report(NULL, NULL, stdout);
+    for (int i = 0; instr_benches[i].name != NULL; i++) {
+        const instr_bench_t *ib = &instr_benches[i];
+        instr_result_t res;
+        if (name != NULL && strcmp(ib->name, name) != 0)
+            continue;
+        if (instr_bench_measure(ib, method, overhead, &res) != 0) {
+            fprintf(stderr, "# Error measuring instruction %s\n", ib->name);
+            return 1;
+        }
+        instr_bench_report(ib, &res, stdout);
+    }
+    return 0;
+}
+
+/* kernel_by_name: Returns CODE() (name is NULL) or relocatable kernel with its argument. */
+static int kernel_by_name(const char *name, void (**func)(void *), void **arg, void **ws)
+{
+    *func = code_call;
+    *arg = NULL;
+    *ws = NULL;
+    if (name == NULL)
+        return 0;
+
+    const reloc_code_t *code = reloc_code_find(name);
+    if (code == NULL) {
+        fprintf(stderr, "# Error: unknown relocatable kernel '%s'\n", name);
+        return -1;
+    }
+    if ( (*arg = reloc_code_arg_create(code, ws)) == NULL) {
+        fprintf(stderr, "# Error allocating working set of the kernel\n");
+        return -1;
+    }
+    *func = code->func;
+    return 0;
+}
+
+/*
+ * cold_child_main: First call of the kernel in executed child of cold_main
+ *                  (read method is resolved by the parent).
+ */
+static int cold_child_main(int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    void (*func)(void *);
+    void *arg, *ws;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:M:")) != -1) {
+        if (opt == 'k')
+            name = optarg;
+        else if (opt == 'M')
+            method_name = optarg;
+    }
+    int method = find_read_method(method_name);
+    if (method < 0 || kernel_by_name(name, &func, &arg, &ws) != 0)
+        return 1;
+    return cold_trial_first_call(&tsc_read_methods[method], func, arg, COLD_TRIAL_FD) == 0 ? 0 : 1;
+}
+
+/*
+ * cold_main: Measures the first call of a kernel in a fresh process
+ *            (fork or fork + exec per trial).
+ */
+static int cold_main(int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int ntrials = 100, exec = 0, no_aslr = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:n:eAM:")) != -1) {
+        switch (opt) {
+        case 'k': name = optarg; break;
+        case 'M': method_name = optarg; break;
+        case 'n': ntrials = atoi(optarg); break;
+        case 'e': exec = 1; break;
+        case 'A': no_aslr = 1; break;
+        default:
+            fprintf(stderr, "Usage: tscbench cold [-k kernel] [-n trials] [-e] [-A] [-M method|auto]\n");
+            return 1;
+        }
+    }
+    if (no_aslr && !exec)
+        fprintf(stderr, "# [Warning!] -A has effect only with -e: forked child inherits address space\n");
+
+    void (*func)(void *);
+    void *arg, *ws;
+    if (ntrials < 1 || kernel_by_name(name, &func, &arg, &ws) != 0)
+        return 1;
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+
+    char *exec_argv[] = {"/proc/self/exe", "cold-child", "-M", (char *)method->name,
+                         name ? "-k" : NULL, (char *)name, NULL};
+    tsc_hist_t *hist = tsc_hist_create(7);
+    double *values = malloc(sizeof(*values) * ntrials);
+    if (hist == NULL || values == NULL) {
+        fprintf(stderr, "# No enough memory for trials\n");
+        return 1;
+    }
+    tsc_hist_shard_t *shard = tsc_hist_local(hist);
+
+    int n = 0;
+    int64_t minflt_max = 0;
+    double minflt = 0.0, majflt = 0.0, minflt_before = 0.0;
+    for (int i = 0; i < ntrials; i++) {
+        cold_sample_t sample;
+        if (cold_trial_run(method, func, arg, exec ? exec_argv : NULL, no_aslr, &sample) != 0) {
+            fprintf(stderr, "# Error: trial %d failed\n", i);
+            continue;
+        }
+        uint64_t ticks = sample.ticks > overhead ? sample.ticks - overhead : 0;
+        tsc_hist_record(shard, ticks);
+        values[n++] = ticks;
+        minflt += sample.minflt;
+        majflt += sample.majflt;
+        minflt_before += sample.minflt_before;
+        if (sample.minflt > minflt_max)
+            minflt_max = sample.minflt;
+    }
+
+    /* Warm calls of the kernel in this process for comparison */
+    kernel_result_t warm;
+    memset(&warm, 0, sizeof(warm));
+    kernel_measure(method, func, arg, overhead, &warm);
+
+    report_isolation();
+    printf("# First call in fresh process: %s, %s, ASLR %s, trials %d (failed %d)\n",
+           name ? name : CODE_NAME(CODE), exec ? "fork + exec" : "fork",
+           exec && no_aslr ? "off" : "as configured", n, ntrials - n);
+    tsc_hist_shard_t *snap = tsc_hist_snapshot(hist);
+    if (snap != NULL && n > 0) {
+        tsc_hist_report(snap, stdout);
+        printf("# [Warm mean]        [Warm min]         [Cold mean/Warm mean]\n");
+        printf("  %-18.2f %-18.2f %-8.2f\n", warm.mean, warm.min,
+               warm.mean > 0.0 ? (double)snap->sum / snap->count / warm.mean : 0.0);
+        printf("# Page faults: [Minor/call] [Max minor/call] [Major/call] [Minor before call]\n");
+        printf("               %-12.2f %-16" PRId64 " %-12.2f %-12.2f\n", minflt / n, minflt_max,
+               majflt / n, minflt_before / n);
+        if (n > 1)
+            report_modes(values, n, MODE_WEIGHT_MIN);
+    }
+    tsc_hist_shard_free(snap);
+    tsc_hist_free(hist);
+    free(values);
+    return n > 0 ? 0 : 1;
+}
+
+/*
+ * membw_main: Measures memory bandwidth of 1..N threads pinned to CPUs
+ *             of every NUMA node with memory on the node.
+ */
+static int membw_main(int argc, char **argv)
+{
+    enum { NCPUS_MAX = 1024 };
+    size_t array_mb = 64;
+    int maxthreads = 0;
+    int onlynode = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:t:N:")) != -1) {
+        switch (opt) {
+        case 's': array_mb = atoi(optarg); break;
+        case 't': maxthreads = atoi(optarg); break;
+        case 'N': onlynode = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: tscbench membw [-s array_MiB] [-t max_threads] [-N node]\n");
+            return 1;
+        }
+    }
+
+    prepare_system_for_benchmarking(-1);
+    double tsc_hz = measure_tsc_frequency(100);
+    int nodes[NUMA_MEM_NODES_MAX];
+    int nnodes = numa_mem_nodes(nodes, NUMA_MEM_NODES_MAX);
+    int *cpus = malloc(sizeof(*cpus) * NCPUS_MAX);
+    double *triad = malloc(sizeof(*triad) * (NCPUS_MAX + 1));
+    if (cpus == NULL || triad == NULL) {
+        fprintf(stderr, "# No enough memory for CPU list\n");
+        free(cpus);
+        free(triad);
+        return 1;
+    }
+
+    report_isolation();
+    printf("# Memory bandwidth (STREAM kernels, best of phases), arrays 3 x %zu MiB,"
+           " TSC %.2f MHz\n", array_mb, tsc_hz / 1E6);
+    membw_report(NULL, stdout);
+    for (int i = 0; i < nnodes; i++) {
+        if (onlynode >= 0 && nodes[i] != onlynode)
+            continue;
+        int ncpus = numa_mem_node_cpus(nodes[i], cpus, NCPUS_MAX);
+        if (maxthreads > 0 && ncpus > maxthreads)
+            ncpus = maxthreads;
+
+        double best = 0.0;
+        int nmeasured = 0;
+        for (int nthreads = 1; nthreads <= ncpus; nthreads++) {
+            membw_result_t res;
+            if (membw_measure(nodes[i], cpus, nthreads, array_mb << 20, tsc_hz, &res) != 0) {
+                fprintf(stderr, "# Error: bandwidth measurement failed (node %d, %d threads)\n",
+                        nodes[i], nthreads);
+                break;
+            }
+            membw_report(&res, stdout);
+            triad[nthreads] = res.mbs[MEMBW_TRIAD];
+            if (triad[nthreads] > best)
+                best = triad[nthreads];
+            nmeasured = nthreads;
+        }
+
+        /* Saturation: the smallest thread count within 10% of the best triad bandwidth */
+        int saturation = 0;
+        for (int nthreads = 1; nthreads <= nmeasured && saturation == 0; nthreads++) {
+            if (triad[nthreads] >= 0.9 * best)
+                saturation = nthreads;
+        }
+        if (saturation > 0)
+            printf("# Node %d: triad bandwidth saturates at %d threads (%.1f MB/s, best %.1f MB/s)\n",
+                   nodes[i], saturation, triad[saturation], best);
+    }
+    free(cpus);
+    free(triad);
+    return 0;
+}
+
+/*
+ * coherence_main: Measures core-to-core cache line round trip, contended
+ *                 atomics and false sharing on CPUs of the process.
+ */
+static int coherence_main(int argc, char **argv)
+{
+    enum { NCPUS_MAX = 256 };
+    int nrounds = 10000;
+    int maxthreads = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n': nrounds = atoi(optarg); break;
+        case 't': maxthreads = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: tscbench coherence [-n rounds] [-t max_threads]\n");
+            return 1;
+        }
+    }
+
+    /* CPUs are taken before the process is pinned to the measurement CPU */
+    cpu_set_t allowed;
+    int cpus[NCPUS_MAX];
+    int ncpus = 0;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE && ncpus < NCPUS_MAX; cpu++) {
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[ncpus++] = cpu;
+    }
+    prepare_system_for_benchmarking(-1);
+    if (ncpus < 2)
+        printf("# Single CPU: core-to-core transfers can't be measured\n");
+
+    report_isolation();
+    /* Row CPU writes first and measures round trip */
+    printf("# Core-to-core cache line round trip (ticks), %d rounds\n#      ", nrounds);
+    for (int j = 0; j < ncpus; j++)
+        printf(" %-7d", cpus[j]);
+    printf("\n");
+    for (int i = 0; i < ncpus; i++) {
+        printf("  %-4d ", cpus[i]);
+        for (int j = 0; j < ncpus; j++) {
+            double ticks = i != j ? coherence_pingpong(cpus[i], cpus[j], nrounds) : -1.0;
+            if (ticks > 0.0)
+                printf(" %-7.1f", ticks);
+            else
+                printf(" %-7s", "-");
+        }
+        printf("\n");
+    }
+
+    if (maxthreads <= 0 || maxthreads > ncpus)
+        maxthreads = ncpus;
+    printf("# Contention (ticks per operation of a thread), %d operations per thread\n", nrounds);
+    printf("# [Threads] [xadd]       [cas]        [Shared]     [Padded]     [False sharing]\n");
+    for (int n = 1; n <= maxthreads; n++) {
+        double xadd = coherence_atomic(cpus, n, COHERENCE_XADD, nrounds);
+        double cas = coherence_atomic(cpus, n, COHERENCE_CAS, nrounds);
+        double shared, padded;
+        printf("  %-9d %-12.2f %-12.2f", n, xadd, cas);
+        if (coherence_false_sharing(cpus, n, nrounds, &shared, &padded) == 0)
+            printf(" %-12.2f %-12.2f %.2fx\n", shared, padded, padded > 0.0 ? shared / padded : 0.0);
+        else
+            printf(" %-12s %-12s -\n", "-", "-");
+    }
+    return 0;
+}
+
+/*
+ * clocks_main: Cross-validation of clock backends: resolution, overhead
+ *              and time of the same kernel measured by every backend.
+ */
+static int clocks_main(int argc, char **argv)
+{
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:M:")) != -1) {
+        switch (opt) {
+        case 'k': name = optarg; break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench clocks [-k kernel] [-M method|auto]\n");
+            return 1;
+        }
+    }
+
+    void (*func)(void *);
+    void *arg, *ws;
+    if (kernel_by_name(name, &func, &arg, &ws) != 0)
+        return 1;
+    stat_sample_t *stat = stat_sample_create();
+    if (stat == NULL) {
+        fprintf(stderr, "# No enough memory for statistics\n");
+        return 1;
+    }
+    prepare_system_for_benchmarking(-1);
+    uint64_t tsc_overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &tsc_overhead);
+    if (method == NULL) {
+        stat_sample_free(stat);
+        return 1;
+    }
+    clock_backend_set_tsc_method(method);
+
+    enum { NCLOCKS_MAX = 16 };
+    kernel_result_t res[NCLOCKS_MAX];
+    int available[NCLOCKS_MAX];
+    report_isolation();
+    printf("# Clock backends (ns)\n");
+    printf("# [Clock]        [Resolution] [Granularity] [Overhead min] [Overhead mean] [StdDev]       [Rejects]  [Source]\n");
+    for (int i = 0; clock_backends[i].name != NULL && i < NCLOCKS_MAX; i++) {
+        const clock_backend_t *clk = &clock_backends[i];
+        if ( (available[i] = clk->open() == 0) == 0) {
+            printf("  %-14s (not available)\n", clk->name);
+            continue;
+        }
+        double ns = 1E9 / clk->frequency();
+        uint64_t overhead = clk->overhead();
+        int nrejects = clk->overhead_stat(stat);
+        printf("  %-14s %-12.2f %-13.2f %-14.2f %-15.2f %-14.2f %-10d %s\n", clk->name,
+               clk->resolution() * ns, clk->granularity() * ns, overhead * ns,
+               stat_sample_mean_knuth(stat) * ns, stat_sample_stddev_knuth(stat) * ns,
+               nrejects, clk->descr);
+
+        /* Overhead is subtracted as by TSC, kernel time is compared in ns */
+        clk->measure(func, arg, overhead, &res[i]);
+        res[i].mean *= ns;
+        res[i].stddev *= ns;
+        res[i].min *= ns;
+        res[i].max *= ns;
+        clk->close();
+    }
+
+    const double ref = available[0] ? res[0].mean : 0.0;
+    printf("# Kernel %s measured by every clock (ns), deviation from %s\n",
+           name != NULL ? name : CODE_NAME(CODE), clock_backends[0].name);
+    printf("# [Clock]        [Runs]   [Mean]         [StdDev]       [RSE]    [Min]          [Deviation]\n");
+    for (int i = 0; clock_backends[i].name != NULL && i < NCLOCKS_MAX; i++) {
+        if (!available[i])
+            continue;
+        printf("  %-14s %-8d %-14.2f %-14.2f %-8.2f %-14.2f ", clock_backends[i].name, res[i].nruns,
+               res[i].mean, res[i].stddev, res[i].rse, res[i].min);
+        if (ref > 0.0)
+            printf("%+.2f%%\n", (res[i].mean - ref) / ref * 100.0);
+        else
+            printf("-\n");
+    }
     stat_sample_free(stat);
+    if (name != NULL)
+        reloc_code_arg_free(reloc_code_find(name), arg, ws);
+    return 0;
 }
 
-void prepare_system_for_benchmarking()
+/*
+ * noise_main: Measures kernels alone and under every antagonist
+ *             (see interference.c), reports slowdown.
+ */
+static int noise_main(int argc, char **argv)
 {
-    if (geteuid() == 0) {
-        /* Only ROOT can change scheduling policy to RT class */
-        struct sched_param sp;
-        memset(&sp, 0, sizeof(sp));
-        sp.sched_priority = sched_get_priority_max(SCHED_FIFO);
-        if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0)
-            fprintf(stderr, "# [Warning!] Error changing scheduling policy to RT class\n");
+    enum { NKERNELS_MAX = 16 };
+    const char *name = NULL;
+    const char *cpulist = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int only = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:a:c:M:")) != -1) {
+        switch (opt) {
+        case 'k': name = optarg; break;
+        case 'M': method_name = optarg; break;
+        case 'a':
+            if ( (only = antagonist_parse(optarg)) < 0) {
+                fprintf(stderr, "# Error: unknown antagonist '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'c': cpulist = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench noise [-k kernel] [-a llc|membw|avx|syscall] [-c cpus] [-M method|auto]\n");
+            return 1;
+        }
+    }
+
+    /* CPUs are taken before the process is pinned to the measurement CPU */
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+    int cpu = sched_getcpu();
+
+    int siblings[INTERFERENCE_THREADS_MAX], others[INTERFERENCE_THREADS_MAX], chosen[INTERFERENCE_THREADS_MAX];
+    int nsiblings = interference_smt_siblings(cpu, siblings, INTERFERENCE_THREADS_MAX);
+    int nothers = 0, nchosen = 0;
+    for (int c = 0; c < CPU_SETSIZE && nothers < INTERFERENCE_THREADS_MAX; c++) {
+        int sibling = 0;
+        for (int i = 0; i < nsiblings; i++)
+            sibling |= siblings[i] == c;
+        if (CPU_ISSET(c, &allowed) && c != cpu && !sibling)
+            others[nothers++] = c;
+    }
+    if (cpulist != NULL)
+        nchosen = numa_mem_parse_list(cpulist, chosen, INTERFERENCE_THREADS_MAX);
+    for (int i = 0; i < nchosen; i++) {
+        if (chosen[i] == cpu)
+            fprintf(stderr, "# [Warning!] Antagonist shares measurement CPU %d: it runs only"
+                            " when the measuring thread is preempted\n", cpu);
+    }
+    report_isolation();
+    printf("# Measurement CPU %d, SMT siblings %d, other CPUs %d\n", cpu, nsiblings, nothers);
+
+    /* CODE() and relocatable kernels (or the one given) */
+    const char *names[NKERNELS_MAX];
+    int nkernels = 0;
+    if (name == NULL)
+        names[nkernels++] = NULL;
+    for (int k = 0; reloc_codes[k].name != NULL && nkernels < NKERNELS_MAX; k++) {
+        if (name == NULL || strcmp(reloc_codes[k].name, name) == 0)
+            names[nkernels++] = reloc_codes[k].name;
+    }
+    if (nkernels == 0) {
+        fprintf(stderr, "# Error: unknown relocatable kernel '%s'\n", name);
+        return 1;
+    }
+
+    static double slowdown[NKERNELS_MAX][ANTAGONIST_NKINDS];
+    printf("# [Kernel]        [Antagonist] [Threads] [Runs]  [Mean]             [StdDev]           [Min]              [Slowdown]\n");
+    for (int k = 0; k < nkernels; k++) {
+        void (*func)(void *);
+        void *arg, *ws;
+        const char *kname = names[k] != NULL ? names[k] : CODE_NAME(CODE);
+        if (kernel_by_name(names[k], &func, &arg, &ws) != 0)
+            return 1;
+
+        kernel_result_t base, res;
+        kernel_measure(method, func, arg, overhead, &base);
+        printf("  %-15s %-12s %-9d %-7d %-18.2f %-18.2f %-18.2f %-10.3f\n",
+               kname, "none", 0, base.nruns, base.mean, base.stddev, base.min, 1.0);
+        for (int a = 0; a < ANTAGONIST_NKINDS; a++) {
+            slowdown[k][a] = 0.0;
+            if (only >= 0 && a != only)
+                continue;
+            const int *cpus = nchosen > 0 ? chosen : a == ANTAGONIST_AVX ? siblings : others;
+            int ncpus = nchosen > 0 ? nchosen : a == ANTAGONIST_AVX ? nsiblings : nothers;
+            interference_t ifr;
+            if (ncpus == 0) {
+                printf("  %-15s %-12s (no CPU for antagonist: %s)\n", kname, antagonist_name(a),
+                       a == ANTAGONIST_AVX ? "no SMT sibling" : "no other CPUs");
+                continue;
+            }
+            if (interference_start(&ifr, a, cpus, ncpus) != 0) {
+                fprintf(stderr, "# Error: can't start antagonist %s\n", antagonist_name(a));
+                continue;
+            }
+            usleep(20000);      /* Antagonists fill caches and memory bus */
+            kernel_measure(method, func, arg, overhead, &res);
+            interference_stop(&ifr);
+            slowdown[k][a] = base.mean > 0.0 ? res.mean / base.mean : 0.0;
+            printf("  %-15s %-12s %-9d %-7d %-18.2f %-18.2f %-18.2f %-10.3f\n",
+                   kname, antagonist_name(a), ncpus, res.nruns, res.mean, res.stddev, res.min,
+                   slowdown[k][a]);
+        }
+        if (names[k] != NULL)
+            reloc_code_arg_free(reloc_code_find(names[k]), arg, ws);
+    }
+
+    printf("# Slowdown matrix (mean under antagonist / mean alone)\n#  %-15s", "");
+    for (int a = 0; a < ANTAGONIST_NKINDS; a++)
+        printf(" %-8s", antagonist_name(a));
+    printf("\n");
+    for (int k = 0; k < nkernels; k++) {
+        printf("#  %-15s", names[k] != NULL ? names[k] : CODE_NAME(CODE));
+        for (int a = 0; a < ANTAGONIST_NKINDS; a++) {
+            if (slowdown[k][a] > 0.0)
+                printf(" %-8.3f", slowdown[k][a]);
+            else
+                printf(" %-8s", "-");
+        }
+        printf("\n");
+    }
+    return 0;
+}
+
+static void call_empty(void *arg) { empty(); }
+static void call_empty_volatile(void *arg) { empty_volatile(); }
+static void call_prime_numbers(void *arg) { prime_numbers(); }
+static void call_prime_numbers_volatile(void *arg) { prime_numbers_volatile(); }
+static void call_saxpy(void *arg) { saxpy(); }
+static void call_saxpy_volatile(void *arg) { saxpy_volatile(); }
+static void call_dgemm(void *arg) { dgemm(); }
+static void call_dgemm_volatile(void *arg) { dgemm_volatile(); }
+
+/*
+ * barrier_main: Compares kernels kept by volatile data (and -O0) with
+ *               their forms kept by compiler barriers (tscbench_barrier.h).
+ */
+static int barrier_main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        void (*volatile_form)(void *);
+        void (*barrier_form)(void *);
+    } forms[] = {
+        {"empty", call_empty_volatile, call_empty},
+        {"prime_numbers", call_prime_numbers_volatile, call_prime_numbers},
+        {"saxpy", call_saxpy_volatile, call_saxpy},
+        {"dgemm", call_dgemm_volatile, call_dgemm},
+        {NULL, NULL, NULL}
+    };
+    const char *name = NULL;
+    const char *method_name = TSC_READ_METHOD_NAME;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:M:")) != -1) {
+        switch (opt) {
+        case 'k': name = optarg; break;
+        case 'M': method_name = optarg; break;
+        default:
+            fprintf(stderr, "Usage: tscbench barrier [-k empty|prime_numbers|saxpy|dgemm] [-M method|auto]\n");
+            return 1;
+        }
+    }
+
+    prepare_system_for_benchmarking(-1);
+    uint64_t overhead;
+    const tsc_read_method_t *method = select_mode_method(method_name, &overhead);
+    if (method == NULL)
+        return 1;
+    report_isolation();
+    printf("# [Kernel]        [Volatile mean]    [StdDev]           [Barrier mean]     [StdDev]           [Speedup]\n");
+    for (int i = 0; forms[i].name != NULL; i++) {
+        if (name != NULL && strcmp(forms[i].name, name) != 0)
+            continue;
+        kernel_result_t old, new;
+        kernel_measure(method, forms[i].volatile_form, NULL, overhead, &old);
+        kernel_measure(method, forms[i].barrier_form, NULL, overhead, &new);
+        printf("  %-15s %-18.2f %-18.2f %-18.2f %-18.2f ", forms[i].name,
+               old.mean, old.stddev, new.mean, new.stddev);
+        if (new.mean > 0.0)
+            printf("%.2fx\n", old.mean / new.mean);
         else
-            printf("# Scheduling policy is changed to RT class with max priority\n");
-        
-        /* Disable paging to swap area */
-        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
-            fprintf(stderr, "# [Warning!] Error locking pages\n");
-        else 
-            printf("# All pages of process are locked (paging is disabled)\n");
-    } else {
-        fprintf(stderr, "# [Warning!] Benchmark is launched without ROOT permissions:\n"
-                        "#            default scheduler, default priority, pages are not locked\n");
+            printf("-\n");
+    }
+    return 0;
+}
+
+/*
+ * campaign_main: Runs matrix of configurations in parallel on CPUs
+ *                without shared cores (see campaign.c).
+ */
+static int campaign_main(int argc, char **argv)
+{
+    const char *config = NULL;
+    const char *output = "campaign.out";
+    int maxjobs = 0;
+    int by_llc = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:o:j:L")) != -1) {
+        switch (opt) {
+        case 'f': config = optarg; break;
+        case 'o': output = optarg; break;
+        case 'j': maxjobs = atoi(optarg); break;
+        case 'L': by_llc = 1; break;
+        default:
+            fprintf(stderr, "Usage: tscbench campaign -f config [-o output] [-j max_jobs] [-L]\n");
+            return 1;
+        }
+    }
+    if (config == NULL) {
+        fprintf(stderr, "Usage: tscbench campaign -f config [-o output] [-j max_jobs] [-L]\n");
+        return 1;
     }
+
+    campaign_config_t cfg;
+    if (campaign_config_load(config, &cfg) != 0)
+        return 1;
+    snprintf(cfg.kernel, sizeof(cfg.kernel), "%s", CODE_NAME(CODE));
+
+    /* The scheduler is not isolated: every run applies preflight to its CPU */
+    int slots[CAMPAIGN_SLOTS_MAX];
+    int nslots = campaign_slots(by_llc, slots, CAMPAIGN_SLOTS_MAX);
+    if (maxjobs > 0 && nslots > maxjobs)
+        nslots = maxjobs;
+    int nfailed = campaign_run(&cfg, output, slots, nslots, stdout);
+    if (nfailed < 0)
+        return 1;
+    printf("# Results: %s, failed runs: %d\n", output, nfailed);
+    return nfailed > 0 ? 2 : 0;
 }
 
-int main()
+/* preflight_main: Checks environment of the CPU without measurements. */
+static int preflight_main(int argc, char **argv)
+{
+    int cpu = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+        case 'c': cpu = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: tscbench preflight [-c cpu]\n");
+            return 1;
+        }
+    }
+    if (preflight_check(&preflight, cpu) != 0)
+        return 1;
+    preflight_report(&preflight, stdout);
+    return preflight.score == 100 ? 0 : 2;
+}
+
+static const struct {
+    const char *name;
+    int (*main)(int argc, char **argv);
+    const char *descr;
+} modes[] = {
+    {"run", run_main, "measure execution time of CODE() (default)"},
+    {"align", align_main, "measure relocatable kernel at a range of code alignments"},
+    {"overhead", overhead_main, "compare overhead of all TSC read methods"},
+    {"region", region_main, "measure overhead of libtscbench region timing"},
+    {"hist", hist_main, "measure histogram recording cost, percentiles of CODE()"},
+    {"trace", trace_main, "measure overhead of trace events, write trace of CODE()"},
+    {"numa", numa_main, "measure kernels with working set on every NUMA node"},
+    {"pages", pages_main, "measure kernels on 4K, THP, 2M and 1G pages"},
+    {"compare", compare_main, "compare the latest stored results with baseline"},
+    {"throughput", throughput_main, "measure latency and reciprocal throughput of a kernel"},
+    {"instr", instr_main, "measure latency and throughput of instructions"},
+    {"cold", cold_main, "measure the first call of a kernel in a fresh process"},
+    {"cold-child", cold_child_main, NULL},
+    {"barrier", barrier_main, "compare volatile and compiler barrier forms of kernels"},
+    {"campaign", campaign_main, "run matrix of configurations in parallel on isolated cores"},
+    {"clocks", clocks_main, "cross-validate clock backends (TSC, clock_gettime, perf task-clock)"},
+    {"coherence", coherence_main, "measure core-to-core cache line transfers and atomic contention"},
+    {"membw", membw_main, "measure memory bandwidth scaling of 1..N threads"},
+    {"modes", modes_main, "find modes of captured raw values"},
+    {"noise", noise_main, "measure slowdown of kernels under antagonist threads"},
+    {"preflight", preflight_main, "check benchmarking environment of the CPU"},
+    {NULL, NULL, NULL}
+};
+
+static void print_usage()
+{
+    fprintf(stderr, "Usage: tscbench [mode] [options]\n");
+    for (int i = 0; modes[i].name != NULL; i++) {
+        if (modes[i].descr != NULL)
+            fprintf(stderr, "  %-12s %s\n", modes[i].name, modes[i].descr);
+    }
+}
+
+int main(int argc, char **argv)
 {
     if (!is_tsc_available()) {
         fprintf(stderr, "# Error: TSC is not supported by this processor\n");
         exit(1);
     }
 
-    prepare_system_for_benchmarking();
-    run_benchmark();
-   
-    return 0;
+    /* First non-option argument selects mode */
+    const char *mode = "run";
+    if (argc > 1 && argv[1][0] != '-') {
+        mode = argv[1];
+        argc--;
+        argv++;
+    }
+
+    for (int i = 0; modes[i].name != NULL; i++) {
+        if (strcmp(modes[i].name, mode) == 0) {
+            int rc = modes[i].main(argc, argv);
+            preflight_release(&preflight);
+            return rc;
+        }
+    }
+    print_usage();
+    return 1;
 }
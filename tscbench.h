@@ -0,0 +1,94 @@
+/*
+ * tscbench.h: Embeddable region timing API (libtscbench).
+ *
+ * Usage:
+ *     static tscbench_region_t *region;
+ *     if (region == NULL)
+ *         region = tscbench_region("parse");
+ *     uint64_t t0 = tscbench_region_begin();
+ *     ... measured code ...
+ *     tscbench_region_end(region, t0);
+ *     ...
+ *     tscbench_report(stdout);
+ *
+ * TSC overhead is calibrated once per process (by the first call of
+ * tscbench_init() or tscbench_region()). Every thread records into its own
+ * samples, so tscbench_region_end() takes no locks. Region registration
+ * is protected by a mutex and should be done outside of hot code. Samples
+ * of a thread are kept after its exit (merged into retired samples).
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef TSCBENCH_H
+#define TSCBENCH_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "tsc_x86.h"
+#include "mathstat.h"
+#include "tscbench_barrier.h"
+
+#define TSCBENCH_REGIONS_MAX 256
+#define TSCBENCH_REGION_NAME_MAX 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tscbench_region tscbench_region_t;
+
+/* tscbench_init: Calibrates TSC overhead (only once). Returns 0 on success. */
+int tscbench_init();
+
+/* tscbench_overhead: Returns calibrated TSC overhead (ticks). */
+uint64_t tscbench_overhead();
+
+/*
+ * tscbench_region: Returns region with given name, registers new region
+ *                  if it does not exist. Returns the overflow region
+ *                  (measurements are dropped) if limit of regions is
+ *                  exceeded or TSC is not available.
+ */
+tscbench_region_t *tscbench_region(const char *name);
+
+/* tscbench_dropped: Returns number of measurements of the overflow region. */
+uint64_t tscbench_dropped();
+
+/* tscbench_region_name: Returns name of the region. */
+const char *tscbench_region_name(tscbench_region_t *region);
+
+/*
+ * tscbench_region_record: Adds measurement t1 - t0 - overhead to the samples
+ *                         of calling thread.
+ */
+void tscbench_region_record(tscbench_region_t *region, uint64_t t0, uint64_t t1);
+
+/*
+ * tscbench_region_stat: Merges samples of all threads into sample stat.
+ *                       Values are exact if timed threads are quiescent.
+ */
+void tscbench_region_stat(tscbench_region_t *region, stat_sample_t *stat);
+
+/* tscbench_report: Prints statistics of all regions. */
+void tscbench_report(FILE *f);
+
+/* tscbench_region_begin: Starts measurement of the region. */
+static inline uint64_t tscbench_region_begin()
+{
+    return read_tsc_before();
+}
+
+/* tscbench_region_end: Finishes measurement of the region started at t0. */
+static inline void tscbench_region_end(tscbench_region_t *region, uint64_t t0)
+{
+    uint64_t t1 = read_tsc_after();
+    tscbench_region_record(region, t0, t1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSCBENCH_H */
@@ -0,0 +1,52 @@
+/*
+ * tscbench.hpp: C++ scoped timer for libtscbench.
+ *
+ * Usage:
+ *     void handler()
+ *     {
+ *         TSCBENCH_SCOPE("handler");
+ *         ... measured code ...
+ *     }
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef TSCBENCH_HPP
+#define TSCBENCH_HPP
+
+#include "tscbench.h"
+
+namespace tscbench {
+
+/* ScopedTimer: Measures lifetime of the object (RAII). */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(tscbench_region_t *region)
+        : region_(region), t0_(tscbench_region_begin()) {}
+
+    ~ScopedTimer()
+    {
+        tscbench_region_end(region_, t0_);
+    }
+
+private:
+    ScopedTimer(const ScopedTimer &);
+    ScopedTimer &operator=(const ScopedTimer &);
+
+    tscbench_region_t *region_;
+    uint64_t t0_;
+};
+
+} /* namespace tscbench */
+
+#define TSCBENCH_CONCAT_(a, b) a##b
+#define TSCBENCH_CONCAT(a, b) TSCBENCH_CONCAT_(a, b)
+
+/* TSCBENCH_SCOPE: Measures the rest of enclosing scope as region name. */
+#define TSCBENCH_SCOPE(name) \
+    static tscbench_region_t *TSCBENCH_CONCAT(tscbench_region_, __LINE__) = \
+        tscbench_region(name); \
+    tscbench::ScopedTimer TSCBENCH_CONCAT(tscbench_timer_, __LINE__)( \
+        TSCBENCH_CONCAT(tscbench_region_, __LINE__))
+
+#endif /* TSCBENCH_HPP */
@@ -0,0 +1,44 @@
+/*
+ * tscbench_barrier.h: Compiler barriers for measured code.
+ *
+ * Keep the compiler from deleting or hoisting measured work without
+ * volatile (which forces a memory round trip on every access and forbids
+ * vectorization):
+ *     tscbench_do_not_optimize(x) -- value of x is used and may be changed
+ *                                    (the computation of x is kept, x is
+ *                                    not constant-folded afterwards),
+ *     tscbench_escape(p)          -- memory reachable by p is observable,
+ *     tscbench_clobber_memory()   -- all memory may be read and written:
+ *                                    pending stores are done before it.
+ * Barriers emit no instructions.
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#ifndef TSCBENCH_BARRIER_H
+#define TSCBENCH_BARRIER_H
+
+/* tscbench_do_not_optimize: x is an lvalue of scalar type (register or memory operand). */
+#define tscbench_do_not_optimize(x) __asm__ __volatile__ ("" : "+g" (x) :: "memory")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* tscbench_escape: Makes memory pointed by p visible to the outside world. */
+static inline void tscbench_escape(const void *p)
+{
+    __asm__ __volatile__ ("" :: "g" (p) : "memory");
+}
+
+/* tscbench_clobber_memory: Forces all pending stores to be done. */
+static inline void tscbench_clobber_memory()
+{
+    __asm__ __volatile__ ("" ::: "memory");
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSCBENCH_BARRIER_H */
@@ -0,0 +1,119 @@
+/*
+ * tsctrace2json.c: Converts binary TSC trace (tsc_trace.h) to Chrome trace
+ *                  JSON (chrome://tracing, Perfetto).
+ *
+ * Usage: tsctrace2json <trace> [<json>]
+ *
+ * Copyright (C) Mikhail Kurnosov 2014 <mkurnosov@gmail.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "tsc_trace.h"
+
+static char region_names[TSC_TRACE_REGIONS_MAX][TSC_TRACE_REGION_NAME_MAX];
+
+/* print_json_string: Prints string with JSON escaping. */
+static void print_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(out, "\\u%04x", (unsigned char)*s);
+        else
+            fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+int main(int argc, char **argv)
+{
+    static const char phases[] = {'B', 'E', 'i'};
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: tsctrace2json <trace> [<json>]\n");
+        return 1;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        fprintf(stderr, "# Error: can't open %s\n", argv[1]);
+        return 1;
+    }
+    FILE *out = stdout;
+    if (argc > 2 && (out = fopen(argv[2], "w")) == NULL) {
+        fprintf(stderr, "# Error: can't create %s\n", argv[2]);
+        return 1;
+    }
+
+    tsc_trace_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+        memcmp(hdr.magic, TSC_TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != TSC_TRACE_VERSION)
+    {
+        fprintf(stderr, "# Error: %s is not a TSC trace\n", argv[1]);
+        return 1;
+    }
+    for (int i = 0; i < TSC_TRACE_REGIONS_MAX; i++)
+        snprintf(region_names[i], TSC_TRACE_REGION_NAME_MAX, "region%d", i);
+
+    double usec_per_tick = 1E6 / hdr.tsc_hz;
+    uint64_t nevents = 0, ndropped = 0;
+    int first = 1;
+    tsc_trace_block_t block;
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    while (fread(&block, sizeof(block), 1, in) == 1) {
+        if (block.type == TSC_TRACE_BLOCK_REGION && block.size == sizeof(tsc_trace_region_rec_t)) {
+            tsc_trace_region_rec_t rec;
+            if (fread(&rec, sizeof(rec), 1, in) != 1)
+                break;
+            if (rec.id < TSC_TRACE_REGIONS_MAX) {
+                memcpy(region_names[rec.id], rec.name, TSC_TRACE_REGION_NAME_MAX);
+                region_names[rec.id][TSC_TRACE_REGION_NAME_MAX - 1] = '\0';
+            }
+        } else if (block.type == TSC_TRACE_BLOCK_EVENTS) {
+            uint32_t tid;
+            if (fread(&tid, sizeof(tid), 1, in) != 1)
+                break;
+            uint64_t count = (block.size - sizeof(tid)) / sizeof(tsc_trace_rec_t);
+            for (uint64_t i = 0; i < count; i++) {
+                tsc_trace_rec_t rec;
+                if (fread(&rec, sizeof(rec), 1, in) != 1)
+                    break;
+                if (rec.type > TSC_TRACE_INSTANT || rec.region >= TSC_TRACE_REGIONS_MAX)
+                    continue;
+                fprintf(out, "%s{\"name\": ", first ? "" : ",\n");
+                print_json_string(out, region_names[rec.region]);
+                fprintf(out, ", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %" PRIu32 ", \"tid\": %" PRIu32 "%s}",
+                        phases[rec.type], (double)(int64_t)(rec.tsc - hdr.tsc_start) * usec_per_tick,
+                        hdr.pid, tid, rec.type == TSC_TRACE_INSTANT ? ", \"s\": \"t\"" : "");
+                first = 0;
+                nevents++;
+            }
+        } else if (block.type == TSC_TRACE_BLOCK_DROPPED) {
+            uint32_t tid;
+            uint64_t n;
+            if (fread(&tid, sizeof(tid), 1, in) != 1 || fread(&n, sizeof(n), 1, in) != 1)
+                break;
+            ndropped += n;
+        } else {
+            /* Unknown block */
+            if (fseek(in, block.size, SEEK_CUR) != 0)
+                break;
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    fprintf(stderr, "# Events: %" PRIu64 ", dropped: %" PRIu64 ", TSC frequency: %.0f Hz\n",
+            nevents, ndropped, hdr.tsc_hz);
+    fclose(in);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}